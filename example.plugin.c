@@ -0,0 +1,134 @@
+/// @file example.plugin.c
+/// @brief Example plugin which appends the `cksum(1)` checksum, size and path
+/// of new and modified files to a manifest file, as the command
+/// `cksum "$FILEPATH" >> manifest` does. Lines are collected per thread and
+/// appended once the thread runs out of work.
+///
+/// Build with `cc -shared -fPIC -Iinclude -o cksum.so example.plugin.c`, and
+/// configure with `"plugin": {"path": "./cksum.so", "arg": "manifest"}`.
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fsaplugin.h"
+
+const int fsap_version = FSAP_VERSION;
+
+/// @struct state_s
+/// @brief Shared state of the plugin.
+struct state_s {
+  int fd;               ///< Manifest file descriptor, opened for appending
+  pthread_mutex_t lock; ///< Lock for writing to `fd`
+  uint32_t crc[256];    ///< CRC-32 lookup table of the `cksum` polynomial
+};
+
+/// @struct ctx_s
+/// @brief Per-thread context of the plugin.
+struct ctx_s {
+  char* buf;  ///< Manifest lines not yet written
+  size_t len; ///< Number of bytes in `buf`
+  size_t cap; ///< Allocated capacity of `buf`
+};
+
+int fsap_init(const char* arg, void** state) {
+  struct state_s* s;
+  if (arg == NULL || (s = calloc(1, sizeof(*s))) == NULL) return -1;
+  const int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+  if ((s->fd = open(arg, flags, 0644)) < 0) {
+    free(s);
+    return -1;
+  }
+  pthread_mutex_init(&s->lock, NULL);
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i << 24;
+    for (int j = 0; j < 8; j++)
+      c = c & 0x80000000 ? (c << 1) ^ 0x04C11DB7 : c << 1;
+    s->crc[i] = c;
+  }
+  *state = s;
+  return 0;
+}
+
+/// @brief Computes the `cksum` checksum of a file.
+/// @param s The plugin state
+/// @param fp The file path
+/// @param crc Set to the checksum
+/// @param size Set to the file size
+/// @return 0 if successful, otherwise -1.
+static int cksumfile(const struct state_s* s, const char* fp, uint32_t* crc,
+                     uint64_t* size) {
+  int fd;
+  if ((fd = open(fp, O_RDONLY | O_CLOEXEC)) < 0) return -1;
+  unsigned char buf[64 * 1024];
+  uint32_t c = 0;
+  uint64_t n = 0;
+  ssize_t r;
+  while ((r = read(fd, buf, sizeof(buf))) > 0) {
+    for (ssize_t i = 0; i < r; i++) c = (c << 8) ^ s->crc[(c >> 24) ^ buf[i]];
+    n += r;
+  }
+  close(fd);
+  if (r < 0) return -1;
+  for (uint64_t l = n; l != 0; l >>= 8)
+    c = (c << 8) ^ s->crc[(c >> 24) ^ (l & 0xFF)];
+  *crc = ~c;
+  *size = n;
+  return 0;
+}
+
+int fsap_process(void* state, void** ctx, const struct fsap_file_s* file) {
+  if (!(file->event & (FSAP_NEW | FSAP_MOD))) return 0;
+  struct ctx_s* c = *ctx;
+  if (c == NULL && (c = *ctx = calloc(1, sizeof(*c))) == NULL) return -1;
+
+  uint32_t crc;
+  uint64_t size;
+  if (cksumfile(state, file->path, &crc, &size)) return -1;
+
+  const size_t need = strlen(file->path) + 40;
+  if (c->len + need > c->cap) {
+    const size_t cap = (c->len + need) * 2;
+    char* buf;
+    if ((buf = realloc(c->buf, cap)) == NULL) return -1;
+    c->buf = buf, c->cap = cap;
+  }
+  c->len += sprintf(c->buf + c->len, "%" PRIu32 " %" PRIu64 " %s\n", crc,
+                    size, file->path);
+  return 0;
+}
+
+int fsap_flush(void* state, void* ctx, const int last) {
+  struct state_s* s = state;
+  struct ctx_s* c = ctx;
+  if (c == NULL) return 0;
+  int ret = 0;
+  if (c->len > 0) {
+    pthread_mutex_lock(&s->lock);
+    for (size_t off = 0; off < c->len;) {
+      const ssize_t n = write(s->fd, c->buf + off, c->len - off);
+      if (n < 0) {
+        ret = -1;
+        break;
+      }
+      off += n;
+    }
+    pthread_mutex_unlock(&s->lock);
+    c->len = 0;
+  }
+  if (last) {
+    free(c->buf);
+    free(c);
+  }
+  return ret;
+}
+
+void fsap_fini(void* state) {
+  struct state_s* s = state;
+  close(s->fd);
+  pthread_mutex_destroy(&s->lock);
+  free(s);
+}
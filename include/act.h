@@ -0,0 +1,33 @@
+/// @file act.h
+/// @brief Built-in file actions executed in-process, without a child process.
+#ifndef FSAUTOPROC_ACT_H
+#define FSAUTOPROC_ACT_H
+
+/// @enum act_t
+/// @brief Built-in file action types
+enum act_t {
+  ACT_NONE,   ///< Not a built-in action
+  ACT_UNLINK, ///< `unlink <path>...`, removes files, missing files are ignored
+  ACT_COPY,   ///< `copy <src> <dst>`, copies a file's contents and mode
+  ACT_LINK,   ///< `link <src> <dst>`, hard links a file, replacing `dst`
+  ACT_RENAME, ///< `rename <src> <dst>`, renames a file, replacing `dst`
+  ACT_MKDIR,  ///< `mkdir <dir>...`, creates directories and their parents
+  ACT_TOUCH,  ///< `touch <path>...`, creates files or updates their times
+};
+
+/// @brief Looks up a built-in action by name and checks its argument count.
+/// @param name The action name, e.g. "copy"
+/// @param argc The number of arguments following the name
+/// @return The action type, or `ACT_NONE` if \p name is not an action or it
+/// does not accept \p argc arguments.
+enum act_t actparse(const char* name, int argc);
+
+/// @brief Executes a built-in action. Actions with several paths stop at the
+/// first error.
+/// @param act The action type
+/// @param argc The number of arguments
+/// @param argv The arguments following the action name
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+int actrun(enum act_t act, int argc, char* const* argv);
+
+#endif//FSAUTOPROC_ACT_H
@@ -0,0 +1,42 @@
+/// @file arena.h
+/// @brief Bump pointer arena allocator for bulk-freed allocations.
+#ifndef FSAUTOPROC_ARENA_H
+#define FSAUTOPROC_ARENA_H
+
+#include <stddef.h>
+
+struct arenablk_s;
+
+/// @struct arena_s
+/// @brief Arena allocator which carves allocations from a chain of large
+/// blocks. Individual allocations cannot be freed, instead all memory is
+/// released at once with `arenafree()`. A zero-initialized struct is a valid,
+/// empty arena.
+struct arena_s {
+  struct arenablk_s* head; ///< Most recently allocated block, or NULL
+  size_t nextsze;          ///< Capacity of the next block to allocate
+};
+
+/// @brief Allocates \p size bytes of uninitialized memory from the arena. The
+/// returned pointer is aligned to \p align bytes.
+/// @param a The arena to allocate from
+/// @param size The number of bytes to allocate
+/// @param align The required alignment, must be a power of two no greater
+/// than `alignof(max_align_t)`
+/// @return A pointer to the allocated memory, or NULL if a new block could not
+/// be allocated and `errno` is set.
+void* arenaalloc(struct arena_s* a, size_t size, size_t align);
+
+/// @brief Duplicates the null terminated string \p s into the arena.
+/// @param a The arena to allocate from
+/// @param s The string to duplicate
+/// @return A pointer to the duplicated string, or NULL if a new block could not
+/// be allocated and `errno` is set.
+char* arenastrdup(struct arena_s* a, const char* s);
+
+/// @brief Frees all blocks allocated by the arena and resets it to its empty
+/// state. All pointers previously returned by the arena become invalid.
+/// @param a The arena to free
+void arenafree(struct arena_s* a);
+
+#endif//FSAUTOPROC_ARENA_H
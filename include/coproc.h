@@ -0,0 +1,65 @@
+/// @file coproc.h
+/// @brief Long-lived child processes which handle line based requests.
+#ifndef FSAUTOPROC_COPROC_H
+#define FSAUTOPROC_COPROC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/// @def COPROCBUFSZE
+/// @brief Size of the reply buffer of a coprocess, longer reply lines are
+/// truncated
+#define COPROCBUFSZE 256
+
+/// @def COPROCTIMEOUTMS
+/// @brief Default time in milliseconds a coprocess may take to reply
+#define COPROCTIMEOUTMS (60 * 1000)
+
+/// @struct coproc_s
+/// @brief A coprocess whose stdin and stdout are connected to a socket. Each
+/// request is written as a single line, and is answered by a single line. A
+/// zero-initialized struct is a valid, stopped coprocess.
+struct coproc_s {
+  pid_t pid;              ///< Process identifier, or 0 if not running
+  int sock;               ///< Socket connected to the process stdin and stdout
+  long calls;             ///< Number of requests since the process started
+  size_t len;             ///< Number of received bytes in `buf`
+  char buf[COPROCBUFSZE]; ///< Received bytes not yet returned as a reply
+};
+
+/// @brief Starts a coprocess executing the program of \p argv, which is
+/// searched in `PATH`. The process inherits the environment and the stderr
+/// file descriptor \p errfd, and starts with an empty signal mask.
+/// @param cp The stopped coprocess to start
+/// @param argv NULL terminated argument array of the program to execute
+/// @param errfd The file descriptor to use as the process stderr
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+int coprocstart(struct coproc_s* cp, char* const* argv, int errfd);
+
+/// @brief Sends the request line \p req to the coprocess and waits for its
+/// reply line. Requests must not contain line breaks, and a line break is
+/// appended if \p req does not end with one.
+/// @param cp The running coprocess
+/// @param req The request line to send
+/// @param len The length of \p req
+/// @param reply Buffer set to the NUL terminated reply line, without its line
+/// break
+/// @param cap The capacity of \p reply
+/// @param timeout The time in milliseconds to wait for the reply, or 0 to
+/// wait indefinitely
+/// @return 0 if successful, otherwise -1 and `errno` is set, e.g. to `EPIPE` if
+/// the coprocess exited or closed its stdin or stdout, or to `ETIMEDOUT` if it
+/// did not reply in time, in which case it must be stopped.
+int coproccall(struct coproc_s* cp, const char* req, size_t len, char* reply,
+               size_t cap, uint64_t timeout);
+
+/// @brief Stops the coprocess by closing its socket, which it should handle as
+/// the end of its input and exit. A coprocess which has not exited within one
+/// second is killed.
+/// @param cp The coprocess to stop, which is reset to a stopped coprocess
+/// @return The exit status of the coprocess, or -1 if it was not running or
+/// did not exit normally.
+int coprocstop(struct coproc_s* cp);
+
+#endif//FSAUTOPROC_COPROC_H
@@ -4,6 +4,8 @@
 #define FSAUTOPROC_DENG_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 
 struct inode_s;
 struct index_s;
@@ -25,11 +27,87 @@ struct deng_hooks_s {
   void (*nop)(struct inode_s* in);         ///< Unmodified file event
 };
 
+/// @def DENG_OPT_MERGE
+/// @brief Option bit flag for diffing the file system against the previous
+/// index state with a single linear merge pass. Directories are walked in
+/// sorted filepath order and compared against the sorted previous index, which
+/// avoids any lookups into the previous index.
+#define DENG_OPT_MERGE (1 << 0)
+
+/// @def DENG_OPT_DIRSKIP
+/// @brief Option bit flag for skipping the listing of directories whose
+/// modification time and child count are unchanged since the previous index
+/// state. The files of a skipped directory are taken from the previous index
+/// without being stat'ed, unless the directory is due to be re-stat'ed per
+/// `deng_opts_s::restat`.
+#define DENG_OPT_DIRSKIP (1 << 1)
+
+/// @def DENG_OPT_URING
+/// @brief Option bit flag for stat'ing the files of each listed directory in
+/// batches using io_uring on Linux, instead of one blocking stat call per
+/// file. Falls back to stat calls if io_uring is unavailable.
+#define DENG_OPT_URING (1 << 2)
+
+/// @def DENG_OPT_POSTDIRS
+/// @brief Option bit flag for replacing the full walk after the command
+/// execution stage with a pass over the indexed directories. Only directories
+/// whose modification time changed since they were listed, e.g. by commands
+/// creating or removing files, are listed again. Files modified in place by a
+/// command are expected to be re-stat'ed by the command execution itself.
+#define DENG_OPT_POSTDIRS (1 << 3)
+
+/// @def DENG_OPT_DIGEST
+/// @brief Option bit flag for detecting modified files by their content
+/// digest, see `fsdigest()`, instead of only their modification time and
+/// size. Files are digested when indexed, and again only once their stat info
+/// or change tag differ from their node in the previous index state. A file
+/// then only triggers a modified (MOD) event if its digest differs, otherwise
+/// an unmodified (NOP) event. Files without a previous digest are compared by
+/// their stat info. With parallel scan threads, previously indexed files are
+/// digested by the scan threads.
+#define DENG_OPT_DIGEST (1 << 4)
+
 /// @typedef deng_filter_t
-/// @brief Filter function for ignoring files during the search process
+/// @brief Prune filter function for ignoring directories during the search
+/// process. The subtree of an ignored directory is neither listed nor indexed.
+/// Prune filters may be called concurrently by parallel scan threads.
+/// @param fp The directory path to filter
+/// @param post True in the post stage, which revisits the directories already
+/// filtered by the first stage
+/// @return true if the directory should be ignored, otherwise false
+typedef bool (*deng_filter_t)(const char* fp, bool post);
+
+/// @typedef deng_match_t
+/// @brief File filter function for ignoring files during the search process,
+/// which also computes a match mask of each file (e.g. of the command sets
+/// matching it). The mask is stored in the file's node and flagged by
+/// `INODE_MASK`. A file whose node in the previous or current index state
+/// already has a non-zero mask is never ignored, and its mask is reused
+/// without calling the filter.
 /// @param fp The file path to filter
+/// @param mask Set to the match mask of the file
 /// @return true if the file should be ignored, otherwise false
-typedef bool (*deng_filter_t)(const char* fp);
+typedef bool (*deng_match_t)(const char* fp, uint64_t* mask);
+
+/// @struct deng_stats_s
+/// @brief Counters of the entries skipped by the file system search process
+struct deng_stats_s {
+  long pruned;  ///< Directories pruned by `deng_opts_s::prune`
+  long ignored; ///< Files ignored by the file filter function
+  long reused;  ///< Files whose match mask was reused, see `deng_match_t`
+  long digests; ///< Files digested, see `DENG_OPT_DIGEST`
+  long touched; ///< Files whose stat info changed but whose digest did not
+};
+
+/// @struct deng_opts_s
+/// @brief Search options for the file system search process
+struct deng_opts_s {
+  int flags;                  ///< Search option bit flags, see `DENG_OPT_*`
+  unsigned int restat;        ///< Re-stat skipped dir files every n searches
+  int threads;                ///< Parallel scan thread count, if above 1
+  deng_filter_t prune;        ///< Directory prune filter, or NULL
+  struct deng_stats_s* stats; ///< Skipped entry counters, or NULL
+};
 
 /// @brief Recursively scans directory \p sd and compares the file system state
 /// with a previously saved index. Any new, modified, deleted, or unmodified
@@ -40,9 +118,58 @@ typedef bool (*deng_filter_t)(const char* fp);
 /// @param hooks The file event hook functions
 /// @param old The previous index state
 /// @param new The current index state
+/// @param opts The search options
 /// @return 0 if successful, otherwise a non-zero error code.
-int dengsearch(const char* sd, deng_filter_t filter,
+int dengsearch(const char* sd, deng_match_t filter,
                const struct deng_hooks_s* hooks, const struct index_s* old,
-               struct index_s* new);
+               struct index_s* new, const struct deng_opts_s* opts);
+
+/// @brief Reconciles the single path \p fp with the index state \p idx, e.g.
+/// after a change notification for the path. A file is inserted or updated.
+/// A directory is listed and each of its files reconciled, its subdirectories
+/// which are not yet indexed are walked recursively, and its indexed children
+/// which no longer exist are removed. If the path no longer exists, its node
+/// is removed, including the subtree of a removed directory. The directory
+/// node of the path's parent directory is updated. New, modified, and deleted
+/// files are reported via the provided hooks structure, \p hooks. Unmodified
+/// files are not reported, and no notifications are invoked.
+/// @param fp The file or directory path to reconcile
+/// @param filter The file filter function
+/// @param hooks The file event hook functions
+/// @param idx The index state to update
+/// @param opts The search options, only `DENG_OPT_URING`, `DENG_OPT_DIGEST`
+/// and `prune` are used
+/// @return 0 if successful, otherwise a non-zero error code.
+int dengsync(const char* fp, deng_match_t filter,
+             const struct deng_hooks_s* hooks, struct index_s* idx,
+             const struct deng_opts_s* opts);
+
+/// @brief Updates the index state \p new from the previous index state \p old
+/// and a list of changed paths read from stream \p s, one path per line,
+/// instead of scanning the whole directory tree. Each path is reconciled as by
+/// `dengsync`, and nodes of all other paths are carried over from \p old
+/// without being stat'ed. If \p s lists every path changed since \p old was
+/// created, \p new matches the index state a full search would produce. Paths
+/// are accepted relative to \p sd or prefixed by \p sd, and paths outside of
+/// \p sd or within hidden or pruned directories are ignored. New, modified,
+/// and deleted files are reported via \p hooks once all paths are read, by
+/// comparing each reconciled file to \p old. Unmodified files are not reported.
+/// Once the following stage notification returns, the reconciled directories
+/// and the parent directories of the changed paths are listed again if their
+/// modification time changed, as by the post stage of `dengsearch`, so files
+/// created by the commands of the reported files are indexed and reported as
+/// new (NEW) files.
+/// @param sd The search directory of the index states
+/// @param s The stream of changed paths
+/// @param filter The file filter function
+/// @param hooks The file event hook functions
+/// @param old The previous index state
+/// @param new The current index state, interning filepaths of \p old
+/// @param opts The search options, only `DENG_OPT_URING`, `DENG_OPT_DIGEST`
+/// and `prune` are used
+/// @return 0 if successful, otherwise a non-zero error code.
+int dengchanges(const char* sd, FILE* s, deng_match_t filter,
+                const struct deng_hooks_s* hooks, const struct index_s* old,
+                struct index_s* new, const struct deng_opts_s* opts);
 
 #endif//FSAUTOPROC_DENG_H
@@ -3,12 +3,20 @@
 #ifndef FSAUTOPROC_FD_H
 #define FSAUTOPROC_FD_H
 
+struct coproc_s;
+struct pluginctx_s;
+
 /// @struct fdset_s
 /// @brief A set of file descriptors for redirecting writes to stdout and stderr
-/// from child processes to log files.
+/// from child processes to log files. The set also holds the coprocesses and
+/// plugin contexts of the thread it belongs to, see `lcmdrelease`.
 struct fdset_s {
-  int out; ///< File descriptor for writing to stdout
-  int err; ///< File descriptor for writing to stderr
+  int out;                      ///< File descriptor for writing to stdout
+  int err;                      ///< File descriptor for writing to stderr
+  struct coproc_s* coprocs;     ///< Coprocesses of the thread, or NULL
+  int ncoprocs;                 ///< Allocated length of `coprocs`
+  struct pluginctx_s* plugctxs; ///< Plugin contexts of the thread, or NULL
+  int nplugctxs;                ///< Allocated length of `plugctxs`
 };
 
 /// @brief Initializes stdout/stderr files used for redirecting output from a
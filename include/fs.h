@@ -6,37 +6,76 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+struct fsstat_s;
+
 /// @typedef fswalkfn_t
 /// @brief Callback function used by `fswalk` to process files and directories.
 /// @param fp The file or directory path to process
+/// @param st The stat info of the file or directory if the `FSWALK_STAT`
+/// option is set, otherwise NULL
 /// @param udata User data passed to the callback function
 /// @return 0 if the walk should continue, otherwise a non-zero value to stop
-typedef int (*fswalkfn_t)(const char* fp, void* udata);
+typedef int (*fswalkfn_t)(const char* fp, const struct fsstat_s* st,
+                          void* udata);
+
+/// @def FSWALK_SORTED
+/// @brief `fswalk` option bit flag for invoking the callbacks in sorted order.
+/// Entries are sorted by name, with directory names compared as if they had a
+/// trailing slash. The filepaths passed to the callbacks, and those of any
+/// recursive walk started by \p dirfn, are then in `strcmp(3)` order.
+#define FSWALK_SORTED (1 << 0)
+
+/// @def FSWALK_STAT
+/// @brief `fswalk` option bit flag for stat'ing each entry relative to the
+/// open directory being walked, and passing the stat info to the callbacks.
+/// This avoids resolving each entry's full filepath again to stat it.
+/// Entries which can no longer be stat'ed are logged and skipped.
+#define FSWALK_STAT (1 << 1)
 
-/// @brief Recursively walks the single directory described by \p dir and calls
-/// \p filefn for each file found and \p dirfn for each directory encountered.
+/// @def FSWALK_URING
+/// @brief `fswalk` option bit flag for stat'ing the entries of each directory
+/// in batches using io_uring, see `uringstat`, once the directory has been
+/// listed. Requires `FSWALK_STAT`. Falls back to synchronous stat calls if
+/// io_uring is unavailable.
+#define FSWALK_URING (1 << 2)
+
+/// @brief Walks the single directory described by \p dir and calls \p filefn
+/// for each file found and \p dirfn for each directory encountered. Entries
+/// are streamed to the callbacks as they are read from the directory unless
+/// the `FSWALK_SORTED` option is set. Hidden entries (names beginning with
+/// `.`) are skipped. Entry types are taken from the directory entry where
+/// supported by the file system, otherwise the entry is stat'ed. Symbolic
+/// links are followed. A walk started by \p dirfn for the directory passed to
+/// it opens that directory relative to the walked directory, which is kept
+/// open during the callbacks.
 /// @param dir The directory to walk
 /// @param filefn The function to call for each file found. The filepath is
-/// passed as the first argument. If the function returns a non-zero value, the
-/// walk is terminated and the same value is returned by `fswalk`.
+/// passed as the first argument and is only valid for the duration of the
+/// call. If the function returns a non-zero value, the walk is terminated and
+/// the same value is returned by `fswalk`.
 /// @param dirfn The function to call for each directory found. The directory
-/// path is passed as the first argument. If the function returns a non-zero
-/// value, the walk is terminated and the same value is returned by `fswalk`.
+/// path is passed as the first argument and is only valid for the duration of
+/// the call. If the function returns a non-zero value, the walk is terminated
+/// and the same value is returned by `fswalk`.
 /// @param udata User data to pass to \p filefn and \p dirfn
+/// @param flags Walk option bit flags, see `FSWALK_*`
 /// @return If successful, 0 is returned. An internal `fswalk` error will return
 /// a value of -1 and `errno` is set. Otherwise the return value of the first
 /// non-zero \p filefn or \p dirfn call is returned.
-int fswalk(const char* dir, fswalkfn_t filefn, fswalkfn_t dirfn, void* udata);
+int fswalk(const char* dir, fswalkfn_t filefn, fswalkfn_t dirfn, void* udata,
+           int flags);
 
 /// @struct fsstat_s
 /// @brief Stat structure for storing the last modified time and file size.
 struct fsstat_s {
   uint64_t lmod; ///< Last modified time in milliseconds since epoch
   uint64_t fsze; ///< File size in bytes
+  uint64_t ctag; ///< Change tag, see `fschangetag()`
 };
 
-/// @brief `fsstateql()` compares the fields of two `struct fsstat_s` values for
-/// equality. Two structs with the same values are considered equal.
+/// @brief `fsstateql()` compares the last modified time and file size of two
+/// `struct fsstat_s` values for equality. The change tag is not compared, so
+/// e.g. changing the permissions of a file does not make it unequal.
 /// @param a The first `struct fsstat_s` to compare
 /// @param b The second `struct fsstat_s` to compare
 /// @return Returns true if the two `struct fsstat_s` values are equal.
@@ -50,4 +89,31 @@ bool fsstateql(const struct fsstat_s* a, const struct fsstat_s* b);
 /// returned and `errno` is set.
 int fsstat(const char* fp, struct fsstat_s* s);
 
+/// @brief Populates all fields of a given \p fsstat_s structure for the file
+/// described by the filepath \p fp, and determines whether it is a directory.
+/// @param fp The filepath to fstat
+/// @param s The `struct fsstat_s` to populate
+/// @param dir Set to true if the file is a directory
+/// @return If successful, \p s and \p dir are populated and 0 is returned.
+/// Otherwise -1 is returned and `errno` is set.
+int fsstatdir(const char* fp, struct fsstat_s* s, bool* dir);
+
+/// @brief Computes the change tag of a file from its inode number and status
+/// change time. The tag changes whenever the file is replaced by another file
+/// or its content or metadata is changed, even if its last modified time is
+/// preserved or restored.
+/// @param ino The inode number
+/// @param csec The seconds of the status change time
+/// @param cnsec The nanoseconds of the status change time
+/// @return The change tag.
+uint64_t fschangetag(uint64_t ino, int64_t csec, uint32_t cnsec);
+
+/// @brief Computes the XXH64 digest of the content of file \p fp, which is
+/// read sequentially in fixed-size blocks.
+/// @param fp The filepath to digest
+/// @param digest Set to the digest
+/// @return If successful, \p digest is set and 0 is returned. Otherwise -1 is
+/// returned and `errno` is set.
+int fsdigest(const char* fp, uint64_t* digest);
+
 #endif// FSAUTOPROC_FS_H
@@ -0,0 +1,78 @@
+/// @file fsaplugin.h
+/// @brief Plugin interface for processing files in-process. A plugin is a
+/// shared object which is loaded once at startup and called directly by the
+/// worker threads, instead of executing a command for each file.
+///
+/// A plugin exports `fsap_version` and `fsap_process`, and optionally
+/// `fsap_init`, `fsap_flush` and `fsap_fini`. `fsap_process` is called
+/// concurrently by the worker threads, each with its own context pointer,
+/// so a plugin only needs to synchronize access to its shared state. Work may
+/// be held in the context of a thread and completed by `fsap_flush`, which is
+/// called by the same thread once it runs out of queued work, and before it
+/// exits.
+#ifndef FSAUTOPROC_FSAPLUGIN_H
+#define FSAUTOPROC_FSAPLUGIN_H
+
+#include <stdint.h>
+
+/// @def FSAP_VERSION
+/// @brief Version of the plugin interface, which a plugin exports as
+/// `fsap_version`
+#define FSAP_VERSION 1
+
+/// @def FSAP_NEW
+/// @brief File event type of new files
+#define FSAP_NEW (1 << 0)
+
+/// @def FSAP_MOD
+/// @brief File event type of modified files
+#define FSAP_MOD (1 << 1)
+
+/// @def FSAP_DEL
+/// @brief File event type of deleted files
+#define FSAP_DEL (1 << 2)
+
+/// @def FSAP_NOP
+/// @brief File event type of unmodified files
+#define FSAP_NOP (1 << 3)
+
+/// @struct fsap_file_s
+/// @brief A file event passed to a plugin.
+struct fsap_file_s {
+  const char* path; ///< File path, including the search directory
+  int event;        ///< File event type, see `FSAP_*`
+  uint64_t mtime;   ///< Last modification time in ms, as of the search
+  uint64_t size;    ///< File size in bytes, as of the search
+};
+
+/// @brief Version of the plugin interface the plugin is built against, which
+/// must be `FSAP_VERSION`.
+extern const int fsap_version;
+
+/// @brief Initializes the plugin once, before any other function is called.
+/// @param arg The `arg` string of the plugin configuration, or NULL
+/// @param state Set to the shared state passed to the other functions
+/// @return 0 if successful, otherwise non-zero to abort startup.
+int fsap_init(const char* arg, void** state);
+
+/// @brief Processes a file event.
+/// @param state The shared state set by `fsap_init`
+/// @param ctx The context of the calling thread, which is NULL on its first
+/// call and may be set by the plugin
+/// @param file The file event
+/// @return 0 if successful, otherwise a non-zero status which is logged.
+int fsap_process(void* state, void** ctx, const struct fsap_file_s* file);
+
+/// @brief Completes the work held in the context of the calling thread.
+/// @param state The shared state set by `fsap_init`
+/// @param ctx The context of the calling thread
+/// @param last Non-zero if the thread is exiting, in which case the plugin
+/// must also free \p ctx
+/// @return 0 if successful, otherwise a non-zero status which is logged.
+int fsap_flush(void* state, void* ctx, int last);
+
+/// @brief Frees the shared state once all threads have exited.
+/// @param state The shared state set by `fsap_init`
+void fsap_fini(void* state);
+
+#endif//FSAUTOPROC_FSAPLUGIN_H
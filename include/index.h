@@ -3,27 +3,71 @@
 #ifndef FSAUTOPROC_INDEX_H
 #define FSAUTOPROC_INDEX_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#include "arena.h"
 #include "fs.h"
 
+/// @def INODE_DIR
+/// @brief Node bit flag for directory nodes. Directory nodes record the last
+/// modified time of the directory in `st.lmod` and its number of indexed
+/// direct children (files and directories) in `st.fsze`.
+#define INODE_DIR (1 << 0)
+
+/// @def INODE_MASK
+/// @brief Node bit flag for file nodes whose `mask` is set. The mask is
+/// computed by the file filter of the search (e.g. the command sets matching
+/// the file) and is only valid as long as the index's `maskhash` is unchanged.
+#define INODE_MASK (1 << 1)
+
+/// @def INODE_DIGEST
+/// @brief Node bit flag for file nodes whose `digest` is set. The digest is
+/// the content digest of the file, see `fsdigest()`, as of the node's stat
+/// info including its change tag, see `indexsetstat()`.
+#define INODE_DIGEST (1 << 2)
+
 /// @struct inode_s
 /// @brief Individual file node in the index map.
 struct inode_s {
-  char* fp;             ///< File path (string duplicated)
-  struct fsstat_s st;   ///< File stat info structure
-  struct inode_s* next; ///< Next node in the index map
+  char* fp;           ///< File path (arena allocated or interned)
+  struct fsstat_s st; ///< File stat info structure
+  uint32_t flags;     ///< Node bit flags, see `INODE_*`
+  uint32_t age;       ///< Directory nodes only, consecutive runs skipped
+  uint64_t mask;      ///< File nodes only, match mask if `INODE_MASK` is set
+  uint64_t digest;    ///< File nodes only, digest if `INODE_DIGEST` is set
 };
 
-/// @def INDEXBUCKETS
-/// @brief The fixed number of buckets in the index map.
-#define INDEXBUCKETS 64
+/// @struct islot_s
+/// @brief Open addressing hash table slot. The full 64-bit hash of the node's
+/// filepath is stored alongside the node pointer so most probe mismatches are
+/// rejected without dereferencing the node or comparing strings.
+struct islot_s {
+  uint64_t hash;        ///< Filepath hash of the node
+  struct inode_s* node; ///< Node pointer, or NULL if the slot is unused
+};
 
 /// @struct index_s
-/// @brief Index map structure for storing file nodes.
+/// @brief Index map structure for storing file nodes. Nodes and their filepath
+/// strings are allocated from arenas owned by the index and are freed all at
+/// once by `indexfree()`. A zero-initialized struct is a valid, empty index.
 struct index_s {
-  struct inode_s* buckets[INDEXBUCKETS]; ///< Array of index buckets
-  long size;                            ///< Number of sum nodes in the index
+  struct islot_s* slots; ///< Linear probing slot array (NULL until first put)
+  long cap;              ///< Slot array capacity, always a power of two
+  long size;             ///< Number of sum nodes in the index
+  long dirs;             ///< Number of directory nodes included in `size`
+  struct arena_s nodes;  ///< Arena for node structs
+  struct arena_s strs;   ///< Arena for filepath strings
+  void* map;             ///< Private mapping of a binary index file, or NULL
+  size_t mapsze;         ///< Size of the mapping in bytes
+  uint64_t maskhash;     ///< Identifies how node masks are computed
+  struct inode_s** view; ///< Sorted nodes for `indexsubtree`, or NULL
+  long viewlen;          ///< Number of nodes in `view`
+  long stale;            ///< Number of nodes removed since `view` was built
+  struct inode_s** adds; ///< Nodes inserted since `view` was built
+  long nadds;            ///< Number of nodes in `adds`
+  long capadds;          ///< Allocated capacity of `adds`
 };
 
 /// @brief Searches the index for a node with a matching filepath.
@@ -33,32 +77,108 @@ struct index_s {
 struct inode_s* indexfind(const struct index_s* idx, const char* fp);
 
 /// @brief Flattens the index map into a sorted array of nodes (by filepath).
-/// The list is then written to the file stream and freed.
+/// The list is then written to the file stream in the text format and freed.
 /// @param idx The index to flatten
 /// @param s The file stream to write to
 /// @return If successful, 0 is returned. Otherwise, -1 is returned and `errno`
 /// is set.
 int indexwrite(struct index_s* idx, FILE* s);
 
+/// @brief Flattens the index map into a sorted array of nodes (by filepath).
+/// The list is then written to the file stream in the versioned binary format
+/// and freed. Binary index files are memory mapped by `indexread()` and their
+/// records are used in place, without parsing or per-record allocation.
+/// @param idx The index to flatten
+/// @param s The file stream to write to
+/// @return If successful, 0 is returned. Otherwise, -1 is returned and `errno`
+/// is set.
+int indexwritebin(struct index_s* idx, FILE* s);
+
 /// @brief Reads a file stream and deserializes the contents into a map of
-/// individual file nodes.
+/// individual file nodes. The binary format is detected by its header magic,
+/// otherwise the stream is read as the text format. A binary index remains
+/// mapped until `indexfree()` is called. Node masks are discarded unless the
+/// stream was written with the same `maskhash` as set in \p idx.
 /// @param idx The index to populate
 /// @param s The file stream to read from
 /// @return If successful, 0 is returned. Otherwise, -1 is returned and `errno`
 /// is set.
 int indexread(struct index_s* idx, FILE* s);
 
-/// @brief Copies the node and inserts it into the index mapping.
+/// @brief Copies the node, including its filepath string, and inserts it into
+/// the index mapping. The caller retains ownership of `node.fp`.
 /// @param idx The index to insert into
 /// @param node The node to insert
 /// @return The pointer to the new node in the index map, otherwise NULL is
 /// returned and `errno` is set.
 struct inode_s* indexput(struct index_s* idx, struct inode_s node);
 
-/// @brief Frees all nodes in the index map.
+/// @brief Copies the node and inserts it into the index mapping without
+/// copying its filepath string. This is used to intern filepaths already owned
+/// by another index (e.g. a previous index state) instead of duplicating them.
+/// @param idx The index to insert into
+/// @param node The node to insert, `node.fp` must outlive the index
+/// @return The pointer to the new node in the index map, otherwise NULL is
+/// returned and `errno` is set.
+struct inode_s* indexputref(struct index_s* idx, struct inode_s node);
+
+/// @brief Updates the stat info of a file node. Its content digest is
+/// discarded unless the stat info, including the change tag, is unchanged.
+/// @param node The node to update
+/// @param st The new stat info
+void indexsetstat(struct inode_s* node, const struct fsstat_s* st);
+
+/// @brief Removes the node with a matching filepath from the index mapping.
+/// The node itself remains allocated until `indexfree()` is called, so the
+/// returned pointer may still be passed to file event hooks.
+/// @param idx The index to remove from
+/// @param fp The filepath of the node to remove
+/// @return The removed node if a match is found, otherwise NULL.
+struct inode_s* indexdel(struct index_s* idx, const char* fp);
+
+/// @brief Copies all nodes of \p src, including their filepath strings, into
+/// \p dst. The copy shares no memory with \p src or any index whose filepaths
+/// \p src interned, so those indexes may then be freed.
+/// @param dst The index to insert into
+/// @param src The index to copy
+/// @return If successful, 0 is returned. Otherwise, -1 is returned and `errno`
+/// is set.
+int indexcopy(struct index_s* dst, const struct index_s* src);
+
+/// @brief Copies all nodes of \p src into \p dst without copying their
+/// filepath strings, which are interned as by `indexputref()`.
+/// @param dst The index to insert into
+/// @param src The index to copy, which must outlive \p dst
+/// @return If successful, 0 is returned. Otherwise, -1 is returned and `errno`
+/// is set.
+int indexcopyref(struct index_s* dst, const struct index_s* src);
+
+/// @brief Frees all nodes in the index map and resets it to an empty index.
 /// @param idx The index to free
 void indexfree(struct index_s* idx);
 
+/// @brief Flattens the index map into an array of nodes sorted by filepath,
+/// using `strcmp(3)` ordering. The list is dynamically allocated and must be
+/// freed by the caller. Array size is determined by the `size` field in the
+/// index struct.
+/// @param idx The index to flatten
+/// @return If successful, a pointer to an array of size `idx->size` is
+/// returned. Otherwise, NULL is returned and `errno` is set.
+struct inode_s** indexsorted(const struct index_s* idx);
+
+/// @brief Lists the nodes within the subtree of directory \p dir, i.e. the
+/// nodes whose filepath starts with \p dir followed by a slash, sorted by
+/// filepath. The subtree is found by a binary search of a sorted view of the
+/// index, which is built by the first call and then tracks inserted and
+/// removed nodes, so it is only rebuilt once they make up an eighth of it.
+/// The list is dynamically allocated and must be freed by the caller.
+/// @param idx The index to search
+/// @param dir The directory path, without trailing slash
+/// @param n Set to the number of nodes in the list
+/// @return If successful, a pointer to an array of size \p n is returned.
+/// Otherwise, NULL is returned and `errno` is set.
+struct inode_s** indexsubtree(struct index_s* idx, const char* dir, long* n);
+
 /// @brief Flattens the index map into an unsorted array of nodes.
 /// The list is dynamically allocated and must be freed by the caller. Array
 /// size is determined by the `size` field in the index struct.
@@ -3,14 +3,20 @@
 #ifndef FSAUTOPROC_LCMD_H
 #define FSAUTOPROC_LCMD_H
 
+#include <pthread.h>
 #include <regex.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "act.h"
 #include "sl.h"
 
 struct inode_s;
 struct fdset_s;
+struct mre_s;
+struct mrestats_s;
+struct plugin_s;
 
 /// @def LCTRIG_NEW
 /// @brief Trigger bit flag for new file events
@@ -40,15 +46,103 @@ struct fdset_s;
 /// @brief Option bit flag for printing commands to stdout before execution
 #define LCTOPT_VERBOSE (1 << 8)
 
+/// @def LCBATCHES
+/// @brief Number of file event types with a separate batch per command set
+#define LCBATCHES 4
+
+/// @def LCBATCHCOUNT
+/// @brief Default maximum number of files per batch
+#define LCBATCHCOUNT 64
+
+/// @def LCBATCHBYTES
+/// @brief Default maximum sum of file path lengths per batch, including
+/// separators. Kept below the 128 KiB limit of a single `FILEPATHS=...`
+/// environment string on Linux (`MAX_ARG_STRLEN`).
+#define LCBATCHBYTES (120 * 1024)
+
+/// @enum lcmdpass_t
+/// @brief Modes of passing the file paths of a batch to its commands
+enum lcmdpass_t {
+  LCPASS_ENV,  ///< Newline separated in the `FILEPATHS` environment variable
+  LCPASS_FILE, ///< NUL separated in a file named by `FILELIST`
+  LCPASS_ARGS, ///< As positional parameters (`"$@"`) of the shell
+};
+
+/// @struct lcmdbatch_s
+/// @brief Files accumulated for a batched command set and file event type.
+struct lcmdbatch_s {
+  struct inode_s** nodes; ///< Accumulated file nodes
+  int len;                ///< Number of accumulated file nodes
+  int cap;                ///< Allocated capacity of `nodes`
+  size_t bytes;           ///< Sum of file path lengths, including separators
+  uint64_t since;         ///< Time the first file was accumulated in ms
+};
+
+/// @struct lcmdbatches_s
+/// @brief Batch settings and pending batches of a command set.
+struct lcmdbatches_s {
+  int count;                             ///< Maximum files per batch, or 0
+  size_t bytes;                          ///< Maximum sum of file path lengths
+  uint64_t ms;                           ///< Maximum age of a batch in ms, or 0
+  enum lcmdpass_t pass;                  ///< File path passing mode
+  struct lcmdbatch_s pending[LCBATCHES]; ///< Pending batch per event type
+  pthread_mutex_t lock;                  ///< Lock for `pending`
+};
+
+/// @enum lcmdvar_t
+/// @brief Placeholders of argv templates, expanded from the file path
+enum lcmdvar_t {
+  LCVAR_NONE,    ///< No placeholder, literal text only
+  LCVAR_PATH,    ///< `{path}`, the file path
+  LCVAR_DIR,     ///< `{dir}`, the parent directory path
+  LCVAR_STEM,    ///< `{stem}`, the file name without its extension
+  LCVAR_EXT,     ///< `{ext}`, the file name extension including the dot
+  LCVAR_RELPATH, ///< `{relpath}`, the file path relative to the search dir
+  LCVAR_RELDIR,  ///< `{reldir}`, the parent directory of `{relpath}`
+  LCVAR_COUNT,   ///< Number of placeholder types
+};
+
+/// @struct lcmdseg_s
+/// @brief Segment of an argument in an argv template, a literal text followed
+/// by an optional placeholder.
+struct lcmdseg_s {
+  const char* lit;    ///< Literal text, not NUL terminated
+  size_t len;         ///< Length of `lit`
+  enum lcmdvar_t var; ///< Placeholder following the literal text
+  bool last;          ///< Segment is the last of its argument
+};
+
+/// @struct lcmdargv_s
+/// @brief Command parsed into an argv template, which is executed directly
+/// without a shell.
+struct lcmdargv_s {
+  char* buf;              ///< Copy of the command which `segs` point into
+  struct lcmdseg_s* segs; ///< Segments of all arguments in order
+  int nsegs;              ///< Number of segments
+  int argc;               ///< Number of arguments
+  bool vars;              ///< The template contains placeholders
+  enum act_t act;         ///< Built-in action of a `@` command, or ACT_NONE
+};
+
 /// @struct lcmdset_s
 /// @brief A set of system commands to execute when a file event of a specific
 /// type and file path is triggered.
 struct lcmdset_s {
-  int onflags;         ///< Command set trigger bit flags
-  regex_t** fpatterns; ///< Compiled regex patterns used for file path matching
-  slist_t* syscmds;    ///< Commands to pass to `system(3)`
-  char* name;          ///< Command set name or description for logging
-  uint64_t msspent;    ///< Sum milliseconds spent executing commands
+  int onflags;                ///< Command set trigger bit flags
+  regex_t** fpatterns;        ///< Compiled regex patterns matching file paths
+  regex_t** dpatterns;        ///< Compiled regex patterns for pruned dirs
+  slist_t* syscmds;           ///< Commands to pass to `/bin/sh -c`
+  struct lcmdargv_s** argvs;  ///< Parsed `syscmds` with `exec` or actions
+  char* name;                 ///< Command set name or description for logging
+  uint64_t msspent;           ///< Sum milliseconds spent executing commands
+  struct lcmdbatches_s batch; ///< Batch settings, see `lcmdparsebatch`
+  int coprocid;               ///< Coprocess index of `syscmds[0]`, or -1
+  long coprocmax;             ///< Requests per coprocess before a restart
+  uint64_t coproctimeout;     ///< Reply timeout of coprocesses in ms, or 0
+  struct plugin_s* plugin;    ///< Plugin called before `syscmds`, or NULL
+  int pluginid;               ///< Plugin context index, or -1
+  struct mre_s* matcher;      ///< Matcher of all sets' `fpatterns`, shared
+  char* searchdir;            ///< Search directory, see `{relpath}`
 };
 
 /// @brief Iterates and frees all memory allocated by the command set array.
@@ -68,31 +162,122 @@ void lcmdfree_r(struct lcmdset_s** cs);
 /// - `nop`: Trigger on no operation
 /// The `patterns` array must contain one or more strings that are used to match
 /// the file path. The `commands` array must contain one or more strings that are
-/// passed to `system(3)` for execution.
+/// passed to `/bin/sh -c` for execution, or with `exec` set to true, parsed as
+/// argv templates and executed directly, see `lcmdparseargv`. Commands
+/// starting with `@` are built-in actions run in-process. An optional
+/// `batch` setting runs the commands once for many files, see
+/// `lcmdparsebatch`. With `coproc` set, the commands are started once per
+/// worker thread and handle one request line per file, see `lcmdparsecoproc`.
+/// A `plugin` shared object is called in-process for each file before the
+/// commands, in which case `commands` is optional, see `lcmdparseplugin`.
+/// Each object may also contain a `prune` array of patterns matched against
+/// directory paths, see `lcmdprune`. An object containing only the `prune`
+/// array never matches any file.
 /// @param fp The file path to parse
+/// @param sd The search directory, which `{relpath}` placeholders are
+/// relative to
 /// @return An array of command sets if successful, otherwise NULL.
-struct lcmdset_s** lcmdparse(const char* fp);
+struct lcmdset_s** lcmdparse(const char* fp, const char* sd);
 
 /// @brief Checks if the provided file path matches any of the file patterns in
-/// the command set.
+/// the command set. The patterns of all command sets are matched in a single
+/// pass by their combined matcher, see `mre.h`.
 /// @param cs The command set array to filter
 /// @param fp The file path to match
 /// @return true if the file path matches any file pattern, otherwise false
 bool lcmdmatchany(struct lcmdset_s** cs, const char* fp);
 
+/// @brief Computes the match mask of the provided file path, which has bit `i`
+/// set if the file patterns of command set `i` match it. The last bit is
+/// shared by all command sets from index 63 on, whose patterns `lcmdexec`
+/// matches again one set at a time. The mask is 0 if no command set matches.
+/// @param cs The command set array to match
+/// @param fp The file path to match
+/// @return The match mask of the file path.
+uint64_t lcmdmatchmask(struct lcmdset_s** cs, const char* fp);
+
+/// @brief Computes the mask of the command sets which are triggered by any of
+/// the provided file event types, in the layout of `lcmdmatchmask`. A file
+/// event only runs commands if its file's match mask intersects this mask.
+/// @param cs The command set array to check
+/// @param flags The trigger flags, see `LCTRIG_*`
+/// @return The mask of the triggered command sets.
+uint64_t lcmdsubscribers(struct lcmdset_s** cs, int flags);
+
+/// @brief Reads the match counters of the combined matcher of the command
+/// sets, see `mrestats`.
+/// @param cs The command set array
+/// @param stats Set to the match counters
+void lcmdmatchstats(struct lcmdset_s** cs, struct mrestats_s* stats);
+
+/// @brief Computes a hash of the file patterns of all command sets, which
+/// identifies the match masks computed by `lcmdmatchmask`. Masks stored with a
+/// different hash must be recomputed.
+/// @param cs The command set array to hash
+/// @return The hash, or 0 if there are no command sets.
+uint64_t lcmdmaskhash(struct lcmdset_s** cs);
+
+/// @brief Checks if the provided directory path matches any of the prune
+/// patterns in the command set, in which case the directory and its subtree
+/// are not searched.
+/// @param cs The command set array to filter
+/// @param dir The directory path to match
+/// @param flags If `LCTOPT_TRACE` is set, the true/false match result for each
+/// command set with prune patterns will be printed to stdout.
+/// @return true if the directory path matches any prune pattern, otherwise
+/// false
+bool lcmdprune(struct lcmdset_s** cs, const char* dir, int flags);
+
+/// @brief Checks if any command set has prune patterns.
+/// @param cs The command set array to check
+/// @return true if any command set has prune patterns, otherwise false
+bool lcmdhasprune(struct lcmdset_s** cs);
+
 /// @brief Sequentially iterates the command set and executes the configured
 /// system commands on the provided file node if the trigger flags and file
-/// patterns match.
+/// patterns match. The file patterns are not matched again if the node has a
+/// match mask, see `INODE_MASK`. The file node is re-stat'ed once the
+/// commands have run for new and modified file events. For batched command
+/// sets, the file node is added to the pending batch instead, and the batch is
+/// run by the calling thread once it is full. For coprocess command sets, a
+/// request is sent to the coprocesses of the calling thread, which are started
+/// as needed and held by \p fds. Plugins are called with their context for the calling
+/// thread, which is also held by \p fds.
 /// @param cs The command set array to filter and execute
 /// @param node The file node to execute on
-/// @param fds The file descriptor set to use for stdout/stderr redirection
+/// @param fds The file descriptor set of the calling thread
 /// @param flags The trigger flags to match, see `LCTRIG_*`. If `LCTOPT_VERBOSE`
 /// is set, the commands will be printed to stdout before execution. If
 /// `LCTOPT_TRACE` is set, the true/false match result for each command set will
 /// be printed to stdout.
-/// @return 0 if successful, otherwise the first non-zero return value from
-/// `system(3)` is returned.
-int lcmdexec(struct lcmdset_s** cs, const struct inode_s* node,
-             const struct fdset_s* fds, int flags);
+/// @return 0 if successful, otherwise -1 to indicate an error.
+int lcmdexec(struct lcmdset_s** cs, struct inode_s* node,
+             struct fdset_s* fds, int flags);
+
+/// @brief Runs the pending batches of all batched command sets, regardless of
+/// their size or age.
+/// @param cs The command set array to flush
+/// @param fds The file descriptor set to use for stdout/stderr redirection
+/// @param flags If `LCTOPT_VERBOSE` is set, the commands will be printed to
+/// stdout before execution.
+/// @return 0 if successful, otherwise the last non-zero error code.
+int lcmdflush(struct lcmdset_s** cs, const struct fdset_s* fds, int flags);
+
+/// @brief Checks if any batched command set has pending files.
+/// @param cs The command set array to check
+/// @return true if any batch is pending, otherwise false
+bool lcmdpending(struct lcmdset_s** cs);
+
+/// @brief Flushes the plugin contexts of a thread which processed files since
+/// their last flush. Called by a thread once it runs out of work, so plugins
+/// complete the work they hold back before the work queue is idle.
+/// @param fds The file descriptor set of the thread
+void lcmdidle(struct fdset_s* fds);
+
+/// @brief Stops all coprocesses started by `lcmdexec` for the file descriptor
+/// set of a thread, makes the last flush of its plugin contexts, and frees
+/// their memory.
+/// @param fds The file descriptor set of the thread
+void lcmdrelease(struct fdset_s* fds);
 
 #endif//FSAUTOPROC_LCMD_H
@@ -0,0 +1,77 @@
+/// @file mre.h
+/// @brief Matching of many regex patterns against a string in a single pass.
+#ifndef FSAUTOPROC_MRE_H
+#define FSAUTOPROC_MRE_H
+
+#include <regex.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/// @def MREIDS
+/// @brief Number of pattern identifiers of a matcher, one bit of a match mask
+/// each
+#define MREIDS 64
+
+struct mre_s;
+
+/// @struct mrestats_s
+/// @brief Match counters of a matcher. Patterns executed by `regexec` are
+/// skipped for strings which lack the literal text every match contains.
+struct mrestats_s {
+  long strings;  ///< Strings matched by `mrematch`
+  long regexecs; ///< Patterns executed by `regexec`
+  long skipped;  ///< Patterns not executed since their literals were missing
+};
+
+/// @brief Allocates an empty matcher.
+/// @return The matcher if successful, otherwise NULL.
+struct mre_s* mrenew(void);
+
+/// @brief Adds a pattern to the matcher. The pattern is compiled into the
+/// matcher's DFA if it only uses the supported subset of POSIX extended
+/// regular expressions, otherwise \p reg is executed for it by `mrematch`.
+/// The subset excludes back-references, GNU escapes such as `\w`, collating
+/// elements and equivalence classes, and empty alternatives or groups.
+/// @param m The matcher, which must not have been built yet
+/// @param pattern The pattern string \p reg was compiled from, with
+/// `REG_EXTENDED | REG_NOSUB` in the C locale
+/// @param reg The compiled pattern, which must outlive the matcher
+/// @param id The pattern identifier, less than `MREIDS`, which may be shared
+/// by several patterns
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+int mreadd(struct mre_s* m, const char* pattern, const regex_t* reg, int id);
+
+/// @brief Builds the DFA of all added patterns. If the DFA grows too large,
+/// all patterns are executed by `regexec` instead.
+/// @param m The matcher to build
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+int mrebuild(struct mre_s* m);
+
+/// @brief Matches all patterns of a built matcher against \p s, as `regexec`
+/// would match them without `REG_NOTBOL` and `REG_NOTEOL`. The match counters
+/// are updated atomically, so the matcher may be used by several threads.
+/// @param m The matcher, or NULL
+/// @param s The NUL terminated string to match
+/// @param any Return as soon as any pattern matched, so the mask may lack
+/// other matching identifiers
+/// @return The mask of the identifiers of all matching patterns, bit `id` for
+/// each identifier.
+uint64_t mrematch(struct mre_s* m, const char* s, bool any);
+
+/// @brief Reads the match counters of the matcher.
+/// @param m The matcher, or NULL
+/// @param stats Set to the match counters, or zero if \p m is NULL
+void mrestats(const struct mre_s* m, struct mrestats_s* stats);
+
+/// @brief Returns a hash of the patterns added to the matcher and their
+/// identifiers, which identifies the match masks returned by `mrematch`.
+/// @param m The matcher, or NULL
+/// @return The hash, or 0 if no pattern was added.
+uint64_t mrehash(const struct mre_s* m);
+
+/// @brief Frees the matcher, without freeing the compiled patterns it was
+/// given.
+/// @param m The matcher to free, or NULL
+void mrefree(struct mre_s* m);
+
+#endif//FSAUTOPROC_MRE_H
@@ -0,0 +1,40 @@
+/// @file plugin.h
+/// @brief Loading of shared object plugins, see `fsaplugin.h`.
+#ifndef FSAUTOPROC_PLUGIN_H
+#define FSAUTOPROC_PLUGIN_H
+
+#include <stdbool.h>
+
+#include "fsaplugin.h"
+
+/// @struct plugin_s
+/// @brief A loaded plugin and its resolved functions.
+struct plugin_s {
+  char* fp;    ///< Shared object file path for logging
+  void* dl;    ///< Handle returned by `dlopen`
+  void* state; ///< Shared state set by `fsap_init`
+  int (*process)(void*, void**, const struct fsap_file_s*); ///< Required
+  int (*flush)(void*, void*, int);                          ///< Or NULL
+  void (*fini)(void*);                                      ///< Or NULL
+};
+
+/// @struct pluginctx_s
+/// @brief The context of a plugin for a single thread.
+struct pluginctx_s {
+  const struct plugin_s* plugin; ///< The plugin, or NULL if never called
+  void* ctx;                     ///< Context pointer owned by the plugin
+  bool dirty;                    ///< Files were processed since the last flush
+};
+
+/// @brief Loads the shared object \p fp, checks its interface version and
+/// initializes it.
+/// @param fp The shared object file path, see `dlopen(3)`
+/// @param arg The argument passed to `fsap_init`, or NULL
+/// @return The loaded plugin if successful, otherwise NULL.
+struct plugin_s* pluginopen(const char* fp, const char* arg);
+
+/// @brief Calls `fsap_fini` of the plugin, unloads it and frees its memory.
+/// @param p The plugin to close, or NULL
+void pluginclose(struct plugin_s* p);
+
+#endif//FSAUTOPROC_PLUGIN_H
@@ -0,0 +1,59 @@
+/// @file scan.h
+/// @brief Parallel work-stealing directory tree scanner.
+#ifndef FSAUTOPROC_SCAN_H
+#define FSAUTOPROC_SCAN_H
+
+struct scanwk_s;
+
+/// @typedef scandirfn_t
+/// @brief Directory function invoked by a scanner thread for each directory in
+/// the tree. The function lists the directory, queues any subdirectories using
+/// `scanpush`, and produces a result for the collecting thread.
+/// @param wk The scanner thread invoking the function
+/// @param dir The directory path to process
+/// @param res Set to the result to collect, or NULL if there is none
+/// @param udata User data passed to `scanrun`
+/// @return 0 if successful, otherwise a non-zero value to stop the scan
+typedef int (*scandirfn_t)(struct scanwk_s* wk, const char* dir, void** res,
+                           void* udata);
+
+/// @typedef scanresfn_t
+/// @brief Result function invoked on the thread which called `scanrun` for
+/// each result produced by the directory function, one at a time. The function
+/// is invoked for every result, even after the scan has failed, so it may
+/// release the result.
+/// @param res The result to collect
+/// @param udata User data passed to `scanrun`
+/// @return 0 if successful, otherwise a non-zero value to stop the scan
+typedef int (*scanresfn_t)(void* res, void* udata);
+
+/// @typedef scanfreefn_t
+/// @brief Free function invoked on a scanner thread for a result which cannot
+/// be queued for the result function, e.g. if an allocation fails.
+/// @param res The result to free
+typedef void (*scanfreefn_t)(void* res);
+
+/// @brief Queues the directory \p dir on the deque of the scanner thread
+/// \p wk. Idle scanner threads steal queued directories from the other
+/// threads' deques.
+/// @param wk The scanner thread
+/// @param dir The directory path to queue, which is copied
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+int scanpush(struct scanwk_s* wk, const char* dir);
+
+/// @brief Scans the directory tree \p root using \p threads scanner threads.
+/// Each directory is processed by \p dirfn on a scanner thread, and its result
+/// is passed to \p resfn on the calling thread as soon as it is available.
+/// Results are collected in no particular order.
+/// @param root The root directory path of the tree
+/// @param threads The number of scanner threads, must be greater than 0
+/// @param dirfn The directory function
+/// @param resfn The result function
+/// @param freefn The free function for results which cannot be queued
+/// @param udata User data to pass to \p dirfn and \p resfn
+/// @return 0 if successful, -1 if an internal error occurred, otherwise the
+/// first non-zero \p dirfn or \p resfn return value.
+int scanrun(const char* root, int threads, scandirfn_t dirfn,
+            scanresfn_t resfn, scanfreefn_t freefn, void* udata);
+
+#endif//FSAUTOPROC_SCAN_H
@@ -3,34 +3,55 @@
 #ifndef FSAUTOPROC_TP_H
 #define FSAUTOPROC_TP_H
 
+#include <stdint.h>
+
 /// @struct tpreq_s
 /// @brief Pending work request which contains a command set to execute on a
 /// thread in the pool, using a file node as the target.
 struct tpreq_s {
   struct lcmdset_s** cs; ///< command set to execute
-  struct inode_s* node;  ///< File node to pass to the command set
+  struct inode_s* node;  ///< File node, or NULL to run pending batches
   int flags;             ///< Trigger flags for the command set
 };
 
+/// @struct tpstats_s
+/// @brief Work queue statistics of the thread pool.
+struct tpstats_s {
+  long queued;         ///< Number of work requests queued
+  int highwater;       ///< Maximum number of requests waiting in the queue
+  int depth;           ///< Capacity of the work queue
+  uint64_t pushwaitns; ///< Time `tpqueue` callers were blocked on a full queue
+  uint64_t popwaitns;  ///< Sum of time worker threads waited on an empty queue
+  uint64_t cpuns;      ///< Sum of CPU time used by worker threads while busy
+};
+
 /// @def TPOPT_LOGFILES
 /// @brief Option bit flag for logging all stdout/stderr output to files.
 #define TPOPT_LOGFILES 1
 
-/// @brief Initializes a global worker thread pool of the given size.
+/// @brief Initializes a global worker thread pool of the given size, fed by a
+/// bounded work queue of the given depth.
 /// @param size The number of threads to create, must be greater than 0.
+/// @param depth The work queue capacity, must be greater than 0.
 /// @param flags The flags to use when creating the thread pool.
 /// @return 0 on success, -1 on failure.
-int tpinit(int size, int flags);
+int tpinit(int size, int depth, int flags);
 
-/// @brief Allocates a work request to the first available thread in the global
-/// pool. If no threads are available, the request will block until a thread
-/// becomes available.
-/// @param req The work request to allocate.
+/// @brief Appends a work request to the work queue of the global pool, from
+/// which it is taken by the first idle thread. If the queue is full, the call
+/// blocks until a thread takes a request from it, so the caller may run ahead
+/// of the threads by up to the queue depth.
+/// @param req The work request to queue.
 /// @return 0 on success, -1 on failure.
 int tpqueue(const struct tpreq_s* req);
 
-/// @brief Waits for all threads in the global pool to finish executing their
-/// work requests.
+/// @brief Copies the work queue statistics of the global pool.
+/// @param s The statistics to populate.
+void tpstats(struct tpstats_s* s);
+
+/// @brief Waits until the work queue of the global pool is drained and all
+/// threads have finished executing their work requests. The calling thread
+/// sleeps until the last request finishes.
 void tpwait(void);
 
 /// @brief Waits for all threads in the global pool to finish executing their
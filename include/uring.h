@@ -0,0 +1,35 @@
+/// @file uring.h
+/// @brief Batched file stat backend using Linux io_uring.
+#ifndef FSAUTOPROC_URING_H
+#define FSAUTOPROC_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "fs.h"
+
+/// @struct uringreq_s
+/// @brief Stat request for a single file, relative to a directory descriptor.
+struct uringreq_s {
+  const char* fp;     ///< Filepath, relative to the directory descriptor
+  bool follow;        ///< Follow the filepath if it is a symbolic link
+  bool wantdir;       ///< Request the file type to populate `dir`
+  struct fsstat_s st; ///< Populated stat info, if `err` is 0
+  bool dir;           ///< Populated if `wantdir`, true if a directory
+  int err;            ///< 0 if successful, otherwise the error number
+};
+
+/// @brief Stats all files in \p reqs relative to the directory file descriptor
+/// \p dfd by submitting `IORING_OP_STATX` requests in batches to an io_uring
+/// instance owned by the calling thread. The instance is created on first use
+/// and destroyed when the thread exits.
+/// @param dfd The directory file descriptor
+/// @param reqs The stat requests, populated with their results
+/// @param n The number of stat requests
+/// @return 0 if all requests were completed (individual requests may have
+/// failed, see `uringreq_s::err`). Otherwise -1 is returned and `errno` is set,
+/// e.g. if io_uring or its stat requests are unavailable, and the caller should
+/// stat the files synchronously instead.
+int uringstat(int dfd, struct uringreq_s* reqs, size_t n);
+
+#endif//FSAUTOPROC_URING_H
@@ -0,0 +1,71 @@
+/// @file watch.h
+/// @brief Recursive directory change notifications using Linux inotify.
+#ifndef FSAUTOPROC_WATCH_H
+#define FSAUTOPROC_WATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/// @typedef watchfn_t
+/// @brief Callback function used by `watchread` for each changed path.
+/// @param fp The created, written, moved, or removed file or directory path,
+/// which is only valid for the duration of the call
+/// @param udata User data passed to `watchread`
+/// @return 0 if reading should continue, otherwise a non-zero value to stop
+typedef int (*watchfn_t)(const char* fp, void* udata);
+
+/// @struct watch_s
+/// @brief Change notification instance watching one or more directory trees.
+struct watch_s {
+  int fd;        ///< inotify instance file descriptor
+  char** dirs;   ///< Watched directory path of each watch descriptor, or NULL
+  int cap;       ///< Allocated capacity of `dirs`
+  char* fp;      ///< Changed path buffer
+  size_t fpcap;  ///< Allocated capacity of `fp`
+  bool overflow; ///< Notifications were lost, set until cleared by the caller
+  bool (*prune)(const char* dir); ///< Returns true to not watch a directory
+};
+
+/// @brief Opens a new change notification instance.
+/// @param w The instance to initialize
+/// @return 0 if successful, otherwise -1 and `errno` is set, e.g. to `ENOSYS`
+/// if change notifications are unsupported on the platform.
+int watchopen(struct watch_s* w);
+
+/// @brief Recursively watches directory \p dir and all of its subdirectories,
+/// skipping hidden entries as `fswalk` does, and subdirectories for which the
+/// `prune` function, if set, returns true. Directories created or moved into
+/// a watched directory are watched automatically by `watchread`.
+/// @param w The instance to add to
+/// @param dir The directory path to watch
+/// @return 0 if successful, otherwise -1 and `errno` is set, e.g. to `ENOSPC`
+/// if the per-user watch limit (`fs.inotify.max_user_watches`) is reached.
+int watchadd(struct watch_s* w, const char* dir);
+
+/// @brief Waits until change notifications are available to read.
+/// @param w The instance to wait on
+/// @param timeout The maximum time to wait in milliseconds, or -1 to wait
+/// indefinitely
+/// @return 1 if notifications are available, 0 if the wait timed out,
+/// otherwise -1 and `errno` is set, e.g. to `EINTR` if a signal was caught.
+int watchwait(struct watch_s* w, int timeout);
+
+/// @brief Reads all available change notifications without blocking and calls
+/// \p fn for each changed path. Files are reported once they are closed after
+/// writing, moved, removed, or their attributes change. Directories are
+/// reported once created, moved, or removed. If the kernel notification queue
+/// overflowed, `overflow` is set and the caller should rescan the trees.
+/// @param w The instance to read from
+/// @param fn The function to call for each changed path
+/// @param udata User data to pass to \p fn
+/// @return If successful, 0 is returned. An internal error will return a
+/// value of -1 and `errno` is set. Otherwise the return value of the first
+/// non-zero \p fn call is returned.
+int watchread(struct watch_s* w, watchfn_t fn, void* udata);
+
+/// @brief Closes the change notification instance and frees all memory
+/// allocated by it.
+/// @param w The instance to close
+void watchclose(struct watch_s* w);
+
+#endif//FSAUTOPROC_WATCH_H
@@ -0,0 +1,179 @@
+/// @file act.c
+/// @brief Built-in file actions executed in-process, without a child process.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE// copy_file_range(2)
+#endif
+
+#include "act.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// @brief Names and argument counts of the built-in actions, indexed by
+/// `act_t`. A maximum of 0 accepts any number of arguments.
+static const struct {
+  const char* name; ///< Action name
+  int min;          ///< Minimum number of arguments
+  int max;          ///< Maximum number of arguments, or 0
+} acts[] = {
+        [ACT_NONE] = {NULL, 0, 0},       [ACT_UNLINK] = {"unlink", 1, 0},
+        [ACT_COPY] = {"copy", 2, 2},     [ACT_LINK] = {"link", 2, 2},
+        [ACT_RENAME] = {"rename", 2, 2}, [ACT_MKDIR] = {"mkdir", 1, 0},
+        [ACT_TOUCH] = {"touch", 1, 0},
+};
+
+enum act_t actparse(const char* name, const int argc) {
+  for (int i = 1; i < (int) (sizeof(acts) / sizeof(*acts)); i++) {
+    if (strcmp(name, acts[i].name) != 0) continue;
+    if (argc < acts[i].min || (acts[i].max > 0 && argc > acts[i].max))
+      return ACT_NONE;
+    return i;
+  }
+  return ACT_NONE;
+}
+
+/// @brief Copies the remaining contents of file descriptor \p in to \p out,
+/// in the kernel if supported.
+/// @param in The file descriptor to read from
+/// @param out The file descriptor to write to
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int actcopyfd(const int in, const int out) {
+#ifdef __linux__
+  for (;;) {
+    const ssize_t n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0);
+    if (n == 0) return 0;
+    if (n > 0) continue;
+    if (errno == EINTR) continue;
+    // e.g. EXDEV before Linux 5.3, or unsupported filesystems
+    if (errno != EXDEV && errno != ENOSYS && errno != EINVAL &&
+        errno != EOPNOTSUPP)
+      return -1;
+    break;
+  }
+#endif
+  char buf[64 * 1024];
+  for (;;) {
+    const ssize_t n = read(in, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return (int) n;
+    for (ssize_t off = 0; off < n;) {
+      const ssize_t w = write(out, buf + off, n - off);
+      if (w < 0 && errno == EINTR) continue;
+      if (w < 0) return -1;
+      off += w;
+    }
+  }
+}
+
+/// @brief Copies file \p src to \p dst, which is created with the mode of
+/// \p src or truncated.
+/// @param src The source file path
+/// @param dst The destination file path
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int actcopy(const char* src, const char* dst) {
+  int in, out;
+  struct stat st;
+  if ((in = open(src, O_RDONLY | O_CLOEXEC)) < 0) return -1;
+  if (fstat(in, &st) ||
+      (out = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  st.st_mode & 0777)) < 0) {
+    const int err = errno;
+    close(in);
+    errno = err;
+    return -1;
+  }
+  int ret = actcopyfd(in, out);
+  const int err = errno;
+  close(in);
+  if (close(out) && ret == 0) return -1;
+  errno = err;
+  return ret;
+}
+
+/// @brief Hard links file \p src as \p dst, replacing an existing \p dst.
+/// @param src The source file path
+/// @param dst The link path
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int actlink(const char* src, const char* dst) {
+  if (link(src, dst) == 0) return 0;
+  if (errno != EEXIST || unlink(dst)) return -1;
+  return link(src, dst);
+}
+
+/// @brief Creates directory \p dir and any missing parent directories, as
+/// `mkdir -p` does.
+/// @param dir The directory path
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int actmkdir(const char* dir) {
+  char fp[4096];
+  const size_t len = strlen(dir);
+  if (len >= sizeof(fp)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memcpy(fp, dir, len + 1);
+  for (char* p = fp + 1; p <= fp + len; p++) {
+    if (*p != '/' && *p != '\0') continue;
+    const char c = *p;
+    *p = '\0';
+    struct stat st;
+    if (mkdir(fp, 0777) && (errno != EEXIST || stat(fp, &st) ||
+                            !S_ISDIR(st.st_mode))) {
+      if (errno == EEXIST) errno = ENOTDIR;
+      return -1;
+    }
+    *p = c;
+  }
+  return 0;
+}
+
+/// @brief Creates file \p fp if it does not exist, and sets its access and
+/// modification times to the current time.
+/// @param fp The file path
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int acttouch(const char* fp) {
+  int fd;
+  if ((fd = open(fp, O_WRONLY | O_CREAT | O_CLOEXEC, 0666)) < 0) return -1;
+  const int ret = futimens(fd, NULL);
+  const int err = errno;
+  close(fd);
+  errno = err;
+  return ret;
+}
+
+int actrun(const enum act_t act, const int argc, char* const* argv) {
+  switch (act) {
+    case ACT_COPY:
+      return actcopy(argv[0], argv[1]);
+    case ACT_LINK:
+      return actlink(argv[0], argv[1]);
+    case ACT_RENAME:
+      return rename(argv[0], argv[1]);
+    default:
+      break;
+  }
+  for (int i = 0; i < argc; i++) {
+    int err = 0;
+    switch (act) {
+      case ACT_UNLINK:
+        if ((err = unlink(argv[i])) && errno == ENOENT) err = 0;
+        break;
+      case ACT_MKDIR:
+        err = actmkdir(argv[i]);
+        break;
+      case ACT_TOUCH:
+        err = acttouch(argv[i]);
+        break;
+      default:
+        errno = EINVAL;
+        return -1;
+    }
+    if (err) return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,65 @@
+/// @file arena.c
+/// @brief Bump pointer arena allocator implementation.
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/// @def ARENAMINBLK
+/// @brief The capacity of the first block allocated by an arena.
+#define ARENAMINBLK 4096
+
+/// @def ARENAMAXBLK
+/// @brief The maximum capacity of a block, unless a single allocation requires
+/// a larger block.
+#define ARENAMAXBLK (1 << 20)
+
+/// @struct arenablk_s
+/// @brief A single arena memory block. Blocks are chained in reverse order of
+/// allocation so only the head block is used for new allocations.
+struct arenablk_s {
+  struct arenablk_s* prev; ///< Previously allocated block, or NULL
+  size_t used;             ///< Number of bytes used in the data buffer
+  size_t cap;              ///< Capacity of the data buffer
+  max_align_t data[];      ///< Block data buffer
+};
+
+void* arenaalloc(struct arena_s* a, const size_t size, const size_t align) {
+  struct arenablk_s* blk = a->head;
+  if (blk != NULL) {
+    const size_t off = (blk->used + align - 1) & ~(align - 1);
+    if (off + size <= blk->cap) {
+      blk->used = off + size;
+      return (char*) blk->data + off;
+    }
+  }
+
+  // allocate a new head block, doubling the size of each subsequent block
+  if (a->nextsze < ARENAMINBLK) a->nextsze = ARENAMINBLK;
+  const size_t cap = size > a->nextsze ? size : a->nextsze;
+  if ((blk = malloc(sizeof(*blk) + cap)) == NULL) return NULL;
+  blk->prev = a->head;
+  blk->used = size;
+  blk->cap = cap;
+  a->head = blk;
+  if (a->nextsze < ARENAMAXBLK) a->nextsze *= 2;
+  return blk->data;
+}
+
+char* arenastrdup(struct arena_s* a, const char* s) {
+  const size_t len = strlen(s) + 1;
+  char* d;
+  if ((d = arenaalloc(a, len, 1)) == NULL) return NULL;
+  return memcpy(d, s, len);
+}
+
+void arenafree(struct arena_s* a) {
+  struct arenablk_s* blk = a->head;
+  while (blk != NULL) {
+    struct arenablk_s* prev = blk->prev;
+    free(blk);
+    blk = prev;
+  }
+  a->head = NULL;
+  a->nextsze = 0;
+}
@@ -0,0 +1,155 @@
+/// @file coproc.c
+/// @brief Long-lived child processes which handle line based requests.
+#include "coproc.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tm.h"
+
+extern char** environ;
+
+int coprocstart(struct coproc_s* cp, char* const* argv, const int errfd) {
+  *cp = (struct coproc_s){0};
+
+  // the parent's end is not inherited by coprocesses started later, which
+  // would otherwise hold it open after it is closed by `coprocstop`
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv)) return -1;
+
+  posix_spawn_file_actions_t fa;
+  posix_spawnattr_t attr;
+  sigset_t mask;
+  sigemptyset(&mask);
+  posix_spawn_file_actions_init(&fa);
+  posix_spawn_file_actions_adddup2(&fa, sv[1], STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&fa, sv[1], STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&fa, errfd, STDERR_FILENO);
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+  posix_spawnattr_setsigmask(&attr, &mask);
+
+  pid_t pid;
+  const int err = posix_spawnp(&pid, argv[0], &fa, &attr, argv, environ);
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&fa);
+  close(sv[1]);
+  if (err) {
+    close(sv[0]);
+    errno = err;
+    return -1;
+  }
+  cp->pid = pid;
+  cp->sock = sv[0];
+  return 0;
+}
+
+/// @brief Sends all \p len bytes of \p buf to the coprocess, without raising
+/// `SIGPIPE` if it has exited.
+/// @param cp The running coprocess
+/// @param buf The bytes to send
+/// @param len The number of bytes to send
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int coprocsend(const struct coproc_s* cp, const char* buf, size_t len) {
+  while (len > 0) {
+    const ssize_t n = send(cp->sock, buf, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return -1;
+    buf += n, len -= n;
+  }
+  return 0;
+}
+
+/// @brief Waits until the coprocess socket is readable or \p deadline passes.
+/// @param cp The running coprocess
+/// @param deadline The `tmnow` time to wait until, or 0 to wait indefinitely
+/// @return 0 if readable, otherwise -1 and `errno` is set, to `ETIMEDOUT` if
+/// the deadline passed.
+static int coprocwait(const struct coproc_s* cp, const uint64_t deadline) {
+  for (;;) {
+    int timeout = -1;
+    if (deadline > 0) {
+      const uint64_t now = tmnow();
+      timeout = deadline > now ? (int) (deadline - now) : 0;
+    }
+    struct pollfd pfd = {.fd = cp->sock, .events = POLLIN};
+    const int ready = poll(&pfd, 1, timeout);
+    if (ready < 0 && errno == EINTR) continue;
+    if (ready < 0) return -1;
+    if (ready > 0) return 0;
+    errno = ETIMEDOUT;
+    return -1;
+  }
+}
+
+int coproccall(struct coproc_s* cp, const char* req, const size_t len,
+               char* reply, const size_t cap, const uint64_t timeout) {
+  if (cp->pid == 0) {
+    errno = EPIPE;
+    return -1;
+  }
+  if (coprocsend(cp, req, len)) return -1;
+  if ((len == 0 || req[len - 1] != '\n') && coprocsend(cp, "\n", 1)) return -1;
+  cp->calls++;
+  const uint64_t deadline = timeout > 0 ? tmnow() + timeout : 0;
+
+  // receive until a line break, dropping the excess of overlong lines
+  size_t out = 0;
+  for (;;) {
+    char* nl;
+    if ((nl = memchr(cp->buf, '\n', cp->len)) != NULL) {
+      const size_t n = nl - cp->buf;
+      const size_t c = n < cap - 1 - out ? n : cap - 1 - out;
+      memcpy(reply + out, cp->buf, c);
+      reply[out + c] = '\0';
+      memmove(cp->buf, nl + 1, cp->len - n - 1);
+      cp->len -= n + 1;
+      return 0;
+    }
+    const size_t c = cp->len < cap - 1 - out ? cp->len : cap - 1 - out;
+    memcpy(reply + out, cp->buf, c);
+    out += c;
+    cp->len = 0;
+
+    if (coprocwait(cp, deadline)) return -1;
+    const ssize_t n = recv(cp->sock, cp->buf, sizeof(cp->buf), 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return -1;
+    if (n == 0) {
+      errno = EPIPE;
+      return -1;
+    }
+    cp->len = n;
+  }
+}
+
+int coprocstop(struct coproc_s* cp) {
+  if (cp->pid == 0) return -1;
+  close(cp->sock);
+
+  // poll for the exit to bound the wait for a coprocess ignoring its input
+  int status = 0;
+  pid_t r = 0;
+  const struct timespec ts = {0, 10 * 1000 * 1000};
+  for (int i = 0; i < 100 && r == 0; i++) {
+    do r = waitpid(cp->pid, &status, WNOHANG);
+    while (r < 0 && errno == EINTR);
+    if (r == 0) nanosleep(&ts, NULL);
+  }
+  if (r == 0) {
+    kill(cp->pid, SIGKILL);
+    do r = waitpid(cp->pid, &status, 0);
+    while (r < 0 && errno == EINTR);
+  }
+  const bool exited = r > 0 && WIFEXITED(status);
+  *cp = (struct coproc_s){0};
+  return exited ? WEXITSTATUS(status) : -1;
+}
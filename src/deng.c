@@ -3,26 +3,69 @@
 #include "deng.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <time.h>
 
 #include "fs.h"
 #include "index.h"
 #include "log.h"
+#include "scan.h"
 
 #define SL_IMPL
 #include "sl.h"
 
+/// @def DENGRACYMS
+/// @brief Directories modified within this many milliseconds of the search
+/// start time are not trusted to be unchanged on the next search, since
+/// further changes may not advance a coarse grained directory mtime.
+#define DENGRACYMS 2000
+
+/// @struct dscanent_s
+/// @brief Child entry of a directory listed by a parallel scanner thread.
+struct dscanent_s {
+  size_t fpoff;       ///< Filepath offset in the listing's string buffer
+  struct fsstat_s st; ///< Stat info of the child
+  bool dir;           ///< Child is a directory
+  bool hashed;        ///< Child file was digested as of `st`
+  uint64_t digest;    ///< Digest of the child file, if `hashed`
+};
+
 /// @struct deng_state_s
 /// @brief Search state context provided to the diff engine as user data which
 /// is passed to the file event hook functions.
 struct deng_state_s {
   slist_t* dirqueue;                ///< Processing directory queue
-  deng_filter_t ffn;                ///< File filter function
+  deng_match_t ffn;                 ///< File filter function
   const struct deng_hooks_s* hooks; ///< File event hook functions
   const struct index_s* lastmap;    ///< Previous index state
   struct index_s* thismap;          ///< Current index state
+  const struct deng_opts_s* opts;   ///< Search options
+  struct inode_s** lastlist;        ///< Sorted previous index, if required
+  long lastpos;                     ///< Merge cursor into `lastlist`
+  long nchild;                      ///< Indexed children of current directory
+  uint64_t started;                 ///< Search start time in ms since epoch
+  fswalkfn_t stagefn;               ///< Parallel scan stage file function
+  bool canskip;                     ///< Parallel scan may skip directories
+  bool post;                        ///< Search is in the post stage
+  bool keepstat;                    ///< Post stage keeps known files' stat
+  long nknown;                      ///< Previously indexed children seen
+  bool defer;                       ///< Collect reconciled nodes in `synced`
+  struct inode_s** synced;          ///< Reconciled nodes with deferred events
+  long synclen;                     ///< Number of nodes in `synced`
+  long synccap;                     ///< Allocated capacity of `synced`
+  struct deng_stats_s* stats;       ///< Skipped entry counters, or NULL
+  bool prehash;                     ///< Parallel scan digests known files
+  const struct dscanent_s* hashed;  ///< Entry being staged with a digest
+  bool listdirs;                    ///< First stage collects `dirs`
+  struct inode_s** dirs;            ///< Directory nodes of the first stage
+  long ndirs;                       ///< Number of nodes in `dirs`
+  long capdirs;                     ///< Allocated capacity of `dirs`
 };
 
 /// @def invokehook
@@ -44,96 +87,726 @@ struct deng_state_s {
     if ((mach)->hooks->notify != NULL) (mach)->hooks->notify(type);            \
   } while (0)
 
-/// @brief Processes a file before the command execution stage to ensure all
-/// files are indexed. This function may trigger new (NEW), modified (MOD),
-/// and unmodified (NOP) events for each file in the directory tree.
-/// @param fp The file path to process
-/// @param udata The diff engine state context
-/// @return 0 if successful, otherwise a non-zero error code.
-static int stagepre(const char* fp, void* udata) {
-  struct deng_state_s* mach = (struct deng_state_s*) udata;
-  if (mach->ffn != NULL && mach->ffn(fp)) return 0;
+/// @brief Applies the file filter function to file \p fp, counting ignored
+/// files in the search statistics. The match mask of \p known is reused if it
+/// is set and non-zero, see `deng_match_t`.
+/// @param mach The diff engine state context
+/// @param fp The file path to filter
+/// @param known The node of the file in an index state, or NULL
+/// @param node The node to set the match mask of if the file is not ignored
+/// @return true if the file should be ignored, otherwise false
+static bool filterfile(struct deng_state_s* mach, const char* fp,
+                       const struct inode_s* known, struct inode_s* node) {
+  if (mach->ffn == NULL) return false;
+  uint64_t mask;
+  if (known != NULL && (known->flags & INODE_MASK) && known->mask != 0) {
+    mask = known->mask;
+    if (mach->stats != NULL) mach->stats->reused++;
+  } else if (mach->ffn(fp, &mask)) {
+    if (mach->stats != NULL) mach->stats->ignored++;
+    return true;
+  }
+  node->mask = mask;
+  node->flags |= INODE_MASK;
+  return false;
+}
 
-  struct inode_s finfo = {0};
-  if ((finfo.fp = strdup(fp)) == NULL) return -1;
-  if (fsstat(fp, &finfo.st)) return -1;
+/// @brief Applies the prune filter of the search options to directory \p dir,
+/// counting pruned directories in the search statistics of the first stage.
+/// @param mach The diff engine state context
+/// @param dir The directory path to filter
+/// @return true if the directory should not be searched, otherwise false
+static bool prunedir(struct deng_state_s* mach, const char* dir) {
+  if (mach->opts->prune == NULL || !mach->opts->prune(dir, mach->post))
+    return false;
+  if (mach->stats != NULL) mach->stats->pruned++;
+  return true;
+}
 
-  // attempt to match file in previous index
-  struct inode_s* prev = indexfind(mach->lastmap, fp);
+/// @brief Compares the stat info of a file to its stat info in an index
+/// state. With the `DENG_OPT_DIGEST` option, the change tags are compared as
+/// well, since the digest of a file is only reused while both are unchanged.
+/// @param mach The diff engine state context
+/// @param a The first stat info to compare
+/// @param b The second stat info to compare
+/// @return true if the stat info is unchanged, otherwise false
+static bool samestat(const struct deng_state_s* mach, const struct fsstat_s* a,
+                     const struct fsstat_s* b) {
+  if (!fsstateql(a, b)) return false;
+  return !(mach->opts->flags & DENG_OPT_DIGEST) || a->ctag == b->ctag;
+}
 
-  // lookup from previous iteration or insert new record and lookup
-  struct inode_s* curr = indexfind(mach->thismap, fp);
-  if (curr == NULL)
-    if ((curr = indexput(mach->thismap, finfo)) == NULL) return -1;
+/// @brief Sets the content digest of file node \p curr if the
+/// `DENG_OPT_DIGEST` option is set and the node has none. The digest of
+/// \p prev is reused if the stat info is unchanged, otherwise the digest
+/// computed by a parallel scanner thread for the same stat info is used, or
+/// the file is digested. A file which cannot be read is left without digest.
+/// @param mach The diff engine state context
+/// @param curr The file node to set the digest of
+/// @param prev The node of the file in the previous index state, or NULL
+static void digestnode(struct deng_state_s* mach, struct inode_s* curr,
+                       const struct inode_s* prev) {
+  if (!(mach->opts->flags & DENG_OPT_DIGEST) || (curr->flags & INODE_DIGEST))
+    return;
+  uint64_t digest;
+  if (prev != NULL && (prev->flags & INODE_DIGEST) &&
+      samestat(mach, &prev->st, &curr->st)) {
+    digest = prev->digest;
+  } else if (mach->hashed != NULL &&
+             samestat(mach, &mach->hashed->st, &curr->st)) {
+    digest = mach->hashed->digest;
+    if (mach->stats != NULL) mach->stats->digests++;
+  } else if (fsdigest(curr->fp, &digest) == 0) {
+    if (mach->stats != NULL) mach->stats->digests++;
+  } else {
+    log_error("error digesting `%s`: %d", curr->fp, errno);
+    return;
+  }
+  curr->digest = digest;
+  curr->flags |= INODE_DIGEST;
+}
+
+/// @brief Determines whether file node \p curr was modified relative to its
+/// node \p prev in an index state. With the `DENG_OPT_DIGEST` option, nodes
+/// which both have a digest are compared by their digests, so a file whose
+/// stat info changed but whose content did not is unmodified.
+/// @param mach The diff engine state context
+/// @param curr The current file node, whose digest is set if required
+/// @param prev The node to compare to
+/// @return true if the file was modified, otherwise false
+static bool filemodified(struct deng_state_s* mach, struct inode_s* curr,
+                         const struct inode_s* prev) {
+  if (!(mach->opts->flags & DENG_OPT_DIGEST))
+    return !fsstateql(&prev->st, &curr->st);
+  digestnode(mach, curr, prev);
+  if (!(curr->flags & prev->flags & INODE_DIGEST))
+    return !fsstateql(&prev->st, &curr->st);
+  if (prev->digest != curr->digest) return true;
+  if (mach->stats != NULL && !samestat(mach, &prev->st, &curr->st))
+    mach->stats->touched++;
+  return false;
+}
 
-  if (prev != NULL && !fsstateql(&prev->st, &curr->st)) {
+/// @brief Triggers the new (NEW), modified (MOD), or unmodified (NOP) event
+/// for an indexed file by comparing it to \p prev.
+/// @param mach The diff engine state context
+/// @param curr The file node in the current index
+/// @param prev The matching file node in the previous index, or NULL
+static void diffhook(struct deng_state_s* mach, struct inode_s* curr,
+                     const struct inode_s* prev) {
+  if (prev != NULL && filemodified(mach, curr, prev)) {
     invokehook(mach, mod, curr);
   } else if (prev != NULL) {
     invokehook(mach, nop, curr);
   } else {
+    digestnode(mach, curr, NULL);
     invokehook(mach, new, curr);
   }
+}
+
+/// @brief Inserts a file into the current index and triggers its event using
+/// `diffhook`.
+/// @param mach The diff engine state context
+/// @param finfo The file node to insert
+/// @param prev The matching file node in the previous index, or NULL
+/// @return 0 if successful, otherwise a non-zero error code.
+static int diffnode(struct deng_state_s* mach, struct inode_s finfo,
+                    const struct inode_s* prev) {
+  struct inode_s* curr;
+  if (prev != NULL) {
+    // intern the previous index's filepath instead of copying it
+    finfo.fp = prev->fp;
+    if ((curr = indexputref(mach->thismap, finfo)) == NULL) return -1;
+  } else if ((curr = indexput(mach->thismap, finfo)) == NULL) {
+    return -1;
+  }
+  mach->nchild++;
+  diffhook(mach, curr, prev);
 
   return 0;
 }
 
+/// @brief Processes a file before the command execution stage, using the
+/// already known stat info \p st if provided. This function may trigger new
+/// (NEW), modified (MOD), and unmodified (NOP) events.
+/// @param mach The diff engine state context
+/// @param fp The file path to process
+/// @param st The stat info of the file, or NULL to stat the file
+/// @return 0 if successful, otherwise a non-zero error code.
+static int stagefile(struct deng_state_s* mach, const char* fp,
+                     const struct fsstat_s* st) {
+  // attempt to match file in previous index
+  const struct inode_s* prev = indexfind(mach->lastmap, fp);
+  if (prev != NULL && (prev->flags & INODE_DIR)) prev = NULL;
+
+  struct inode_s finfo = {(char*) fp, {0}, 0, 0, 0, 0};
+  if (filterfile(mach, fp, prev, &finfo)) return 0;
+  if (st != NULL) {
+    finfo.st = *st;
+  } else if (fsstat(fp, &finfo.st)) {
+    return -1;
+  }
+
+  // lookup from previous iteration or insert new record
+  struct inode_s* curr = indexfind(mach->thismap, fp);
+  if (curr != NULL) {
+    mach->nchild++;
+    diffhook(mach, curr, prev);
+    return 0;
+  }
+  return diffnode(mach, finfo, prev);
+}
+
+/// @brief Processes a file before the command execution stage to ensure all
+/// files are indexed. This function may trigger new (NEW), modified (MOD),
+/// and unmodified (NOP) events for each file in the directory tree.
+/// @param fp The file path to process
+/// @param st The stat info of the file
+/// @param udata The diff engine state context
+/// @return 0 if successful, otherwise a non-zero error code.
+static int stagepre(const char* fp, const struct fsstat_s* st, void* udata) {
+  return stagefile((struct deng_state_s*) udata, fp, st);
+}
+
 /// @brief Processes a file after the command execution stage to ensure all
 /// files are indexed. This function may trigger new (NEW) and modified (MOD)
 /// events for each file in the directory tree.
 /// @param fp The file path to process
+/// @param st The stat info of the file
 /// @param udata The diff engine state context
 /// @return 0 if successful, otherwise a non-zero error code.
-static int stagepost(const char* fp, void* udata) {
+static int stagepost(const char* fp, const struct fsstat_s* st, void* udata) {
   struct deng_state_s* mach = (struct deng_state_s*) udata;
-  if (mach->ffn != NULL && mach->ffn(fp)) return 0;
-
   struct inode_s* curr = indexfind(mach->thismap, fp);
+  struct inode_s finfo = {(char*) fp, *st, 0, 0, 0, 0};
+  if (filterfile(mach, fp, curr, &finfo)) return 0;
   if (curr != NULL) {
-    // check if the file was modified during the command execution
-    struct fsstat_s mod = {0};
-    if (fsstat(fp, &mod)) return -1;
-    curr->st = mod;// update the file info in the current index
+    // check if the file was modified during the command execution, unless the
+    // first stage took it from the previous index without stat'ing it
+    if (!mach->keepstat) indexsetstat(curr, st);
+    mach->nchild++;
     return 0;
   }
 
-  struct inode_s finfo = {0};
-  if ((finfo.fp = strdup(fp)) == NULL) return -1;
-  if (fsstat(fp, &finfo.st)) return -1;
   if ((curr = indexput(mach->thismap, finfo)) == NULL) return -1;
+  mach->nchild++;
   invokehook(mach, new, curr);
 
   return 0;
 }
 
-/// @brief Pushes a directory path onto the directory queue for processing.
+/// @brief Pushes a directory path onto the directory queue for processing,
+/// unless the directory is pruned.
 /// @param fp The directory path to push
+/// @param st The stat info of the directory (unused, directories are stat'ed
+/// again when popped from the queue)
 /// @param udata The diff engine state context
 /// @return 0 if successful, otherwise a non-zero error code.
-static int dqpush(const char* fp, void* udata) {
+static int dqpush(const char* fp, const struct fsstat_s* st, void* udata) {
+  (void) st;
   struct deng_state_s* mach = (struct deng_state_s*) udata;
+  if (prunedir(mach, fp)) return 0;
   int err;
   if ((err = sladd(&mach->dirqueue, fp)))
     log_error("error pushing directory `%s`", fp);
+  mach->nchild++;
   return err;
 }
 
+/// @brief Returns the `fswalk` option flags for listing directories, which
+/// always stat the listed entries.
+/// @param mach The diff engine state context
+/// @return The `FSWALK_*` option bit flags.
+static int walkflags(const struct deng_state_s* mach) {
+  return FSWALK_STAT | (mach->opts->flags & DENG_OPT_URING ? FSWALK_URING : 0);
+}
+
+/// @brief Collects the directory node \p node for `execpostdirs`, which would
+/// otherwise have to list the whole index to find the directories to check,
+/// if the search state collects directories and is not in the post stage.
+/// @param mach The diff engine state context
+/// @param node The directory node
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int listdir(struct deng_state_s* mach, struct inode_s* node) {
+  if (!mach->listdirs || mach->post) return 0;
+  if (mach->ndirs == mach->capdirs) {
+    const long cap = mach->capdirs > 0 ? mach->capdirs * 2 : 64;
+    struct inode_s** r;
+    if ((r = realloc(mach->dirs, cap * sizeof(*r))) == NULL) return -1;
+    mach->dirs = r, mach->capdirs = cap;
+  }
+  mach->dirs[mach->ndirs++] = node;
+  return 0;
+}
+
+/// @brief Inserts or updates the directory node for \p dir in the current
+/// index. The directory's child count is taken from the `nchild` counter of
+/// the search state. Directories modified shortly before the search started
+/// are recorded with a zero mtime so they are always listed by the next search.
+/// @param mach The diff engine state context
+/// @param dir The directory path
+/// @param st The stat info of the directory
+/// @param age The number of consecutive searches the directory has been
+/// skipped, or NULL to keep the age of an existing directory node
+/// @return 0 if successful, otherwise a non-zero error code.
+static int recorddir(struct deng_state_s* mach, const char* dir,
+                     const struct fsstat_s* st, const uint32_t* age) {
+  struct inode_s dinfo = {(char*) dir, *st, INODE_DIR, age ? *age : 0, 0, 0};
+  if (dinfo.st.lmod + DENGRACYMS > mach->started) dinfo.st.lmod = 0;
+  dinfo.st.fsze = (uint64_t) mach->nchild;
+
+  struct inode_s* curr;
+  if ((curr = indexfind(mach->thismap, dir)) != NULL) {
+    curr->st = dinfo.st;
+    if (age != NULL) curr->age = *age;
+    return 0;
+  }
+
+  const struct inode_s* prev = indexfind(mach->lastmap, dir);
+  if (prev != NULL) {
+    dinfo.fp = prev->fp;// intern the previous index's filepath
+    curr = indexputref(mach->thismap, dinfo);
+  } else {
+    curr = indexput(mach->thismap, dinfo);
+  }
+  if (curr == NULL) return -1;
+  return listdir(mach, curr);
+}
+
+/// @brief Compares two index nodes in the order in which their filepaths, and
+/// the filepaths of any directory's descendants, sort using `strcmp(3)`. This
+/// is the order in which a `FSWALK_SORTED` walk visits the nodes.
+/// @param a The first index node pointer to compare
+/// @param b The second index node pointer to compare
+/// @return The result of the comparison.
+static int inodewalkcmp(const void* a, const void* b) {
+  const struct inode_s* na = *(const struct inode_s**) a;
+  const struct inode_s* nb = *(const struct inode_s**) b;
+  const unsigned char* pa = (const unsigned char*) na->fp;
+  const unsigned char* pb = (const unsigned char*) nb->fp;
+  while (*pa != '\0' && *pa == *pb) pa++, pb++;
+  const int ca = *pa != '\0' ? *pa : (na->flags & INODE_DIR ? '/' : 0);
+  const int cb = *pb != '\0' ? *pb : (nb->flags & INODE_DIR ? '/' : 0);
+  return ca - cb;
+}
+
+/// @brief Finds the first entry in the sorted previous index which does not
+/// sort before \p key.
+/// @param mach The diff engine state context
+/// @param key The filepath to search for
+/// @return The position of the entry, or the size of the index if none.
+static long lastlowerbound(const struct deng_state_s* mach, const char* key) {
+  long lo = 0, hi = mach->lastmap->size;
+  while (lo < hi) {
+    const long mid = lo + (hi - lo) / 2;
+    if (strcmp(mach->lastlist[mid]->fp, key) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/// @brief Lists the direct children (files and directories) of directory
+/// \p dir recorded in the sorted previous index, in walk order. The subtrees
+/// of child directories sort contiguously and are skipped with a binary search
+/// instead of being scanned.
+/// @param mach The diff engine state context
+/// @param dir The directory path
+/// @param len Set to the number of children listed
+/// @return A dynamically allocated array of child nodes which must be freed by
+/// the caller, or NULL if an error occurred.
+static struct inode_s** lastchildren(const struct deng_state_s* mach,
+                                     const char* dir, long* len) {
+  const size_t dlen = strlen(dir);
+  struct inode_s** ch = NULL; /* child node list */
+  long cap = 0;               /* child node list capacity */
+  char* key = NULL;           /* binary search key buffer */
+  *len = 0;
+
+  if ((key = malloc(dlen + 2)) == NULL) return NULL;
+  memcpy(key, dir, dlen);
+  key[dlen] = '/', key[dlen + 1] = '\0';
+
+  long i = lastlowerbound(mach, key);
+  while (i < mach->lastmap->size) {
+    struct inode_s* node = mach->lastlist[i];
+    if (strncmp(node->fp, key, dlen + 1) != 0) break;
+    const char* rest = node->fp + dlen + 1;
+    const char* sep = strchr(rest, '/');
+    if (sep == NULL) {
+      if (*len == cap) {
+        cap = cap > 0 ? cap * 2 : 16;
+        struct inode_s** r;
+        if ((r = realloc(ch, cap * sizeof(*ch))) == NULL) goto err;
+        ch = r;
+      }
+      ch[(*len)++] = node, i++;
+      continue;
+    }
+
+    // skip past the subtree of the child directory, all of its entries share
+    // the prefix `dir/child/` and sort before `dir/child0` ('0' follows '/')
+    const size_t plen = sep - node->fp;
+    char* r;
+    if ((r = realloc(key, plen + 2)) == NULL) goto err;
+    key = r;
+    memcpy(key, node->fp, plen);
+    key[plen] = '0', key[plen + 1] = '\0';
+    i = lastlowerbound(mach, key);
+    key[dlen] = '/', key[dlen + 1] = '\0';
+  }
+
+  free(key);
+  if (ch != NULL) qsort(ch, *len, sizeof(*ch), inodewalkcmp);
+  if (ch == NULL && (ch = malloc(sizeof(*ch))) == NULL) return NULL;
+  return ch;
+
+err:
+  free(key);
+  free(ch);
+  return NULL;
+}
+
+/// @brief Determines whether directory \p dir is unchanged since the previous
+/// search and its children may be taken from the previous index instead of
+/// listing the directory. The directory's modification time must match its
+/// previous directory node, and its previously indexed child count must match
+/// the children found in the previous index.
+/// @param mach The diff engine state context
+/// @param dir The directory path
+/// @param st The current stat info of the directory
+/// @param len Set to the number of children if skippable
+/// @return The list of children if skippable, which must be freed by the
+/// caller, otherwise NULL.
+static struct inode_s** skipdir(const struct deng_state_s* mach,
+                                const char* dir, const struct fsstat_s* st,
+                                long* len) {
+  if (!(mach->opts->flags & DENG_OPT_DIRSKIP) || mach->lastlist == NULL)
+    return NULL;
+  const struct inode_s* prev = indexfind(mach->lastmap, dir);
+  if (prev == NULL || !(prev->flags & INODE_DIR) || prev->st.lmod == 0 ||
+      prev->st.lmod != st->lmod)
+    return NULL;
+
+  struct inode_s** ch;
+  if ((ch = lastchildren(mach, dir, len)) == NULL) return NULL;
+  if ((uint64_t) *len != prev->st.fsze) {
+    free(ch);// previous index is inconsistent, list the directory instead
+    return NULL;
+  }
+  return ch;
+}
+
+/// @brief Computes the age of an unchanged directory which is being skipped,
+/// and whether its files are due to be re-stat'ed per the configured cadence.
+/// @param mach The diff engine state context
+/// @param dir The directory path
+/// @param restat Set to true if the directory's files should be re-stat'ed
+/// @return The new age of the directory.
+static uint32_t skipage(const struct deng_state_s* mach, const char* dir,
+                        bool* restat) {
+  const struct inode_s* prev = indexfind(mach->lastmap, dir);
+  const uint32_t age = prev->age + 1;
+  *restat = mach->opts->restat > 0 && age >= mach->opts->restat;
+  return *restat ? 0 : age;
+}
+
+/// @brief Determines whether the files of directory \p dir were taken from the
+/// previous index by the first stage without being stat'ed. The post stage
+/// must then keep their stat info, or a file modified in place would be
+/// recorded as unmodified before its directory is due to be re-stat'ed.
+/// Such files only had unmodified (NOP) events, so no command touched them.
+/// @param mach The diff engine state context
+/// @param dir The directory path
+/// @return true if the stat info of the directory's files must be kept
+static bool keptstat(const struct deng_state_s* mach, const char* dir) {
+  const struct inode_s* node = indexfind(mach->thismap, dir);
+  return node != NULL && (node->flags & INODE_DIR) && node->age > 0;
+}
+
+/// @struct dscan_s
+/// @brief Listing of a single directory produced by a parallel scanner thread
+/// and applied to the current index by the searching thread.
+struct dscan_s {
+  struct fsstat_s st;      ///< Stat info of the directory
+  bool hasst;              ///< Stat info of the directory is valid
+  uint32_t age;            ///< Age to record for the directory
+  struct dscanent_s* ents; ///< Child entries
+  long len;                ///< Number of child entries
+  long cap;                ///< Allocated capacity of `ents`
+  char* strs;              ///< String buffer, starting with the directory path
+  size_t strslen;          ///< Used length of `strs`
+  size_t strscap;          ///< Allocated capacity of `strs`
+  struct scanwk_s* wk;     ///< Scanner thread producing the listing
+  bool skipped;            ///< Children were taken from the previous index
+  bool post;               ///< Listed by the post stage
+  deng_filter_t prune;     ///< Directory prune filter, or NULL
+  long pruned;             ///< Number of child directories pruned
+};
+
+/// @brief Appends a string to the string buffer of a directory listing.
+/// @param ds The directory listing
+/// @param str The string to append
+/// @param off Set to the offset of the appended string
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int dscanstr(struct dscan_s* ds, const char* str, size_t* off) {
+  const size_t len = strlen(str) + 1;
+  if (ds->strslen + len > ds->strscap) {
+    const size_t cap = (ds->strslen + len) * 2;
+    char* strs;
+    if ((strs = realloc(ds->strs, cap)) == NULL) return -1;
+    ds->strs = strs, ds->strscap = cap;
+  }
+  memcpy(ds->strs + ds->strslen, str, len);
+  *off = ds->strslen;
+  ds->strslen += len;
+  return 0;
+}
+
+/// @brief Appends a child entry to a directory listing. Child directories are
+/// also queued on the producing scanner thread, unless they are pruned.
+/// @param ds The directory listing
+/// @param fp The filepath of the child
+/// @param st The stat info of the child
+/// @param dir True if the child is a directory
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int dscanadd(struct dscan_s* ds, const char* fp,
+                    const struct fsstat_s* st, const bool dir) {
+  if (dir && ds->prune != NULL && ds->prune(fp, ds->post)) {
+    ds->pruned++;
+    return 0;
+  }
+  if (ds->len == ds->cap) {
+    const long cap = ds->cap > 0 ? ds->cap * 2 : 16;
+    struct dscanent_s* ents;
+    if ((ents = realloc(ds->ents, cap * sizeof(*ents))) == NULL) return -1;
+    ds->ents = ents, ds->cap = cap;
+  }
+  struct dscanent_s* ent = &ds->ents[ds->len];
+  if (dscanstr(ds, fp, &ent->fpoff)) return -1;
+  ent->st = *st, ent->dir = dir, ent->hashed = false;
+  ds->len++;
+  return dir ? scanpush(ds->wk, fp) : 0;
+}
+
+/// @brief `fswalk` file callback which appends a file to a directory listing.
+/// @param fp The file path
+/// @param st The stat info of the file
+/// @param udata The directory listing
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int dscanfile(const char* fp, const struct fsstat_s* st, void* udata) {
+  return dscanadd(udata, fp, st, false);
+}
+
+/// @brief `fswalk` directory callback which appends a directory to a
+/// directory listing.
+/// @param fp The directory path
+/// @param st The stat info of the directory
+/// @param udata The directory listing
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int dscandir(const char* fp, const struct fsstat_s* st, void* udata) {
+  return dscanadd(udata, fp, st, true);
+}
+
+/// @brief Digests the file of a child entry on the parallel scanner thread if
+/// the file is indexed by the previous index state, but its digest cannot be
+/// reused. New files are digested by the searching thread instead, once they
+/// passed the file filter.
+/// @param mach The diff engine state context
+/// @param fp The filepath of the child
+/// @param ent The child entry
+static void dscanhash(const struct deng_state_s* mach, const char* fp,
+                      struct dscanent_s* ent) {
+  if (ent->dir) return;
+  const struct inode_s* prev = indexfind(mach->lastmap, fp);
+  if (prev == NULL || (prev->flags & INODE_DIR)) return;
+  if ((prev->flags & INODE_DIGEST) && samestat(mach, &prev->st, &ent->st))
+    return;
+  ent->hashed = fsdigest(fp, &ent->digest) == 0;
+}
+
+/// @brief Frees a directory listing, also used as the `scanrun` free function.
+/// @param res The directory listing to free
+static void dscanfree(void* res) {
+  struct dscan_s* ds = res;
+  free(ds->ents);
+  free(ds->strs);
+  free(ds);
+}
+
+/// @brief `scanrun` directory function which lists directory \p dir on a
+/// parallel scanner thread. Unchanged directories are skipped as in
+/// `execstage`. Known files are digested if the search state requires it, see
+/// `dscanhash`. The previous index is only read, so no locking is required.
+/// @param wk The scanner thread
+/// @param dir The directory path
+/// @param res Set to the directory listing
+/// @param udata The diff engine state context
+/// @return 0 if successful, otherwise a non-zero error code.
+static int dscanlist(struct scanwk_s* wk, const char* dir, void** res,
+                     void* udata) {
+  const struct deng_state_s* mach = udata;
+  struct dscan_s* ds;
+  if ((ds = calloc(1, sizeof(*ds))) == NULL) return -1;
+  ds->wk = wk, ds->prune = mach->opts->prune, ds->post = mach->post;
+  size_t off;
+  int err;
+  if ((err = dscanstr(ds, dir, &off))) goto err;
+  ds->hasst = fsstat(dir, &ds->st) == 0;
+
+  long len = 0;
+  struct inode_s** ch = mach->canskip && ds->hasst
+                                ? skipdir(mach, dir, &ds->st, &len)
+                                : NULL;
+  if (ch != NULL) {
+    bool restat;
+    ds->age = skipage(mach, dir, &restat);
+    ds->skipped = true;
+    for (long i = 0; i < len && !err; i++) {
+      const struct inode_s* c = ch[i];
+      if (mach->post && !(c->flags & INODE_DIR)) continue;
+      struct fsstat_s st = c->st;
+      if (restat && !(c->flags & INODE_DIR) && fsstat(c->fp, &st)) {
+        log_error("error accessing `%s`: %d", c->fp, errno);
+        continue;
+      }
+      err = dscanadd(ds, c->fp, &st, c->flags & INODE_DIR);
+    }
+    free(ch);
+  } else {
+    err = fswalk(dir, dscanfile, dscandir, ds, walkflags(mach));
+  }
+  if (err) goto err;
+  for (long i = 0; i < ds->len && mach->prehash; i++)
+    dscanhash(mach, ds->strs + ds->ents[i].fpoff, &ds->ents[i]);
+
+  *res = ds;
+  return 0;
+err:
+  dscanfree(ds);
+  return err;
+}
+
+/// @brief `scanrun` result function which applies a directory listing to the
+/// current index on the searching thread, using the stage file function of
+/// the search state. This function may trigger the same events as the stage
+/// file function, and the directory done (DIR_DONE) notification.
+/// @param res The directory listing
+/// @param udata The diff engine state context
+/// @return 0 if successful, otherwise a non-zero error code.
+static int dscanapply(void* res, void* udata) {
+  struct deng_state_s* mach = udata;
+  struct dscan_s* ds = res;
+  const char* dir = ds->strs;
+  mach->nchild = 0;
+  mach->keepstat = mach->post && !ds->skipped && keptstat(mach, dir);
+  if (mach->stats != NULL) mach->stats->pruned += ds->pruned;
+
+  int err = 0;
+  for (long i = 0; i < ds->len && !err; i++) {
+    const struct dscanent_s* ent = &ds->ents[i];
+    if (ent->dir) {
+      mach->nchild++;
+    } else {
+      mach->hashed = ent->hashed ? ent : NULL;
+      err = mach->stagefn(ds->strs + ent->fpoff, &ent->st, mach);
+      mach->hashed = NULL;
+    }
+  }
+  // the first stage already recorded the directories skipped by the post stage
+  const uint32_t* age = mach->canskip && !mach->post ? &ds->age : NULL;
+  if (!err && ds->hasst && !(ds->skipped && mach->post))
+    err = recorddir(mach, dir, &ds->st, age);
+  if (!err) notifyhook(mach, DENG_NOTIF_DIR_DONE);
+
+  dscanfree(ds);
+  return err;
+}
+
+/// @brief Parallel equivalent of `execstage` using `opts->threads` scanner
+/// threads. Directories are listed and stat'ed on the scanner threads, while
+/// the listings are applied to the current index and all hooks are invoked on
+/// the calling thread, so the triggered events are identical.
+/// @param mach The diff engine state context
+/// @param sd The initial search directory path
+/// @param filefn The function to invoke for each file in the directory tree
+/// @param canskip True if unchanged directories may be skipped
+/// @return 0 if successful, otherwise a non-zero error code.
+static int execscan(struct deng_state_s* mach, const char* sd,
+                    fswalkfn_t filefn, const bool canskip) {
+  mach->stagefn = filefn, mach->canskip = canskip;
+  int err;
+  if ((err = scanrun(sd, mach->opts->threads, dscanlist, dscanapply,
+                     dscanfree, mach))) {
+    log_error("parallel scan of `%s` returned %d", sd, err);
+    return -1;
+  }
+  notifyhook(mach, DENG_NOTIF_STAGE_DONE);
+
+  return 0;
+}
+
 /// @brief Resets the directory queue to the initial search path, and invokes
 /// the `filefn` function for each file in the directory tree, recursively.
+/// If the `DENG_OPT_DIRSKIP` option is set and \p canskip is true, unchanged
+/// directories are not listed and their files are taken from the previous
+/// index instead, or are left as recorded by the first stage in the post
+/// stage. If more than one scan thread is configured, the stage is performed
+/// by `execscan`.
 /// @param mach The diff engine state context
 /// @param sd The initial search directory path
 /// @param filefn The function to invoke for each file in the directory tree
+/// @param canskip True if unchanged directories may be skipped
 /// @return 0 if successful, otherwise a non-zero error code.
 static int execstage(struct deng_state_s* mach, const char* sd,
-                     fswalkfn_t filefn) {
+                     fswalkfn_t filefn, const bool canskip) {
+  if (mach->opts->threads > 1) return execscan(mach, sd, filefn, canskip);
+
   slfree(mach->dirqueue);
   mach->dirqueue = NULL;
   if (sladd(&mach->dirqueue, sd)) return -1;
 
   char* dir;
   while ((dir = slpop(mach->dirqueue)) != NULL) {
-    int err;
-    if ((err = fswalk(dir, filefn, dqpush, (void*) mach))) {
+    struct fsstat_s dst = {0};
+    const bool hasst = fsstat(dir, &dst) == 0;
+    mach->nchild = 0;
+
+    long len = 0;
+    struct inode_s** ch = canskip && hasst ? skipdir(mach, dir, &dst, &len)
+                                           : NULL;
+    const bool skipped = ch != NULL;
+    uint32_t age = 0;
+    int err = 0;
+    if (skipped) {
+      bool restat;
+      age = skipage(mach, dir, &restat);
+      for (long i = 0; i < len && !err; i++) {
+        const struct inode_s* c = ch[i];
+        if (c->flags & INODE_DIR) {
+          err = dqpush(c->fp, NULL, mach);
+        } else if (!mach->post) {
+          err = stagefile(mach, c->fp, restat ? NULL : &c->st);
+        }
+      }
+      free(ch);
+    } else {
+      mach->keepstat = mach->post && keptstat(mach, dir);
+      err = fswalk(dir, filefn, dqpush, (void*) mach, walkflags(mach));
+    }
+    if (err) {
       log_error("file func for `%s` returned %d", dir, err);
+      free(dir);
+      return -1;
+    }
+    // the first stage already recorded the directories skipped by the post
+    // stage, and the post stage keeps the recorded ages
+    const bool record = hasst && !(skipped && mach->post);
+    if (record &&
+        recorddir(mach, dir, &dst, canskip && !mach->post ? &age : NULL)) {
+      free(dir);
       return -1;
     }
     notifyhook(mach, DENG_NOTIF_DIR_DONE);
@@ -144,6 +817,214 @@ static int execstage(struct deng_state_s* mach, const char* sd,
   return 0;
 }
 
+/// @brief Advances the merge cursor past all previous index entries which sort
+/// before \p fp, or through the end of the previous index if \p fp is NULL.
+/// Each skipped file entry no longer exists and triggers a deleted (DEL)
+/// event. Skipped directory entries are ignored.
+/// @param mach The diff engine state context
+/// @param fp The filepath to advance to, or NULL
+static void mergedel(struct deng_state_s* mach, const char* fp) {
+  while (mach->lastpos < mach->lastmap->size) {
+    struct inode_s* prev = mach->lastlist[mach->lastpos];
+    if (fp != NULL && strcmp(prev->fp, fp) >= 0) break;
+    if (!(prev->flags & INODE_DIR)) invokehook(mach, del, prev);
+    mach->lastpos++;
+  }
+}
+
+/// @brief Merge mode equivalent of `stagefile`. Files must be provided in
+/// sorted order. The file is compared to the previous index entry at the merge
+/// cursor, and may trigger new (NEW), modified (MOD), unmodified (NOP) and
+/// deleted (DEL) events.
+/// @param mach The diff engine state context
+/// @param fp The file path to process
+/// @param st The stat info of the file, or NULL to stat the file
+/// @return 0 if successful, otherwise a non-zero error code.
+static int mergefile(struct deng_state_s* mach, const char* fp,
+                     const struct fsstat_s* st) {
+  mergedel(mach, fp);
+  const struct inode_s* prev = NULL;
+  if (mach->lastpos < mach->lastmap->size &&
+      strcmp(mach->lastlist[mach->lastpos]->fp, fp) == 0)
+    prev = mach->lastlist[mach->lastpos];
+
+  // an ignored file is left at the merge cursor and deleted by the next file
+  struct inode_s finfo = {(char*) fp, {0}, 0, 0, 0, 0};
+  if (filterfile(mach, fp, prev, &finfo)) return 0;
+  if (st != NULL) {
+    finfo.st = *st;
+  } else if (fsstat(fp, &finfo.st)) {
+    return -1;
+  }
+
+  if (prev != NULL) {
+    mach->lastpos++;
+    if (prev->flags & INODE_DIR) prev = NULL;
+  }
+
+  return diffnode(mach, finfo, prev);
+}
+
+static int mergedir(struct deng_state_s* mach, const char* dir,
+                    const struct fsstat_s* st);
+
+/// @brief `fswalk` file callback for `mergefile`.
+/// @param fp The file path to process
+/// @param st The stat info of the file
+/// @param udata The diff engine state context
+/// @return 0 if successful, otherwise a non-zero error code.
+static int mergefilefn(const char* fp, const struct fsstat_s* st,
+                       void* udata) {
+  return mergefile((struct deng_state_s*) udata, fp, st);
+}
+
+/// @brief `fswalk` directory callback for `mergedir`, which ignores pruned
+/// directories.
+/// @param fp The directory path to process
+/// @param st The stat info of the directory
+/// @param udata The diff engine state context
+/// @return 0 if successful, otherwise a non-zero error code.
+static int mergedirfn(const char* fp, const struct fsstat_s* st,
+                      void* udata) {
+  struct deng_state_s* mach = (struct deng_state_s*) udata;
+  if (prunedir(mach, fp)) return 0;
+  return mergedir(mach, fp, st);
+}
+
+/// @brief Recursively walks the directory \p dir in sorted filepath order and
+/// merges each file against the previous index using `mergefile`. If the
+/// `DENG_OPT_DIRSKIP` option is set, unchanged directories are not listed and
+/// their files are taken from the previous index instead.
+/// @param mach The diff engine state context
+/// @param dir The directory path to walk
+/// @param st The stat info of the directory, or NULL to stat the directory
+/// @return 0 if successful, otherwise a non-zero error code.
+static int mergedir(struct deng_state_s* mach, const char* dir,
+                    const struct fsstat_s* st) {
+  const long nparent = mach->nchild;
+  mach->nchild = 0;
+
+  struct fsstat_s dst = {0};
+  bool hasst = true;
+  if (st != NULL) {
+    dst = *st;
+  } else if (fsstat(dir, &dst)) {
+    hasst = false;
+  }
+
+  long len = 0;
+  struct inode_s** ch = hasst ? skipdir(mach, dir, &dst, &len) : NULL;
+  uint32_t age = 0;
+  int err = 0;
+  if (ch != NULL) {
+    bool restat;
+    age = skipage(mach, dir, &restat);
+    for (long i = 0; i < len && !err; i++) {
+      const struct inode_s* c = ch[i];
+      if (c->flags & INODE_DIR) {
+        err = mergedirfn(c->fp, NULL, mach);
+      } else {
+        err = mergefile(mach, c->fp, restat ? NULL : &c->st);
+      }
+    }
+    free(ch);
+  } else if ((err = fswalk(dir, mergefilefn, mergedirfn, mach,
+                           FSWALK_SORTED | walkflags(mach)))) {
+    log_error("file func for `%s` returned %d", dir, err);
+  }
+  if (!err && hasst) err = recorddir(mach, dir, &dst, &age);
+  if (!err) notifyhook(mach, DENG_NOTIF_DIR_DONE);
+  mach->nchild = nparent + 1;
+  return err;
+}
+
+static int postdir(struct deng_state_s* mach, const char* dir,
+                   const struct fsstat_s* st);
+
+/// @brief `fswalk` directory callback for `postdir`. Indexed directories are
+/// counted but not walked, since they are checked by `execpostdirs` itself.
+/// Pruned directories are ignored.
+/// @param fp The directory path
+/// @param st The stat info of the directory
+/// @param udata The diff engine state context
+/// @return 0 if successful, otherwise a non-zero error code.
+static int postdirfn(const char* fp, const struct fsstat_s* st, void* udata) {
+  struct deng_state_s* mach = udata;
+  if (prunedir(mach, fp)) return 0;
+  const struct inode_s* node = indexfind(mach->thismap, fp);
+  if (node != NULL && (node->flags & INODE_DIR)) {
+    mach->nchild++;
+    return 0;
+  }
+  const long nparent = mach->nchild;
+  const int err = postdir(mach, fp, st);
+  mach->nchild = nparent + 1;
+  return err;
+}
+
+/// @brief Lists the directory \p dir after the command execution stage as
+/// `stagepost` would, and records its directory node. New subdirectories are
+/// walked recursively.
+/// @param mach The diff engine state context
+/// @param dir The directory path
+/// @param st The stat info of the directory
+/// @return 0 if successful, otherwise a non-zero error code.
+static int postdir(struct deng_state_s* mach, const char* dir,
+                   const struct fsstat_s* st) {
+  mach->nchild = 0;
+  mach->keepstat = keptstat(mach, dir);
+  int err;
+  if ((err = fswalk(dir, stagepost, postdirfn, mach, walkflags(mach)))) {
+    log_error("file func for `%s` returned %d", dir, err);
+    return err;
+  }
+  if ((err = recorddir(mach, dir, st, NULL))) return err;
+  notifyhook(mach, DENG_NOTIF_DIR_DONE);
+  return 0;
+}
+
+/// @brief Targeted equivalent of the `stagepost` stage. Each directory node
+/// recorded by the first stage is re-stat'ed, and only directories modified
+/// since they were listed, or recorded without a trusted modification time,
+/// are listed again. This may trigger new (NEW) events for files created
+/// during the command execution stage.
+/// @param mach The diff engine state context
+/// @return 0 if successful, otherwise a non-zero error code.
+static int execpostdirs(struct deng_state_s* mach) {
+  // directories recorded by this stage are walked by `postdir` itself
+  const long ndirs = mach->ndirs;
+  int err = 0;
+  for (long i = 0; i < ndirs && !err; i++) {
+    const struct inode_s* node = mach->dirs[i];
+    struct fsstat_s st;
+    if (fsstat(node->fp, &st)) continue;// removed by a command
+    if (node->st.lmod != 0 && node->st.lmod == st.lmod) continue;
+    err = postdir(mach, node->fp, &st);
+  }
+  if (!err) notifyhook(mach, DENG_NOTIF_STAGE_DONE);
+
+  return err;
+}
+
+/// @brief Merge mode equivalent of the `stagepre` stage and `checkremoved`.
+/// The search directory is walked in sorted order and merged against the
+/// sorted previous index in a single pass. This may trigger new (NEW),
+/// modified (MOD), unmodified (NOP) and deleted (DEL) events.
+/// @param mach The diff engine state context
+/// @param sd The initial search directory path
+/// @return 0 if successful, otherwise a non-zero error code.
+static int execmerge(struct deng_state_s* mach, const char* sd) {
+  mach->lastpos = 0;
+
+  int err;
+  if ((err = mergedir(mach, sd, NULL))) return err;
+  notifyhook(mach, DENG_NOTIF_STAGE_DONE);
+  mergedel(mach, NULL);// remaining entries sort after all current files
+  notifyhook(mach, DENG_NOTIF_STAGE_DONE);
+
+  return 0;
+}
+
 /// @brief Compares the current file system state with a previous index to
 /// determine which files were removed. This function may trigger deleted (DEL)
 /// events for each file in the previous index that is not present in the
@@ -155,6 +1036,7 @@ static int checkremoved(struct deng_state_s* mach) {
   if ((lastlist = indexlist(mach->lastmap)) == NULL) return -1;
   for (long i = 0; i < mach->lastmap->size; i++) {
     struct inode_s* prev = lastlist[i];
+    if (prev->flags & INODE_DIR) continue;
     if (indexfind(mach->thismap, prev->fp) != NULL) continue;
     invokehook(mach, del, prev);
   }
@@ -164,20 +1046,531 @@ static int checkremoved(struct deng_state_s* mach) {
   return 0;
 }
 
-int dengsearch(const char* sd, deng_filter_t filter,
+int dengsearch(const char* sd, deng_match_t filter,
                const struct deng_hooks_s* hooks, const struct index_s* old,
-               struct index_s* new) {
+               struct index_s* new, const struct deng_opts_s* opts) {
   assert(sd != NULL);
   assert(hooks != NULL);
   assert(old != NULL);
   assert(new != NULL);
+  assert(opts != NULL);
 
-  struct deng_state_s mach = {NULL, filter, hooks, old, new};
-  int err;
-  if ((err = execstage(&mach, sd, stagepre))) goto ret;
-  if ((err = checkremoved(&mach))) goto ret;
-  if ((err = execstage(&mach, sd, stagepost))) goto ret;
+  struct deng_state_s mach = {
+          .ffn = filter,
+          .hooks = hooks,
+          .lastmap = old,
+          .thismap = new,
+          .opts = opts,
+          .started = (uint64_t) time(NULL) * 1000,
+          .stats = opts->stats,
+          .prehash = opts->flags & DENG_OPT_DIGEST,
+          .listdirs = opts->flags & DENG_OPT_POSTDIRS,
+  };
+
+  // merge and directory skipping modes require the sorted previous index
+  int err = 0;
+  if ((opts->flags & (DENG_OPT_MERGE | DENG_OPT_DIRSKIP)) && old->size > 0)
+    if ((mach.lastlist = indexsorted(old)) == NULL) return -1;
+
+  if (opts->flags & DENG_OPT_MERGE) {
+    if ((err = execmerge(&mach, sd))) goto ret;
+  } else {
+    if ((err = execstage(&mach, sd, stagepre, true))) goto ret;
+    if ((err = checkremoved(&mach))) goto ret;
+  }
+  mach.stats = NULL;// the post stage revisits the same entries
+  mach.prehash = false;
+  mach.post = true;
+  if (opts->flags & DENG_OPT_POSTDIRS) {
+    err = execpostdirs(&mach);
+  } else {
+    err = execstage(&mach, sd, stagepost, true);
+  }
 ret:
+  free(mach.lastlist);
+  free(mach.dirs);
   slfree(mach.dirqueue);
   return err;
 }
+
+/// @brief Triggers a file event for a reconciled path, or defers it if the
+/// search state is collecting the reconciled nodes to diff them against the
+/// previous index state once all paths are reconciled.
+/// @param mach The diff engine state context
+/// @param hook The file event hook function, or NULL
+/// @param node The file node
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int synchook(struct deng_state_s* mach, void (*hook)(struct inode_s*),
+                    struct inode_s* node) {
+  if (!mach->defer) {
+    if (hook != NULL) hook(node);
+    return 0;
+  }
+  if (mach->synclen == mach->synccap) {
+    const long cap = mach->synccap > 0 ? mach->synccap * 2 : 64;
+    struct inode_s** r;
+    if ((r = realloc(mach->synced, cap * sizeof(*r))) == NULL) return -1;
+    mach->synced = r, mach->synccap = cap;
+  }
+  mach->synced[mach->synclen++] = node;
+  return 0;
+}
+
+/// @brief Removes the node of the no longer existing path \p fp from the
+/// current index. If the path was an indexed directory, all nodes within its
+/// subtree are removed as well. This function may trigger deleted (DEL)
+/// events for each removed file.
+/// @param mach The diff engine state context
+/// @param fp The removed file or directory path
+/// @return 0 if successful, otherwise a non-zero error code.
+static int syncdel(struct deng_state_s* mach, const char* fp) {
+  struct inode_s* node;
+  if ((node = indexdel(mach->thismap, fp)) == NULL) return 0;
+  if (!(node->flags & INODE_DIR)) return synchook(mach, mach->hooks->del, node);
+  if (mach->thismap->size == 0) return 0;
+
+  struct inode_s** list;
+  long n;
+  if ((list = indexsubtree(mach->thismap, fp, &n)) == NULL) return -1;
+  int err = 0;
+  for (long i = 0; i < n && !err; i++) {
+    struct inode_s* c = list[i];
+    indexdel(mach->thismap, c->fp);
+    if (!(c->flags & INODE_DIR)) err = synchook(mach, mach->hooks->del, c);
+  }
+  free(list);
+
+  return err;
+}
+
+/// @brief Compares two index node pointers by filepath.
+/// @param a The first index node pointer to compare
+/// @param b The second index node pointer to compare
+/// @return The result of the comparison.
+static int inodefpcmp(const void* a, const void* b) {
+  const struct inode_s* na = *(const struct inode_s**) a;
+  const struct inode_s* nb = *(const struct inode_s**) b;
+  return strcmp(na->fp, nb->fp);
+}
+
+/// @brief Checks if the first \p len characters of \p fp are the filepath of
+/// a removed directory node of \p gone.
+/// @param gone The removed directory nodes, sorted by filepath
+/// @param n The number of removed directory nodes
+/// @param fp The filepath to check
+/// @param len The length of the prefix of \p fp to check
+/// @return true if the prefix is a removed directory, otherwise false
+static bool syncgonefind(struct inode_s** gone, long n, const char* fp,
+                         const size_t len) {
+  long lo = 0, hi = n;
+  while (lo < hi) {
+    const long mid = lo + (hi - lo) / 2;
+    int cmp = strncmp(gone[mid]->fp, fp, len);
+    if (cmp == 0 && gone[mid]->fp[len] == '\0') return true;
+    if (cmp == 0) cmp = 1;// the removed directory path is longer
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return false;
+}
+
+/// @brief Removes the indexed direct children of directory \p dir which no
+/// longer exist, including their subtrees. This requires a scan of the whole
+/// indexed subtree of \p dir, so it is only used once a directory is known to
+/// have lost children. The subtrees of all removed child directories are
+/// removed by a single second scan. This function may trigger deleted (DEL)
+/// events for each removed file.
+/// @param mach The diff engine state context
+/// @param dir The directory path
+/// @return 0 if successful, otherwise a non-zero error code.
+static int syncgone(struct deng_state_s* mach, const char* dir) {
+  if (mach->thismap->size == 0) return 0;
+
+  struct inode_s** list;
+  long size;
+  if ((list = indexsubtree(mach->thismap, dir, &size)) == NULL) return -1;
+  struct inode_s** gone = NULL; /* removed child directories, sorted */
+  long ngone = 0, capgone = 0;
+  const size_t len = strlen(dir);
+  int err = 0;
+  for (long i = 0; i < size && !err; i++) {
+    struct inode_s* c = list[i];
+    if (strchr(c->fp + len + 1, '/') != NULL) continue;// not a direct child
+    struct fsstat_s st;
+    if (fsstat(c->fp, &st) == 0 || (errno != ENOENT && errno != ENOTDIR))
+      continue;
+    indexdel(mach->thismap, c->fp);
+    if (!(c->flags & INODE_DIR)) {
+      err = synchook(mach, mach->hooks->del, c);
+      continue;
+    }
+    if (ngone == capgone) {
+      capgone = capgone > 0 ? capgone * 2 : 16;
+      struct inode_s** r;
+      if ((r = realloc(gone, capgone * sizeof(*r))) == NULL) {
+        err = -1;
+        break;
+      }
+      gone = r;
+    }
+    gone[ngone++] = c;
+  }
+
+  // remove the subtrees of the removed child directories
+  for (long i = 0; i < size && !err && ngone > 0; i++) {
+    struct inode_s* c = list[i];
+    const char* sep = strchr(c->fp + len + 1, '/');
+    if (sep == NULL || !syncgonefind(gone, ngone, c->fp, sep - c->fp))
+      continue;
+    indexdel(mach->thismap, c->fp);
+    if (!(c->flags & INODE_DIR)) err = synchook(mach, mach->hooks->del, c);
+  }
+  free(gone);
+  free(list);
+
+  return err;
+}
+
+/// @brief Reconciles the file \p fp with its node in the current index,
+/// inserting or updating the node. This function may trigger new (NEW) and
+/// modified (MOD) events. Unmodified files trigger no event.
+/// @param mach The diff engine state context
+/// @param fp The file path to reconcile
+/// @param st The stat info of the file
+/// @return 0 if successful, otherwise a non-zero error code.
+static int syncfile(struct deng_state_s* mach, const char* fp,
+                    const struct fsstat_s* st) {
+  struct inode_s* curr = indexfind(mach->thismap, fp);
+  struct inode_s finfo = {(char*) fp, *st, 0, 0, 0, 0};
+  if (filterfile(mach, fp, curr, &finfo)) return 0;
+  if (curr != NULL) mach->nknown++;
+  if (curr != NULL && (curr->flags & INODE_DIR)) {
+    // a directory was replaced by the file
+    if (syncdel(mach, fp)) return -1;
+    curr = NULL;
+  }
+  mach->nchild++;
+  if (curr != NULL) {
+    if (samestat(mach, &curr->st, st)) return 0;
+    const struct inode_s prev = *curr;
+    indexsetstat(curr, st);
+    if (!filemodified(mach, curr, &prev)) return 0;
+    return synchook(mach, mach->hooks->mod, curr);
+  }
+
+  if ((curr = indexput(mach->thismap, finfo)) == NULL) return -1;
+  digestnode(mach, curr, NULL);
+  return synchook(mach, mach->hooks->new, curr);
+}
+
+static int syncdir(struct deng_state_s* mach, const char* dir,
+                   const struct fsstat_s* st);
+
+/// @brief `fswalk` file callback for `syncfile`.
+/// @param fp The file path to reconcile
+/// @param st The stat info of the file
+/// @param udata The diff engine state context
+/// @return 0 if successful, otherwise a non-zero error code.
+static int syncfilefn(const char* fp, const struct fsstat_s* st, void* udata) {
+  return syncfile((struct deng_state_s*) udata, fp, st);
+}
+
+/// @brief `fswalk` directory callback for `syncdir`. Directories which are
+/// already indexed are counted but not walked, pruned directories are ignored.
+/// @param fp The directory path to reconcile
+/// @param st The stat info of the directory
+/// @param udata The diff engine state context
+/// @return 0 if successful, otherwise a non-zero error code.
+static int syncdirfn(const char* fp, const struct fsstat_s* st, void* udata) {
+  struct deng_state_s* mach = udata;
+  if (prunedir(mach, fp)) return 0;
+  const struct inode_s* node = indexfind(mach->thismap, fp);
+  mach->nchild++;
+  if (node != NULL) mach->nknown++;
+  if (node != NULL && (node->flags & INODE_DIR)) return 0;
+  return syncdir(mach, fp, st);
+}
+
+/// @brief Lists the directory \p dir and reconciles each file using
+/// `syncfile`. Subdirectories which are not yet indexed are walked
+/// recursively, indexed subdirectories are not. If fewer previously indexed
+/// children are found than recorded by the directory node, the children which
+/// no longer exist are removed. The directory node is then recorded as a full
+/// search would record it.
+/// @param mach The diff engine state context
+/// @param dir The directory path
+/// @param st The stat info of the directory
+/// @return 0 if successful, otherwise a non-zero error code.
+static int syncdir(struct deng_state_s* mach, const char* dir,
+                   const struct fsstat_s* st) {
+  const long nchild = mach->nchild, nknown = mach->nknown;
+  mach->nchild = mach->nknown = 0;
+
+  struct inode_s* curr = indexfind(mach->thismap, dir);
+  int err = 0;
+  if (curr != NULL && !(curr->flags & INODE_DIR)) {
+    // a file was replaced by the directory
+    indexdel(mach->thismap, dir);
+    err = synchook(mach, mach->hooks->del, curr);
+    curr = NULL;
+  }
+  if (!err && (err = fswalk(dir, syncfilefn, syncdirfn, mach,
+                            walkflags(mach))))
+    log_error("file func for `%s` returned %d", dir, err);
+  if (!err && curr != NULL && (uint64_t) mach->nknown < curr->st.fsze)
+    err = syncgone(mach, dir);
+
+  if (!err) {
+    struct inode_s dinfo = {(char*) dir, *st, INODE_DIR, 0, 0, 0};
+    if (dinfo.st.lmod + DENGRACYMS > mach->started) dinfo.st.lmod = 0;
+    dinfo.st.fsze = (uint64_t) mach->nchild;
+    if (curr != NULL) {
+      curr->st = dinfo.st, curr->age = 0;
+    } else if ((curr = indexput(mach->thismap, dinfo)) == NULL) {
+      err = -1;
+    }
+    if (!err) err = listdir(mach, curr);
+  }
+
+  mach->nchild = nchild, mach->nknown = nknown;
+  return err;
+}
+
+/// @brief Updates the directory node of the parent directory of \p fp, if
+/// indexed, after \p fp was reconciled. The parent's mtime is re-stat'ed and
+/// its child count adjusted by \p delta.
+/// @param mach The diff engine state context
+/// @param fp The reconciled path
+/// @param delta The change in the number of indexed nodes for \p fp
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int syncparent(struct deng_state_s* mach, const char* fp,
+                      const long delta) {
+  const char* sep = strrchr(fp, '/');
+  if (sep == NULL || sep == fp) return 0;
+  char* dir;
+  if ((dir = malloc(sep - fp + 1)) == NULL) return -1;
+  memcpy(dir, fp, sep - fp);
+  dir[sep - fp] = '\0';
+
+  struct inode_s* node = indexfind(mach->thismap, dir);
+  struct fsstat_s st;
+  int err = 0;
+  if (node != NULL && (node->flags & INODE_DIR) && fsstat(dir, &st) == 0) {
+    if (st.lmod + DENGRACYMS > mach->started) st.lmod = 0;
+    node->st.lmod = st.lmod;
+    if (delta >= 0 || node->st.fsze >= (uint64_t) -delta)
+      node->st.fsze += delta;
+    err = listdir(mach, node);
+  }
+  free(dir);
+  return err;
+}
+
+/// @brief Reconciles the single path \p fp with the current index, see
+/// `dengsync`, and updates the directory node of its parent. A pruned
+/// directory is reconciled as if it no longer exists.
+/// @param mach The diff engine state context
+/// @param fp The file or directory path to reconcile
+/// @return 0 if successful, otherwise a non-zero error code.
+static int syncpath(struct deng_state_s* mach, const char* fp) {
+  const bool had = indexfind(mach->thismap, fp) != NULL;
+  mach->nchild = mach->nknown = 0;
+
+  struct fsstat_s st;
+  bool dir;
+  int err;
+  if (fsstatdir(fp, &st, &dir)) {
+    if (errno != ENOENT && errno != ENOTDIR) return -1;
+    err = syncdel(mach, fp);
+  } else if (dir && prunedir(mach, fp)) {
+    err = syncdel(mach, fp);
+  } else {
+    err = dir ? syncdir(mach, fp, &st) : syncfile(mach, fp, &st);
+  }
+  if (err) return err;
+
+  const bool has = indexfind(mach->thismap, fp) != NULL;
+  return syncparent(mach, fp, (long) has - (long) had);
+}
+
+int dengsync(const char* fp, deng_match_t filter,
+             const struct deng_hooks_s* hooks, struct index_s* idx,
+             const struct deng_opts_s* opts) {
+  assert(fp != NULL);
+  assert(hooks != NULL);
+  assert(idx != NULL);
+  assert(opts != NULL);
+
+  struct deng_state_s mach = {
+          .ffn = filter,
+          .hooks = hooks,
+          .lastmap = idx,
+          .thismap = idx,
+          .opts = opts,
+          .started = (uint64_t) time(NULL) * 1000,
+  };
+  return syncpath(&mach, fp);
+}
+
+/// @brief Resolves a path read from a list of changed paths to the filepath
+/// of its index node. Paths are accepted relative to the search directory, or
+/// prefixed by the search directory path as they are indexed.
+/// @param sd The search directory path
+/// @param line The changed path, without trailing newline or slash
+/// @param buf Buffer used to join relative paths, freed by the caller
+/// @return The filepath, or NULL if the path is outside of the search
+/// directory, hidden (and would be skipped by a search) or an allocation
+/// error occurred.
+static const char* changepath(const char* sd, const char* line, char** buf) {
+  const size_t sdlen = strlen(sd);
+  const char* fp = line;
+  if (strncmp(line, sd, sdlen) != 0 ||
+      (line[sdlen] != '/' && line[sdlen] != '\0')) {
+    if (line[0] == '/') {
+      log_error("ignoring `%s` outside of `%s`", line, sd);
+      return NULL;
+    }
+    char* r;
+    if ((r = realloc(*buf, sdlen + strlen(line) + 2)) == NULL) return NULL;
+    sprintf(r, "%s/%s", sd, line);
+    *buf = r, fp = r;
+  }
+  for (const char* p = strchr(fp + sdlen, '/'); p != NULL;
+       p = strchr(p + 1, '/'))
+    if (p[1] == '.') return NULL;
+  return fp;
+}
+
+/// @brief Determines whether any directory between the search directory \p sd
+/// and the path \p fp within it is pruned, in which case a search would not
+/// reach the path.
+/// @param mach The diff engine state context
+/// @param sd The search directory path
+/// @param fp The path within \p sd
+/// @return true if an ancestor directory of \p fp is pruned, otherwise false
+static bool prunedparent(struct deng_state_s* mach, const char* sd,
+                         const char* fp) {
+  const size_t sdlen = strlen(sd);
+  if (mach->opts->prune == NULL || fp[sdlen] == '\0') return false;
+  char* dir;
+  if ((dir = strdup(fp)) == NULL) return false;
+  bool pruned = false;
+  for (char* p = strchr(dir + sdlen + 1, '/'); p != NULL && !pruned;
+       p = strchr(p + 1, '/')) {
+    *p = '\0';
+    pruned = prunedir(mach, dir);
+    *p = '/';
+  }
+  free(dir);
+  return pruned;
+}
+
+/// @brief Diffs each reconciled file against the previous index state and
+/// triggers its new (NEW), modified (MOD) or deleted (DEL) event, once per
+/// filepath. Files which are unchanged relative to the previous index state,
+/// e.g. created and removed again, trigger no event.
+/// @param mach The diff engine state context
+static void firesynced(struct deng_state_s* mach) {
+  if (mach->synclen == 0) return;
+  qsort(mach->synced, mach->synclen, sizeof(*mach->synced), inodefpcmp);
+  for (long i = 0; i < mach->synclen; i++) {
+    const char* fp = mach->synced[i]->fp;
+    if (i > 0 && strcmp(mach->synced[i - 1]->fp, fp) == 0) continue;
+
+    struct inode_s* curr = indexfind(mach->thismap, fp);
+    if (curr != NULL && (curr->flags & INODE_DIR)) curr = NULL;
+    struct inode_s* prev = indexfind(mach->lastmap, fp);
+    if (prev != NULL && (prev->flags & INODE_DIR)) prev = NULL;
+    if (curr != NULL && prev == NULL) {
+      invokehook(mach, new, curr);
+    } else if (curr != NULL && filemodified(mach, curr, prev)) {
+      invokehook(mach, mod, curr);
+    } else if (curr == NULL && prev != NULL) {
+      invokehook(mach, del, prev);
+    }
+  }
+}
+
+/// @brief Sorts the directory nodes collected while reconciling the changed
+/// paths for `execpostdirs`, and drops duplicates and nodes which are no longer
+/// indexed, e.g. of a directory removed by a later changed path.
+/// @param mach The diff engine state context
+static void syncdirs(struct deng_state_s* mach) {
+  if (mach->ndirs == 0) return;
+  qsort(mach->dirs, mach->ndirs, sizeof(*mach->dirs), inodefpcmp);
+  long n = 0;
+  for (long i = 0; i < mach->ndirs; i++) {
+    struct inode_s* node = mach->dirs[i];
+    if (n > 0 && mach->dirs[n - 1] == node) continue;
+    if (indexfind(mach->thismap, node->fp) != node) continue;
+    mach->dirs[n++] = node;
+  }
+  mach->ndirs = n;
+}
+
+int dengchanges(const char* sd, FILE* s, deng_match_t filter,
+                const struct deng_hooks_s* hooks, const struct index_s* old,
+                struct index_s* new, const struct deng_opts_s* opts) {
+  assert(sd != NULL);
+  assert(s != NULL);
+  assert(hooks != NULL);
+  assert(old != NULL);
+  assert(new != NULL);
+  assert(opts != NULL);
+
+  struct deng_state_s mach = {
+          .ffn = filter,
+          .hooks = hooks,
+          .lastmap = old,
+          .thismap = new,
+          .opts = opts,
+          .started = (uint64_t) time(NULL) * 1000,
+          .defer = true,
+          .stats = opts->stats,
+          .listdirs = true,
+  };
+
+  // unchanged nodes are carried over from the previous index state as is
+  if (indexcopyref(new, old)) return -1;
+
+  char* line = NULL;  /* changed path line buffer */
+  size_t linecap = 0; /* allocated capacity of `line` */
+  char* buf = NULL;   /* joined filepath buffer */
+  ssize_t len;
+  int err = 0;
+  while (!err && (len = getline(&line, &linecap, s)) >= 0) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+      line[--len] = '\0';
+    while (len > 1 && line[len - 1] == '/') line[--len] = '\0';
+    if (len == 0) continue;
+    const char* fp;
+    if ((fp = changepath(sd, line, &buf)) == NULL) continue;
+    if (prunedparent(&mach, sd, fp)) continue;
+    if ((err = syncpath(&mach, fp)))
+      log_error("error processing `%s`: %d", fp, errno);
+  }
+  if (!err && ferror(s)) err = -1;
+  free(line);
+  free(buf);
+
+  if (!err) {
+    firesynced(&mach);
+    notifyhook(&mach, DENG_NOTIF_STAGE_DONE);
+  }
+
+  // files created by the commands are found by listing the reconciled
+  // directories and parents again, as by the post stage of a search
+  if (!err) {
+    syncdirs(&mach);
+    mach.stats = NULL;
+    mach.defer = false;
+    mach.post = true;
+    err = execpostdirs(&mach);
+  }
+  free(mach.synced);
+  free(mach.dirs);
+  return err;
+}
@@ -1,62 +1,377 @@
 /// @file fs.c
 /// @brief Filesystem walk and stat implementation.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE// statx(2)
+#endif
+
 #include "fs.h"
 
 #include <assert.h>
-#include <glob.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "log.h"
+#include "uring.h"
 
-/// @brief Error callback implementation for glob search. Logs each error using
-/// the \p log_error macro.
-/// @param epath The path that caused the error.
-/// @param errno The error number.
-/// @return Always returns 0 to continue the glob scan.
-static int fswalkerr(const char* epath, const int errno) {
-  log_error("error accessing `%s`: %d", epath, errno);
-  return 0; /* continue glob scan */
-}
+/// @def FSDIGESTBUF
+/// @brief The block size `fsdigest` reads files in, a multiple of the 32 byte
+/// stripe size of XXH64.
+#define FSDIGESTBUF (64 * 1024)
 
-int fswalk(const char* dir, fswalkfn_t filefn, fswalkfn_t dirfn, void* udata) {
-  char pattern[256]; /* glob pattern format buffer */
-  glob_t gres = {0}; /* glob search results */
-  int ret;           /* glob return value */
+/// @def FSWALKFDDEPTH
+/// @brief The maximum nesting depth of buffered `fswalk` calls which keep
+/// their directory open during the callbacks, bounding the open descriptors.
+#define FSWALKFDDEPTH 64
 
-  // ensure pattern has capacity for dir + wildcard suffix
-  assert(strlen(dir) < sizeof(pattern));
-  snprintf(pattern, sizeof(pattern), "%s/*", dir);
+/// @struct fsent_s
+/// @brief Directory entry collected by a buffered (sorted or batched stat)
+/// directory walk.
+struct fsent_s {
+  union {
+    size_t off;       ///< Entry name offset in the walk's name buffer
+    const char* name; ///< Entry name, once the name buffer is complete
+  };
+  bool dir;           ///< Entry is a directory
+  bool typed;         ///< Entry type was provided by the directory entry
+  bool ok;            ///< Entry was classified and stat'ed successfully
+  struct fsstat_s st; ///< Entry stat info, if requested
+};
 
-  if ((ret = glob(pattern, GLOB_MARK | GLOB_TILDE, fswalkerr, &gres))) {
-    globfree(&gres);
-    if (ret == GLOB_NOMATCH) return 0;
-    return -1;
-  }
+/// @struct fswalk_s
+/// @brief Directory walk state. Entry filepaths are built in a single reusable
+/// path buffer, prefixed by the walked directory path.
+struct fswalk_s {
+  char* fp;             ///< Filepath buffer
+  size_t fpcap;         ///< Allocated capacity of `fp`
+  size_t dirlen;        ///< Length of the directory prefix in `fp`
+  int dfd;              ///< Walked directory descriptor, or -1 once closed
+  int depth;            ///< Number of enclosing walks
+  struct fswalk_s* up;  ///< Enclosing walk on this thread, or NULL
+  char* names;          ///< Buffered mode entry name buffer
+  size_t namelen;       ///< Used length of `names`
+  size_t namecap;       ///< Allocated capacity of `names`
+  struct fsent_s* ents; ///< Buffered mode entries
+  size_t len;           ///< Number of entries in `ents`
+  size_t cap;           ///< Allocated capacity of `ents`
+};
+
+/// @brief Innermost walk of this thread whose callbacks are being invoked.
+static _Thread_local struct fswalk_s* fswalktop;
 
+/// @brief Opens the directory \p dir of a walk. A walk started by a callback
+/// of an enclosing walk on the same thread, e.g. a recursive walk of the
+/// directory passed to \p dirfn, opens its directory relative to the still
+/// open enclosing directory so only the last path component is resolved.
+/// @param dir The directory path
+/// @return The directory stream, or NULL and `errno` is set.
+static DIR* fswalkopen(const char* dir) {
+  const struct fswalk_s* up = fswalktop;
+  if (up == NULL || up->dfd < 0 || strncmp(dir, up->fp, up->dirlen) != 0)
+    return opendir(dir);
+  const char* name = dir + up->dirlen;
+  if (*name == '\0' || strchr(name, '/') != NULL) return opendir(dir);
+  int fd;
+  if ((fd = openat(up->dfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+    return NULL;
+  DIR* d;
+  if ((d = fdopendir(fd)) == NULL) close(fd);
+  return d;
+}
+
+/// @brief Populates \p s for the file \p fp, relative to the directory file
+/// descriptor \p dfd. Only the modification time, size and change tag fields
+/// (and the file type if \p dir is not NULL) are requested where `statx(2)` is
+/// supported.
+/// @param dfd The directory file descriptor, or `AT_FDCWD`
+/// @param fp The filepath, relative to \p dfd unless absolute
+/// @param flags `AT_SYMLINK_NOFOLLOW` if \p fp is known not to be a symbolic
+/// link, otherwise 0 to follow symbolic links
+/// @param s The `struct fsstat_s` to populate
+/// @param dir If not NULL, set to true if the file is a directory
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int fsstatat(const int dfd, const char* fp, const int flags,
+                    struct fsstat_s* s, bool* dir) {
+#ifdef STATX_MTIME
+  struct statx stx;
+  const unsigned int mask = STATX_MTIME | STATX_SIZE | STATX_INO |
+                            STATX_CTIME | (dir != NULL ? STATX_TYPE : 0);
+  if (statx(dfd, fp, flags | AT_STATX_SYNC_AS_STAT, mask, &stx) == 0) {
+    s->lmod = stx.stx_mtime.tv_sec * 1000 + stx.stx_mtime.tv_nsec / 1000000;
+    s->fsze = stx.stx_size;
+    s->ctag = fschangetag(stx.stx_ino, stx.stx_ctime.tv_sec,
+                          stx.stx_ctime.tv_nsec);
+    if (dir != NULL) *dir = S_ISDIR(stx.stx_mode);
+    return 0;
+  }
+  if (errno != ENOSYS) return -1;
+#endif
+  struct stat st = {0};
+  if (fstatat(dfd, fp, &st, flags)) return -1;
 #if defined(__FreeBSD__) || defined(__APPLE__)
-  const int mc = gres.gl_matchc;
+  const struct timespec ts = st.st_mtimespec; /* last modified */
+  const struct timespec cs = st.st_ctimespec; /* status changed */
 #else
-  const int mc = gres.gl_pathc;
+  const struct timespec ts = st.st_mtim; /* last modified */
+  const struct timespec cs = st.st_ctim; /* status changed */
 #endif
+  s->lmod = ts.tv_sec * 1000 + ts.tv_nsec / 1000000; /* convert to millis */
+  s->fsze = st.st_size;                              /* copy file size */
+  s->ctag = fschangetag(st.st_ino, cs.tv_sec, cs.tv_nsec);
+  if (dir != NULL) *dir = S_ISDIR(st.st_mode);
+  return 0;
+}
+
+/// @brief Sets the filepath buffer to the walked directory path joined with
+/// the entry \p name, growing the buffer as required.
+/// @param w The walk state
+/// @param name The entry name
+/// @return The filepath, or NULL if an allocation error occurred.
+static const char* fswalkpath(struct fswalk_s* w, const char* name) {
+  const size_t len = strlen(name) + 1;
+  if (w->dirlen + len > w->fpcap) {
+    const size_t cap = (w->dirlen + len) * 2;
+    char* fp;
+    if ((fp = realloc(w->fp, cap)) == NULL) return NULL;
+    w->fp = fp, w->fpcap = cap;
+  }
+  memcpy(w->fp + w->dirlen, name, len);
+  return w->fp;
+}
+
+/// @brief Classifies the directory entry \p de, and stat's it relative to the
+/// open directory \p dfd if \p st is not NULL. The entry type is used if
+/// provided by the file system, otherwise it is taken from the stat info.
+/// Symbolic links are followed.
+/// @param dfd The file descriptor of the walked directory
+/// @param de The directory entry
+/// @param dir Set to true if the entry is a directory
+/// @param st If not NULL, populated with the stat info of the entry
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int fswalkent(const int dfd, const struct dirent* de, bool* dir,
+                     struct fsstat_s* st) {
+#ifdef DT_DIR
+  if (de->d_type != DT_UNKNOWN && de->d_type != DT_LNK) {
+    *dir = de->d_type == DT_DIR;
+    return st != NULL
+                   ? fsstatat(dfd, de->d_name, AT_SYMLINK_NOFOLLOW, st, NULL)
+                   : 0;
+  }
+#endif
+  struct fsstat_s tmp;
+  return fsstatat(dfd, de->d_name, 0, st != NULL ? st : &tmp, dir);
+}
+
+/// @brief Appends an entry to the buffered mode entry list.
+/// @param w The walk state
+/// @param name The entry name
+/// @param dir True if the entry is a directory
+/// @param st The entry stat info, or NULL if the entry is not stat'ed yet
+/// @return The appended entry, or NULL and `errno` is set.
+static struct fsent_s* fswalkadd(struct fswalk_s* w, const char* name,
+                                 const bool dir, const struct fsstat_s* st) {
+  const size_t len = strlen(name) + 1;
+  if (w->namelen + len > w->namecap) {
+    const size_t cap = (w->namelen + len) * 2;
+    char* names;
+    if ((names = realloc(w->names, cap)) == NULL) return NULL;
+    w->names = names, w->namecap = cap;
+  }
+  if (w->len == w->cap) {
+    const size_t cap = w->cap > 0 ? w->cap * 2 : 64;
+    struct fsent_s* ents;
+    if ((ents = realloc(w->ents, cap * sizeof(*ents))) == NULL) return NULL;
+    w->ents = ents, w->cap = cap;
+  }
+  memcpy(w->names + w->namelen, name, len);
+  struct fsent_s* ent = &w->ents[w->len++];
+  ent->off = w->namelen, ent->dir = dir, ent->typed = true;
+  ent->ok = st != NULL;
+  if (st != NULL) ent->st = *st;
+  w->namelen += len;
+  return ent;
+}
+
+/// @brief Stats all buffered entries of a walk which are not stat'ed yet,
+/// relative to the open directory
+/// \p dfd in batches using `uringstat`, falling back to synchronous stat
+/// calls if io_uring is unavailable. Entries which cannot be stat'ed are
+/// logged and skipped.
+/// @param w The walk state, with entry names resolved
+/// @param dfd The file descriptor of the walked directory
+/// @param dir The walked directory path, for logging
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int fswalkstat(struct fswalk_s* w, const int dfd, const char* dir) {
+  struct uringreq_s* reqs;
+  size_t* idxs;
+  if ((reqs = calloc(w->len + 1, sizeof(*reqs))) == NULL) return -1;
+  if ((idxs = calloc(w->len + 1, sizeof(*idxs))) == NULL) {
+    free(reqs);
+    return -1;
+  }
+  size_t n = 0;
+  for (size_t i = 0; i < w->len; i++) {
+    const struct fsent_s* ent = &w->ents[i];
+    if (ent->ok) continue;
+    reqs[n].fp = ent->name;
+    reqs[n].follow = reqs[n].wantdir = !ent->typed;
+    idxs[n++] = i;
+  }
+
+  const bool batched = n > 0 && uringstat(dfd, reqs, n) == 0;
+  for (size_t i = 0; i < n; i++) {
+    struct fsent_s* ent = &w->ents[idxs[i]];
+    struct uringreq_s* req = &reqs[i];
+    if (!batched) {
+      const int flags = req->follow ? 0 : AT_SYMLINK_NOFOLLOW;
+      bool* dp = req->wantdir ? &req->dir : NULL;
+      req->err = fsstatat(dfd, req->fp, flags, &req->st, dp) ? errno : 0;
+    }
+    if (req->err) {
+      log_error("error accessing `%s/%s`: %d", dir, ent->name, req->err);
+      continue;
+    }
+    ent->st = req->st, ent->ok = true;
+    if (req->wantdir) ent->dir = req->dir;
+  }
+  free(reqs);
+  free(idxs);
+  return 0;
+}
+
+/// @brief Compares two directory entries by name, with directory names
+/// compared as if they had a trailing slash.
+/// @param a The first `struct fsent_s` to compare
+/// @param b The second `struct fsent_s` to compare
+/// @return The result of the comparison.
+static int fsentcmp(const void* a, const void* b) {
+  const struct fsent_s* ea = a;
+  const struct fsent_s* eb = b;
+  const unsigned char* pa = (const unsigned char*) ea->name;
+  const unsigned char* pb = (const unsigned char*) eb->name;
+  while (*pa != '\0' && *pa == *pb) pa++, pb++;
+  const int ca = *pa != '\0' ? *pa : (ea->dir ? '/' : 0);
+  const int cb = *pb != '\0' ? *pb : (eb->dir ? '/' : 0);
+  return ca - cb;
+}
+
+/// @brief Invokes the walk callbacks for each collected entry of a buffered
+/// mode walk, in sorted order if the `FSWALK_SORTED` option is set.
+/// @param w The walk state, with entry names resolved
+/// @param filefn The function to call for each file
+/// @param dirfn The function to call for each directory
+/// @param udata User data to pass to \p filefn and \p dirfn
+/// @param flags Walk option bit flags, see `FSWALK_*`
+/// @return 0 if successful, -1 if an allocation error occurred, otherwise the
+/// first non-zero callback return value.
+static int fswalkbuf(struct fswalk_s* w, fswalkfn_t filefn, fswalkfn_t dirfn,
+                     void* udata, const int flags) {
+  if (flags & FSWALK_SORTED)
+    qsort(w->ents, w->len, sizeof(*w->ents), fsentcmp);
 
-  // invoke process function for each result
   int err = 0;
-  for (int i = 0; i < mc; i++) {
-    char* fp = gres.gl_pathv[i];
-    const size_t len = strlen(fp);
-    if (fp[len - 1] == '/') {// if directory, invoke directory function
-      fp[len - 1] = '\0';    // remove the trailing slash generated by GLOB_MARK
-      if ((err = dirfn(fp, udata))) goto doret;
-    } else if ((err = filefn(gres.gl_pathv[i], udata))) {
-      goto doret;
+  for (size_t i = 0; i < w->len && !err; i++) {
+    const struct fsent_s* ent = &w->ents[i];
+    if (!ent->ok) continue;
+    const struct fsstat_s* st = flags & FSWALK_STAT ? &ent->st : NULL;
+    const char* fp;
+    if ((fp = fswalkpath(w, ent->name)) == NULL) return -1;
+    err = ent->dir ? dirfn(fp, st, udata) : filefn(fp, st, udata);
+  }
+  return err;
+}
+
+int fswalk(const char* dir, fswalkfn_t filefn, fswalkfn_t dirfn, void* udata,
+           const int flags) {
+  DIR* d;
+  if ((d = fswalkopen(dir)) == NULL) {
+    // unreadable directories are logged and skipped, not treated as errors
+    log_error("error accessing `%s`: %d", dir, errno);
+    return 0;
+  }
+  const int dfd = dirfd(d);
+
+  struct fswalk_s w = {0};
+  w.dfd = dfd, w.up = fswalktop;
+  w.depth = w.up != NULL ? w.up->depth + 1 : 0;
+  w.dirlen = strlen(dir) + 1;
+  w.fpcap = w.dirlen + 256;
+  if ((w.fp = malloc(w.fpcap)) == NULL) {
+    closedir(d);
+    return -1;
+  }
+  memcpy(w.fp, dir, w.dirlen - 1);
+  w.fp[w.dirlen - 1] = '/';
+
+  // entries are buffered if sorted, or if stat'ed in batches once listed
+  const bool batch = (flags & FSWALK_STAT) && (flags & FSWALK_URING);
+  const bool buffer = batch || (flags & FSWALK_SORTED);
+
+  int err = 0;
+  fswalktop = &w;
+  struct dirent* de;
+  for (errno = 0; (de = readdir(d)) != NULL; errno = 0) {
+    if (de->d_name[0] == '.') continue;// skip hidden files, `.` and `..`
+#ifdef DT_DIR
+    if (batch) {
+      const bool typed = de->d_type != DT_UNKNOWN && de->d_type != DT_LNK;
+      struct fsent_s* ent;
+      if ((ent = fswalkadd(&w, de->d_name, de->d_type == DT_DIR, NULL)) ==
+          NULL) {
+        err = -1;
+        break;
+      }
+      ent->typed = typed;
+      continue;
+    }
+#endif
+    bool isdir;
+    struct fsstat_s st = {0};
+    if (fswalkent(dfd, de, &isdir, flags & FSWALK_STAT ? &st : NULL)) {
+      log_error("error accessing `%s/%s`: %d", dir, de->d_name, errno);
+      continue;
+    }
+    if (buffer) {
+      if (fswalkadd(&w, de->d_name, isdir, &st) == NULL) {
+        err = -1;
+        break;
+      }
+      continue;
     }
+    const struct fsstat_s* stp = flags & FSWALK_STAT ? &st : NULL;
+    if (fswalkpath(&w, de->d_name) == NULL) {
+      err = -1;
+      break;
+    }
+    if ((err = isdir ? dirfn(w.fp, stp, udata) : filefn(w.fp, stp, udata)))
+      break;
+  }
+  if (de == NULL && errno != 0) {
+    log_error("error reading `%s`: %d", dir, errno);
+    err = -1;
+  }
+  if (!err && buffer) {
+    for (size_t i = 0; i < w.len; i++) w.ents[i].name = w.names + w.ents[i].off;
+    if (batch) err = fswalkstat(&w, dfd, dir);
   }
+  if (buffer && w.depth >= FSWALKFDDEPTH) {
+    closedir(d), d = NULL;
+    w.dfd = -1;
+  }
+
+  if (!err && buffer) err = fswalkbuf(&w, filefn, dirfn, udata, flags);
 
-doret:
-  globfree(&gres);
+  fswalktop = w.up;
+  if (d != NULL) closedir(d);
+  free(w.fp);
+  free(w.names);
+  free(w.ents);
   return err;
 }
 
@@ -65,14 +380,150 @@ bool fsstateql(const struct fsstat_s* a, const struct fsstat_s* b) {
 }
 
 int fsstat(const char* fp, struct fsstat_s* s) {
-  struct stat st = {0};
-  if (stat(fp, &st)) return -1;
-#if defined(__FreeBSD__) || defined(__APPLE__)
-  const struct timespec ts = st.st_mtimespec; /* last modified */
-#else
-  const struct timespec ts = st.st_mtim; /* last modified */
+  return fsstatat(AT_FDCWD, fp, 0, s, NULL);
+}
+
+int fsstatdir(const char* fp, struct fsstat_s* s, bool* dir) {
+  return fsstatat(AT_FDCWD, fp, 0, s, dir);
+}
+
+uint64_t fschangetag(const uint64_t ino, const int64_t csec,
+                     const uint32_t cnsec) {
+  uint64_t h = ino * 0x9e3779b97f4a7c15ULL;
+  h ^= (uint64_t) csec * 1000000000ULL + cnsec;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/// @brief The five XXH64 prime constants.
+static const uint64_t fsxxprimes[5] = {
+        0x9e3779b185ebca87ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL,
+        0x85ebca77c2b2ae63ULL, 0x27d4eb2f165667c5ULL};
+
+/// @struct fsxx_s
+/// @brief XXH64 state of a digest whose input is streamed in whole stripes.
+struct fsxx_s {
+  uint64_t acc[4]; ///< Stripe lane accumulators
+  uint64_t len;    ///< Number of bytes processed
+};
+
+/// @brief Rotates \p x left by \p r bits.
+static inline uint64_t fsxxrotl(const uint64_t x, const int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+/// @brief Reads a little endian 64-bit value.
+static inline uint64_t fsxxread64(const unsigned char* p) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+  return v;
+}
+
+/// @brief Reads a little endian 32-bit value.
+static inline uint64_t fsxxread32(const unsigned char* p) {
+  return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 |
+         (uint64_t) p[3] << 24;
+}
+
+/// @brief Mixes an 8 byte lane of input into an accumulator.
+static inline uint64_t fsxxround(uint64_t acc, const uint64_t in) {
+  acc += in * fsxxprimes[1];
+  return fsxxrotl(acc, 31) * fsxxprimes[0];
+}
+
+/// @brief Processes \p n bytes of input, which must be a multiple of the 32
+/// byte stripe size.
+/// @param s The digest state
+/// @param p The input
+/// @param n The number of input bytes
+static void fsxxstripes(struct fsxx_s* s, const unsigned char* p,
+                        const size_t n) {
+  uint64_t a0 = s->acc[0], a1 = s->acc[1], a2 = s->acc[2], a3 = s->acc[3];
+  for (size_t i = 0; i < n; i += 32) {
+    a0 = fsxxround(a0, fsxxread64(p + i));
+    a1 = fsxxround(a1, fsxxread64(p + i + 8));
+    a2 = fsxxround(a2, fsxxread64(p + i + 16));
+    a3 = fsxxround(a3, fsxxread64(p + i + 24));
+  }
+  s->acc[0] = a0, s->acc[1] = a1, s->acc[2] = a2, s->acc[3] = a3;
+  s->len += n;
+}
+
+/// @brief Processes the remaining input, shorter than a stripe, and returns
+/// the digest of all input.
+/// @param s The digest state
+/// @param p The remaining input
+/// @param n The number of remaining input bytes, less than 32
+/// @return The digest.
+static uint64_t fsxxfinal(const struct fsxx_s* s, const unsigned char* p,
+                          size_t n) {
+  uint64_t h;
+  if (s->len > 0) {
+    h = fsxxrotl(s->acc[0], 1) + fsxxrotl(s->acc[1], 7) +
+        fsxxrotl(s->acc[2], 12) + fsxxrotl(s->acc[3], 18);
+    for (int i = 0; i < 4; i++) {
+      h ^= fsxxround(0, s->acc[i]);
+      h = h * fsxxprimes[0] + fsxxprimes[3];
+    }
+  } else {
+    h = fsxxprimes[4];
+  }
+  h += s->len + n;
+  for (; n >= 8; p += 8, n -= 8) {
+    h ^= fsxxround(0, fsxxread64(p));
+    h = fsxxrotl(h, 27) * fsxxprimes[0] + fsxxprimes[3];
+  }
+  if (n >= 4) {
+    h ^= fsxxread32(p) * fsxxprimes[0];
+    h = fsxxrotl(h, 23) * fsxxprimes[1] + fsxxprimes[2];
+    p += 4, n -= 4;
+  }
+  for (; n > 0; p++, n--) {
+    h ^= *p * fsxxprimes[4];
+    h = fsxxrotl(h, 11) * fsxxprimes[0];
+  }
+  h ^= h >> 33;
+  h *= fsxxprimes[1];
+  h ^= h >> 29;
+  h *= fsxxprimes[2];
+  h ^= h >> 32;
+  return h;
+}
+
+int fsdigest(const char* fp, uint64_t* digest) {
+  int fd;
+  if ((fd = open(fp, O_RDONLY | O_CLOEXEC)) < 0) return -1;
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 #endif
-  s->lmod = ts.tv_sec * 1000 + ts.tv_nsec / 1000000; /* convert to millis */
-  s->fsze = st.st_size;                              /* copy file size */
+
+  // blocks are filled completely, so only the last block may end mid-stripe
+  unsigned char buf[FSDIGESTBUF];
+  struct fsxx_s s = {{fsxxprimes[0] + fsxxprimes[1], fsxxprimes[1], 0,
+                      -fsxxprimes[0]},
+                     0};
+  size_t n = 0; /* bytes in `buf` */
+  for (;;) {
+    const ssize_t r = read(fd, buf + n, sizeof(buf) - n);
+    if (r < 0 && errno == EINTR) continue;
+    if (r < 0) {
+      const int err = errno;
+      close(fd);
+      errno = err;
+      return -1;
+    }
+    n += r;
+    if (r > 0 && n < sizeof(buf)) continue;
+    const size_t whole = n & ~(size_t) 31;
+    fsxxstripes(&s, buf, whole);
+    if (r == 0) {
+      *digest = fsxxfinal(&s, buf + whole, n - whole);
+      break;
+    }
+    n = 0;
+  }
+  close(fd);
   return 0;
 }
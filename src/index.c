@@ -4,32 +4,219 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
 #include "log.h"
 
-/// @def INDEXMAXFP
-/// @brief The maximum filepath length of a file in the index.
-#define INDEXMAXFP 512
+/// @def INDEXMAGIC
+/// @brief The magic value which prefixes the binary index format. It starts
+/// with a NUL byte, which never occurs in the text index format.
+#define INDEXMAGIC "\0FSA"
 
-/// @brief Hashes the filepath string into an index bucket.
+/// @def INDEXVERSION
+/// @brief The current version of the binary index format. Files of any other
+/// version are rejected.
+#define INDEXVERSION 1
+
+/// @def INDEXMASKHASH
+/// @brief The prefix of the text index format line which records the
+/// `maskhash` of the index. The line contains no commas, so it is never
+/// mistaken for a record.
+#define INDEXMASKHASH "#maskhash "
+
+/// @struct indexhdr_s
+/// @brief Binary index format header. The header is followed by `count`
+/// fixed-width records sorted by filepath, and then by a string table of null
+/// terminated filepaths which begins at byte offset `stroff`. All fields are
+/// stored in native byte order.
+struct indexhdr_s {
+  char magic[4];     ///< Format magic value, see `INDEXMAGIC`
+  uint32_t version;  ///< Format version, see `INDEXVERSION`
+  uint64_t count;    ///< Number of records
+  uint64_t stroff;   ///< Byte offset of the string table from the file start
+  uint64_t maskhash; ///< Hash the record masks were computed with
+};
+
+/// @struct indexrec_s
+/// @brief Binary index format record.
+struct indexrec_s {
+  uint64_t fpoff;  ///< Byte offset of the filepath in the string table
+  uint64_t lmod;   ///< Last modified time in milliseconds since epoch
+  uint64_t fsze;   ///< File size in bytes
+  uint64_t ctag;   ///< Change tag, see `fschangetag()`
+  uint32_t flags;  ///< Node bit flags, see `INODE_*`
+  uint32_t age;    ///< Directory nodes only, consecutive runs skipped
+  uint64_t mask;   ///< File nodes only, match mask if `INODE_MASK` is set
+  uint64_t digest; ///< File nodes only, digest if `INODE_DIGEST` is set
+};
+
+/// @def INDEXRECINPLACE
+/// @brief Whether binary index records can be reinterpreted in place as
+/// `struct inode_s` values, i.e. the filepath offset and pointer fields share
+/// the same size and the stat fields share the same layout.
+#define INDEXRECINPLACE                                                        \
+  (sizeof(struct inode_s) == sizeof(struct indexrec_s) &&                      \
+   offsetof(struct inode_s, st) == offsetof(struct indexrec_s, lmod) &&        \
+   offsetof(struct inode_s, flags) == offsetof(struct indexrec_s, flags) &&    \
+   offsetof(struct inode_s, age) == offsetof(struct indexrec_s, age) &&        \
+   offsetof(struct inode_s, mask) == offsetof(struct indexrec_s, mask) &&      \
+   offsetof(struct inode_s, digest) == offsetof(struct indexrec_s, digest) &&  \
+   _Alignof(struct inode_s) <= _Alignof(struct indexrec_s))
+
+/// @def INDEXMINCAP
+/// @brief The initial slot capacity of an index map, must be a power of two.
+#define INDEXMINCAP 64
+
+/// @brief Hashes the filepath string using 64-bit FNV-1a, followed by a final
+/// avalanche mix so the low bits used for slot selection are well distributed.
 /// @param fp The filepath string to hash
-/// @return The index bucket number.
-static int indexhash(const char* fp) {
-  int h = 0;
-  for (const char* p = fp; *p != '\0'; p++) h = (h << 5) - h + *p;
-  if (h < 0) h = -h;
-  return h % INDEXBUCKETS;
+/// @return The 64-bit hash value.
+static uint64_t indexhash(const char* fp) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (const char* p = fp; *p != '\0'; p++) {
+    h ^= (unsigned char) *p;
+    h *= 0x100000001b3ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
 }
 
 struct inode_s* indexfind(const struct index_s* idx, const char* fp) {
-  struct inode_s* head = idx->buckets[indexhash(fp)];
-  while (head != NULL) {
-    if (strcmp(head->fp, fp) == 0) return head;
-    head = head->next;
+  if (idx->size == 0) return NULL;
+  const uint64_t h = indexhash(fp);
+  const uint64_t mask = (uint64_t) idx->cap - 1;
+  for (uint64_t i = h & mask;; i = (i + 1) & mask) {
+    const struct islot_s* slot = &idx->slots[i];
+    if (slot->node == NULL) return NULL;
+    if (slot->hash == h && strcmp(slot->node->fp, fp) == 0) return slot->node;
+  }
+}
+
+/// @brief Resizes the slot array of the index to \p cap slots and re-inserts
+/// all existing nodes using their cached hash values.
+/// @param idx The index to resize
+/// @param cap The new slot capacity, must be a power of two and greater than
+/// the number of nodes in the index
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int indexgrow(struct index_s* idx, const long cap) {
+  struct islot_s* slots;
+  if ((slots = calloc(cap, sizeof(*slots))) == NULL) return -1;
+  const uint64_t mask = (uint64_t) cap - 1;
+  for (long i = 0; i < idx->cap; i++) {
+    const struct islot_s* old = &idx->slots[i];
+    if (old->node == NULL) continue;
+    uint64_t j = old->hash & mask;
+    while (slots[j].node != NULL) j = (j + 1) & mask;
+    slots[j] = *old;
+  }
+  free(idx->slots);
+  idx->slots = slots;
+  idx->cap = cap;
+  return 0;
+}
+
+/// @brief Inserts an existing node into the slot array of the index, growing
+/// the slot array as necessary. The node is referenced and not copied.
+/// @param idx The index to insert into
+/// @param node The node to insert, must outlive the index
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int indexinsert(struct index_s* idx, struct inode_s* node) {
+  // keep the load factor at or below 3/4 to bound linear probe lengths
+  if ((idx->size + 1) * 4 > idx->cap * 3)
+    if (indexgrow(idx, idx->cap > 0 ? idx->cap * 2 : INDEXMINCAP)) return -1;
+
+  // nodes inserted after the sorted view was built are tracked separately
+  if (idx->view != NULL && idx->nadds == idx->capadds) {
+    const long cap = idx->capadds > 0 ? idx->capadds * 2 : 64;
+    struct inode_s** adds;
+    if ((adds = realloc(idx->adds, cap * sizeof(*adds))) == NULL) return -1;
+    idx->adds = adds, idx->capadds = cap;
+  }
+  if (idx->view != NULL) idx->adds[idx->nadds++] = node;
+
+  const uint64_t h = indexhash(node->fp);
+  const uint64_t mask = (uint64_t) idx->cap - 1;
+  uint64_t i = h & mask;
+  while (idx->slots[i].node != NULL) i = (i + 1) & mask;
+  idx->slots[i] = (struct islot_s){h, node};
+  idx->size++;
+  if (node->flags & INODE_DIR) idx->dirs++;
+  return 0;
+}
+
+struct inode_s* indexputref(struct index_s* idx, const struct inode_s node) {
+  struct inode_s* head;
+  const size_t align = _Alignof(struct inode_s);
+  if ((head = arenaalloc(&idx->nodes, sizeof(node), align)) == NULL)
+    return NULL;
+  memcpy(head, &node, sizeof(node));
+  if (indexinsert(idx, head)) return NULL;
+  return head;
+}
+
+struct inode_s* indexput(struct index_s* idx, struct inode_s node) {
+  if ((node.fp = arenastrdup(&idx->strs, node.fp)) == NULL) return NULL;
+  return indexputref(idx, node);
+}
+
+void indexsetstat(struct inode_s* node, const struct fsstat_s* st) {
+  if (!fsstateql(&node->st, st) || node->st.ctag != st->ctag)
+    node->flags &= ~INODE_DIGEST;
+  node->st = *st;
+}
+
+struct inode_s* indexdel(struct index_s* idx, const char* fp) {
+  if (idx->size == 0) return NULL;
+  const uint64_t h = indexhash(fp);
+  const uint64_t mask = (uint64_t) idx->cap - 1;
+  uint64_t i = h & mask;
+  for (;; i = (i + 1) & mask) {
+    const struct islot_s* slot = &idx->slots[i];
+    if (slot->node == NULL) return NULL;
+    if (slot->hash == h && strcmp(slot->node->fp, fp) == 0) break;
+  }
+  struct inode_s* node = idx->slots[i].node;
+
+  // backward shift the following slots of the probe run into the hole, unless
+  // a slot's home position lies cyclically within (hole, slot] and it would
+  // become unreachable from its home position
+  for (uint64_t j = (i + 1) & mask; idx->slots[j].node != NULL;
+       j = (j + 1) & mask) {
+    const uint64_t k = idx->slots[j].hash & mask;
+    const bool reachable = i <= j ? (k > i && k <= j) : (k > i || k <= j);
+    if (reachable) continue;
+    idx->slots[i] = idx->slots[j];
+    i = j;
   }
-  return NULL;
+  idx->slots[i] = (struct islot_s){0, NULL};
+  idx->size--;
+  if (node->flags & INODE_DIR) idx->dirs--;
+  if (idx->view != NULL) idx->stale++;
+  return node;
+}
+
+int indexcopy(struct index_s* dst, const struct index_s* src) {
+  for (long i = 0; i < src->cap; i++) {
+    const struct inode_s* node = src->slots[i].node;
+    if (node != NULL && indexput(dst, *node) == NULL) return -1;
+  }
+  return 0;
+}
+
+int indexcopyref(struct index_s* dst, const struct index_s* src) {
+  for (long i = 0; i < src->cap; i++) {
+    const struct inode_s* node = src->slots[i].node;
+    if (node != NULL && indexputref(dst, *node) == NULL) return -1;
+  }
+  return 0;
 }
 
 /// @brief Compares two file nodes for sorting in ascending order by filepath.
@@ -43,77 +230,310 @@ static int indexnodecmp(const void* a, const void* b) {
   return strcmp(na->fp, nb->fp);
 }
 
-int indexwrite(struct index_s* idx, FILE* s) {
+struct inode_s** indexsorted(const struct index_s* idx) {
   struct inode_s** fl;
-  if ((fl = indexlist(idx)) == NULL) return -1;
+  if ((fl = indexlist(idx)) == NULL) return NULL;
   qsort(fl, idx->size, sizeof(struct inode_s*), indexnodecmp);
+  return fl;
+}
+
+/// @brief Compares a filepath to the subtree prefix of directory \p dir, i.e.
+/// \p dir followed by a slash.
+/// @param fp The filepath to compare
+/// @param dir The directory path
+/// @param len The length of \p dir
+/// @return 0 if \p fp is within the subtree, otherwise the sign of the
+/// `strcmp(3)` comparison of \p fp to the subtree prefix.
+static int indexsubcmp(const char* fp, const char* dir, const size_t len) {
+  const int cmp = strncmp(fp, dir, len);
+  return cmp != 0 ? cmp : (unsigned char) fp[len] - '/';
+}
+
+struct inode_s** indexsubtree(struct index_s* idx, const char* dir, long* n) {
+  *n = 0;
+  if (idx->view == NULL || (idx->nadds + idx->stale) * 8 > idx->viewlen) {
+    struct inode_s** view;
+    if ((view = indexsorted(idx)) == NULL) return NULL;
+    free(idx->view);
+    idx->view = view, idx->viewlen = idx->size;
+    idx->nadds = idx->stale = 0;
+  }
 
-  char lbuf[INDEXMAXFP]; /* line output format buffer */
+  const size_t len = strlen(dir);
+  long lo = 0, hi = idx->viewlen;
+  while (lo < hi) {
+    const long mid = lo + (hi - lo) / 2;
+    if (indexsubcmp(idx->view[mid]->fp, dir, len) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  for (hi = lo; hi < idx->viewlen; hi++)
+    if (indexsubcmp(idx->view[hi]->fp, dir, len) != 0) break;
+
+  // removed nodes are still listed by the view, and are skipped
+  struct inode_s** fl;
+  if ((fl = calloc(hi - lo + idx->nadds + 1, sizeof(*fl))) == NULL)
+    return NULL;
+  long nfl = 0;
+  for (long i = lo; i < hi; i++)
+    if (indexfind(idx, idx->view[i]->fp) == idx->view[i])
+      fl[nfl++] = idx->view[i];
+  const long nview = nfl;
+  for (long i = 0; i < idx->nadds; i++)
+    if (indexsubcmp(idx->adds[i]->fp, dir, len) == 0 &&
+        indexfind(idx, idx->adds[i]->fp) == idx->adds[i])
+      fl[nfl++] = idx->adds[i];
+  if (nfl > nview) qsort(fl, nfl, sizeof(*fl), indexnodecmp);
+  *n = nfl;
+  return fl;
+}
+
+/// @brief Writes a file node as a record of the text index format, see
+/// `indexreadtext()`.
+/// @param node The file node to write
+/// @param s The file stream to write to
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int indexwritefile(const struct inode_s* node, FILE* s) {
+  char mask[24] = "";   /* `:mask`, the mask may be empty */
+  char digest[40] = ""; /* `:ctag:digest` */
+  if (node->flags & INODE_MASK) {
+    snprintf(mask, sizeof(mask), ":%" PRIx64, node->mask);
+  } else if (node->flags & INODE_DIGEST) {
+    strcpy(mask, ":");
+  }
+  if (node->flags & INODE_DIGEST)
+    snprintf(digest, sizeof(digest), ":%" PRIx64 ":%016" PRIx64,
+             node->st.ctag, node->digest);
+  if (fprintf(s, "%s,%" PRIu64 ",%" PRIu64 "%s%s\n", node->fp, node->st.lmod,
+              node->st.fsze, mask, digest) < 0)
+    return -1;
+  return 0;
+}
+
+int indexwrite(struct index_s* idx, FILE* s) {
+  struct inode_s** fl;
+  if ((fl = indexsorted(idx)) == NULL) return -1;
 
   int err = 0;
-  for (long i = 0; i < idx->size; i++) {
-    struct inode_s* node = fl[i];
-    const int n = snprintf(lbuf, sizeof(lbuf), "%s,%" PRIu64 ",%" PRIu64 "\n",
-                           node->fp, node->st.lmod, node->st.fsze);
-    if (fwrite(lbuf, n, 1, s) != 1) {
+  if (idx->maskhash != 0 &&
+      fprintf(s, INDEXMASKHASH "%016" PRIx64 "\n", idx->maskhash) < 0)
+    err = -1;
+  for (long i = 0; i < idx->size && !err; i++) {
+    const struct inode_s* node = fl[i];
+    if (node->flags & INODE_DIR) {
+      if (fprintf(s, "%s/,%" PRIu64 ",%" PRIu64 ":%" PRIu32 "\n", node->fp,
+                  node->st.lmod, node->st.fsze, node->age) < 0)
+        err = -1;
+    } else if (indexwritefile(node, s)) {
       err = -1;
-      break;
     }
   }
   free(fl);
   return err;
 }
 
-int indexread(struct index_s* idx, FILE* s) {
-  char fp[INDEXMAXFP] = {0};          /* fscanf filepath string buffer */
-  struct inode_s b = {fp, {0}, NULL}; /* fscanf node buffer */
+int indexwritebin(struct index_s* idx, FILE* s) {
+  struct inode_s** fl;
+  if ((fl = indexsorted(idx)) == NULL) return -1;
 
-  while (fscanf(s, "%[^,],%" PRIu64 ",%" PRIu64 "\n", b.fp, &b.st.lmod,
-                &b.st.fsze) == 3) {
-    // duplicate the string onto the heap
-    if ((b.fp = strdup(b.fp)) == NULL) return -1;
-    if (indexput(idx, b) == NULL) return -1;
-    b.fp = fp;
-  }
+  // string table begins directly after the header and record array
+  struct indexhdr_s hdr = {INDEXMAGIC, INDEXVERSION, (uint64_t) idx->size, 0,
+                           idx->maskhash};
+  hdr.stroff = sizeof(hdr) + idx->size * sizeof(struct indexrec_s);
 
-  return 0;
+  int err = -1;
+  if (fwrite(&hdr, sizeof(hdr), 1, s) != 1) goto ret;
+  uint64_t fpoff = 0; /* offset of the next string in the string table */
+  for (long i = 0; i < idx->size; i++) {
+    const struct inode_s* node = fl[i];
+    const struct indexrec_s rec = {fpoff,         node->st.lmod, node->st.fsze,
+                                   node->st.ctag, node->flags,   node->age,
+                                   node->mask,    node->digest};
+    if (fwrite(&rec, sizeof(rec), 1, s) != 1) goto ret;
+    fpoff += strlen(node->fp) + 1;
+  }
+  for (long i = 0; i < idx->size; i++) {
+    const char* fp = fl[i]->fp;
+    if (fwrite(fp, strlen(fp) + 1, 1, s) != 1) goto ret;
+  }
+  err = 0;
+ret:
+  free(fl);
+  return err;
 }
 
-/// @brief Prepends a new node to the linked list by overwriting the head.
-/// @param idx The head of the linked list
-/// @param tail The new node to prepend
-/// @return The new head of the linked list or NULL if memory allocation fails.
-static struct inode_s* indexprepend(struct inode_s* idx,
-                                    const struct inode_s tail) {
-  struct inode_s* node;
-  if ((node = malloc(sizeof(tail))) == NULL) return NULL;
-  memcpy(node, &tail, sizeof(tail));
-  node->next = idx;
-  return node;
-}
+/// @brief Reads the text index format, one `filepath,lmod,fsze` record per
+/// line. Fields are split at the last two commas so filepaths may contain
+/// commas. Directory records are written as `dirpath/,lmod,children:age`, a
+/// trailing slash is never present in a file record. File records with a
+/// mask are written as `filepath,lmod,fsze:mask`, with the mask in hex, and
+/// are preceded by an `INDEXMASKHASH` line. File records with a digest are
+/// written as `filepath,lmod,fsze:mask:ctag:digest`, with an empty mask if
+/// the record has none, and the change tag and digest in hex. Malformed lines
+/// are logged and skipped.
+/// @param idx The index to populate
+/// @param s The file stream to read from
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int indexreadtext(struct index_s* idx, FILE* s) {
+  char* line = NULL; /* getline buffer */
+  size_t cap = 0;    /* getline buffer capacity */
+  ssize_t len;       /* length of the current line */
+  int err = 0;
 
-struct inode_s* indexput(struct index_s* idx, const struct inode_s node) {
-  struct inode_s* bucket = idx->buckets[indexhash(node.fp)];
-  struct inode_s* head = indexprepend(bucket, node);
-  if (head == NULL) return NULL;
-  idx->buckets[indexhash(node.fp)] = head;
-  idx->size++;
-  return head;
+  // masks are only kept if computed as the index's masks, see `INDEXMASKHASH`
+  bool masks = idx->maskhash == 0;
+
+  errno = 0;
+  while ((len = getline(&line, &cap, s)) > 0) {
+    if (line[len - 1] == '\n') line[--len] = '\0';
+    if (len == 0) continue;
+    if (strncmp(line, INDEXMASKHASH, sizeof(INDEXMASKHASH) - 1) == 0 &&
+        strchr(line, ',') == NULL) {
+      const char* hash = line + sizeof(INDEXMASKHASH) - 1;
+      masks = strtoull(hash, NULL, 16) == idx->maskhash;
+      continue;
+    }
+
+    char* fsze = strrchr(line, ',');
+    char* lmod = NULL;
+    if (fsze != NULL) *fsze++ = '\0', lmod = strrchr(line, ',');
+    if (lmod == NULL) {
+      log_error("skipping malformed index record `%s`", line);
+      continue;
+    }
+    *lmod++ = '\0';
+
+    struct inode_s b = {line, {0}, 0, 0, 0, 0};
+    b.st.lmod = strtoull(lmod, NULL, 10);
+    b.st.fsze = strtoull(fsze, &fsze, 10);
+    const size_t fplen = lmod - 1 - line;
+    if (fplen > 1 && line[fplen - 1] == '/') {
+      line[fplen - 1] = '\0';// strip the directory marker
+      b.flags = INODE_DIR;
+      if (*fsze == ':') b.age = (uint32_t) strtoul(fsze + 1, NULL, 10);
+    } else if (*fsze == ':') {
+      char* p = fsze + 1;
+      const uint64_t mask = strtoull(p, &p, 16);
+      if (p != fsze + 1 && masks) b.mask = mask, b.flags = INODE_MASK;
+      if (*p == ':') b.st.ctag = strtoull(p + 1, &p, 16);
+      if (*p == ':') {
+        b.digest = strtoull(p + 1, NULL, 16);
+        b.flags |= INODE_DIGEST;
+      }
+    }
+    if (indexput(idx, b) == NULL) {
+      err = -1;
+      break;
+    }
+  }
+  if (ferror(s)) err = -1;
+  free(line);
+  return err;
 }
 
-/// @brief Recursively frees a linked list of nodes starting from a given head.
-/// @param idx The head of the linked list
-static void indexfree_r(struct inode_s* idx) {
-  struct inode_s *head, *prev;
-  for (head = idx; head != NULL;) {
-    free(head->fp);
-    prev = head, head = head->next;
-    free(prev); /* free previous node */
+/// @brief Maps the binary index format into memory and inserts its records
+/// directly into the index without copying them. On platforms where the
+/// record layout matches `struct inode_s`, each record's string table offset
+/// is rewritten in place to a filepath pointer into the private mapping.
+/// Otherwise the records are copied into the index's arenas.
+/// @param idx The index to populate
+/// @param s The file stream to map
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int indexreadbin(struct index_s* idx, FILE* s) {
+  struct stat st;
+  if (fstat(fileno(s), &st)) return -1;
+  const size_t sze = (size_t) st.st_size;
+
+  char* map = NULL;
+  if (sze < sizeof(struct indexhdr_s)) goto einval;
+  if ((map = mmap(NULL, sze, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(s),
+                  0)) == MAP_FAILED)
+    return -1;
+
+  // validate the header bounds before trusting any offsets
+  struct indexhdr_s hdr;
+  memcpy(&hdr, map, sizeof(hdr));
+  if (hdr.version != INDEXVERSION) {
+    log_error("unsupported index version %" PRIu32, hdr.version);
+    goto einval;
   }
+  const size_t hdrsze = sizeof(hdr);
+  const size_t recsze = sizeof(struct indexrec_s);
+  const bool inplace = INDEXRECINPLACE;
+  const bool masks = hdr.maskhash == idx->maskhash;
+  const uint64_t count = hdr.count;
+  if (count > (sze - hdrsze) / recsze || hdr.stroff < hdrsze + count * recsze ||
+      hdr.stroff > sze || (count > 0 && map[sze - 1] != '\0'))
+    goto einval;
+  const char* strs = map + hdr.stroff;
+  const uint64_t strsze = sze - hdr.stroff;
+
+  // records are referenced in place, so the index owns the mapping from here
+  if (inplace) idx->map = map, idx->mapsze = sze;
+
+  // reserve all slots up front to avoid incrementally rehashing the records
+  long cap = idx->cap > 0 ? idx->cap : INDEXMINCAP;
+  while ((idx->size + (long) count) * 4 > cap * 3) cap *= 2;
+  if (cap > idx->cap && indexgrow(idx, cap)) goto err;
+
+  char* recs = map + hdrsze;
+  for (uint64_t i = 0; i < count; i++) {
+    struct indexrec_s rec;
+    memcpy(&rec, recs + i * recsze, recsze);
+    if (rec.fpoff >= strsze) goto einval;
+    if (!masks) rec.flags &= ~INODE_MASK;
+    const struct inode_s node = {(char*) strs + rec.fpoff,
+                                 {rec.lmod, rec.fsze, rec.ctag},
+                                 rec.flags,
+                                 rec.age,
+                                 rec.mask,
+                                 rec.digest};
+    if (inplace) {
+      struct inode_s* in = (struct inode_s*) (recs + i * recsze);
+      *in = node;
+      if (indexinsert(idx, in)) goto err;
+    } else if (indexput(idx, node) == NULL) {
+      goto err;
+    }
+  }
+
+  if (!inplace) munmap(map, sze);
+  return 0;
+
+einval:
+  log_error("invalid or corrupt binary index (%zu bytes)", sze);
+  errno = EINVAL;
+err:
+  if (map != NULL && idx->map != map) munmap(map, sze);
+  return -1;
+}
+
+int indexread(struct index_s* idx, FILE* s) {
+  // detect the binary format by its header magic, otherwise fallback to text
+  char magic[sizeof(INDEXMAGIC) - 1];
+  const size_t n = fread(magic, 1, sizeof(magic), s);
+  if (n == sizeof(magic) && memcmp(magic, INDEXMAGIC, sizeof(magic)) == 0)
+    return indexreadbin(idx, s);
+  if (ferror(s) || fseek(s, 0, SEEK_SET)) return -1;
+  return indexreadtext(idx, s);
 }
 
 void indexfree(struct index_s* idx) {
-  for (int i = 0; i < INDEXBUCKETS; i++) indexfree_r(idx->buckets[i]);
+  if (idx->map != NULL) munmap(idx->map, idx->mapsze);
+  idx->map = NULL;
+  idx->mapsze = 0;
+  arenafree(&idx->nodes);
+  arenafree(&idx->strs);
+  free(idx->slots);
+  idx->slots = NULL;
+  idx->cap = idx->size = idx->dirs = 0;
+  idx->maskhash = 0;
+  free(idx->view);
+  free(idx->adds);
+  idx->view = idx->adds = NULL;
+  idx->viewlen = idx->stale = idx->nadds = idx->capadds = 0;
 }
 
 struct inode_s** indexlist(const struct index_s* idx) {
@@ -121,18 +541,17 @@ struct inode_s** indexlist(const struct index_s* idx) {
   struct inode_s** fl;
   if ((fl = calloc(idx->size, sizeof(*fl))) == NULL) return NULL;
   long ni = 0;
-  for (int i = 0; i < INDEXBUCKETS; i++) {
-    for (struct inode_s* head = idx->buckets[i]; head != NULL;
-         head = head->next) {
-      // prevent linked-list data from exceeding the expected/alloc'd index size
-      if (ni >= idx->size) {
-        errno = ERANGE;
-        log_error("indexlist: size error (limit %ld, at %ld)", idx->size, ni);
-        free(fl);
-        return NULL;
-      }
-      fl[ni++] = head;
+  for (long i = 0; i < idx->cap; i++) {
+    struct inode_s* node = idx->slots[i].node;
+    if (node == NULL) continue;
+    // prevent slot data from exceeding the expected/alloc'd index size
+    if (ni >= idx->size) {
+      errno = ERANGE;
+      log_error("indexlist: size error (limit %ld, at %ld)", idx->size, ni);
+      free(fl);
+      return NULL;
     }
+    fl[ni++] = node;
   }
   return fl;
 }
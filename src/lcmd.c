@@ -4,7 +4,12 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
 #include <regex.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,28 +20,65 @@
 
 #include "cJSON/cJSON.h"
 
+#include "act.h"
+#include "coproc.h"
 #include "fd.h"
+#include "fs.h"
 #include "index.h"
 #include "log.h"
+#include "mre.h"
+#include "plugin.h"
 #include "sl.h"
 #include "tm.h"
 
+extern char** environ;
+
+/// @def LCMASKREST
+/// @brief Bit of the match mask which is shared by the command sets from this
+/// index on, and whose file patterns are then matched again one set at a time
+#define LCMASKREST (MREIDS - 1)
+
+/// @brief Frees a NULL terminated array of compiled regex patterns.
+/// @param patterns Array of compiled regex patterns, or NULL
+static void lcmdfreepatterns(regex_t** patterns) {
+  for (size_t i = 0; patterns != NULL && patterns[i] != NULL; i++) {
+    regfree(patterns[i]);
+    free(patterns[i]);
+  }
+  free(patterns);
+}
+
+/// @brief Frees the argv templates of a command set.
+/// @param cmd The command set
+static void lcmdfreeargvs(struct lcmdset_s* cmd) {
+  for (size_t i = 0; cmd->argvs != NULL && cmd->syscmds[i] != NULL; i++) {
+    if (cmd->argvs[i] == NULL) continue;
+    free(cmd->argvs[i]->buf);
+    free(cmd->argvs[i]->segs);
+    free(cmd->argvs[i]);
+  }
+  free(cmd->argvs);
+}
+
 /// @brief Frees the memory allocated for a single command set entry struct.
 /// @param cmd Command set entry to free
 static void lcmdfree(struct lcmdset_s* cmd) {
-  for (size_t i = 0; cmd->fpatterns[i] != NULL; i++) {
-    regex_t* reg = cmd->fpatterns[i];
-    if (reg == NULL) continue;
-    regfree(reg);
-    free(reg);
+  if (cmd->batch.count > 0) {
+    for (int i = 0; i < LCBATCHES; i++) free(cmd->batch.pending[i].nodes);
+    pthread_mutex_destroy(&cmd->batch.lock);
   }
-  free(cmd->fpatterns);
+  lcmdfreepatterns(cmd->fpatterns);
+  lcmdfreepatterns(cmd->dpatterns);
   free(cmd->name);
+  free(cmd->searchdir);
+  lcmdfreeargvs(cmd);
   slfree(cmd->syscmds);
+  pluginclose(cmd->plugin);
   free(cmd);
 }
 
 void lcmdfree_r(struct lcmdset_s** cs) {
+  if (cs != NULL && cs[0] != NULL) mrefree(cs[0]->matcher);
   for (size_t i = 0; cs != NULL && cs[i] != NULL; i++) lcmdfree(cs[i]);
   free(cs);
 }
@@ -120,8 +162,271 @@ static int lcmdparseflags(const cJSON* item) {
   return flags;
 }
 
+/// @brief Compiles a cJSON array of regex pattern strings into a NULL
+/// terminated array of compiled regex patterns.
+/// @param plist cJSON array of regex pattern strings
+/// @return A dynamically allocated array of compiled regex patterns, which
+/// must be freed using `lcmdfreepatterns`, or NULL if any entry is not a
+/// string or fails to compile.
+static regex_t** lcmdcompile(const cJSON* plist) {
+  const int regcount = cJSON_GetArraySize(plist);
+  regex_t** patterns;
+  if ((patterns = calloc(regcount + 1, sizeof(regex_t*))) == NULL) return NULL;
+
+  // compile regex patterns
+  for (int i = 0; i < regcount; i++) {
+    cJSON* p = cJSON_GetArrayItem(plist, i);
+    if (!cJSON_IsString(p)) goto err;
+
+    regex_t* reg;
+    if ((reg = calloc(1, sizeof(*reg))) == NULL) goto err;
+
+    int regmode = REG_EXTENDED | REG_NOSUB;
+#ifdef __APPLE__
+    regmode |= REG_ENHANCED;
+#endif
+
+    int err;
+    if ((err = regcomp(reg, p->valuestring, regmode))) {
+      char errmsg[512] = {0};
+      regerror(err, reg, errmsg, sizeof(errmsg));
+      log_error("error compiling pattern `%s`: %s", p->valuestring, errmsg);
+      free(reg);
+      goto err;
+    }
+    patterns[i] = reg;
+  }
+
+  return patterns;
+err:
+  lcmdfreepatterns(patterns);
+  return NULL;
+}
+
+/// @brief Parses the `batch` setting of a command set, which is either `true`
+/// to batch files using the default limits, or an object with optional
+/// `count`, `bytes` and `ms` limits and a `pass` mode of `env`, `file` or
+/// `args`. The mutex of batched command sets is initialized.
+/// @param item cJSON `batch` item
+/// @param cmd Struct to populate with the parsed batch settings
+/// @return 0 if successful, otherwise non-zero to indicate an error.
+static int lcmdparsebatch(const cJSON* item, struct lcmdset_s* cmd) {
+  if (cJSON_IsFalse(item)) return 0;
+  if (!cJSON_IsTrue(item) && !cJSON_IsObject(item)) return -1;
+
+  cmd->batch.count = LCBATCHCOUNT;
+  cmd->batch.bytes = LCBATCHBYTES;
+  cmd->batch.pass = LCPASS_ENV;
+  if (cJSON_IsObject(item)) {
+    const cJSON* count = cJSON_GetObjectItem(item, "count");
+    const cJSON* bytes = cJSON_GetObjectItem(item, "bytes");
+    const cJSON* ms = cJSON_GetObjectItem(item, "ms");
+    const cJSON* pass = cJSON_GetObjectItem(item, "pass");
+    if (cJSON_IsNumber(count)) cmd->batch.count = count->valueint;
+    if (cJSON_IsNumber(bytes)) cmd->batch.bytes = (size_t) bytes->valuedouble;
+    if (cJSON_IsNumber(ms)) cmd->batch.ms = (uint64_t) ms->valuedouble;
+    if (cmd->batch.count <= 0 || cmd->batch.bytes == 0) return -1;
+    if (cJSON_IsString(pass)) {
+      if (strcmp(pass->valuestring, "file") == 0) {
+        cmd->batch.pass = LCPASS_FILE;
+      } else if (strcmp(pass->valuestring, "args") == 0) {
+        cmd->batch.pass = LCPASS_ARGS;
+      } else if (strcmp(pass->valuestring, "env") != 0) {
+        log_error("unknown batch pass mode `%s`", pass->valuestring);
+        return -1;
+      }
+    }
+  }
+  if (pthread_mutex_init(&cmd->batch.lock, NULL)) {
+    cmd->batch.count = 0;
+    return -1;
+  }
+  return 0;
+}
+
+/// @brief Placeholder names of argv templates, indexed by `lcmdvar_t`.
+static const char* const lcmdvarnames[LCVAR_COUNT] = {
+        NULL, "path", "dir", "stem", "ext", "relpath", "reldir",
+};
+
+/// @brief Parses command \p cmd into an argv template. Arguments are separated
+/// by whitespace, and quotes or other shell syntax are not interpreted. Each
+/// argument may contain placeholders (`{path}`, `{dir}`, `{stem}`, `{ext}`,
+/// `{relpath}` and `{reldir}`) which are expanded for each file, and `{{` for
+/// a literal `{`.
+/// A command starting with `@` is a built-in action, named by its first
+/// argument, see `act_t`.
+/// @param cmd The command string to parse
+/// @return The argv template if successful, otherwise NULL.
+static struct lcmdargv_s* lcmdparseargv(const char* cmd) {
+  struct lcmdargv_s* a;
+  if ((a = calloc(1, sizeof(*a))) == NULL) return NULL;
+  if ((a->buf = strdup(cmd[0] == '@' ? cmd + 1 : cmd)) == NULL) goto err;
+  if ((a->segs = malloc((strlen(cmd) + 1) * sizeof(*a->segs))) == NULL)
+    goto err;
+
+  // literal text is compacted in place, as `{{` escapes are unescaped
+  char* p = a->buf;
+  char* w = a->buf;
+  for (;;) {
+    while (*p == ' ' || *p == '\t' || *p == '\n') p++;
+    if (*p == '\0') break;
+
+    w = p;
+    struct lcmdseg_s seg = {.lit = w};
+    while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\n') {
+      if (p[0] == '{' && p[1] == '{') {
+        *w++ = '{', p += 2;
+        continue;
+      }
+      if (*p != '{') {
+        *w++ = *p++;
+        continue;
+      }
+      const char* end = strchr(p, '}');
+      int var = LCVAR_COUNT;
+      for (int i = 1; end != NULL && i < LCVAR_COUNT; i++)
+        if (strlen(lcmdvarnames[i]) == (size_t) (end - p - 1) &&
+            strncmp(p + 1, lcmdvarnames[i], end - p - 1) == 0)
+          var = i;
+      if (var == LCVAR_COUNT) {
+        log_error("unknown placeholder in command `%s`", cmd);
+        goto err;
+      }
+      seg.len = w - seg.lit, seg.var = var;
+      a->segs[a->nsegs++] = seg;
+      a->vars = true;
+      seg = (struct lcmdseg_s){.lit = w};
+      p = (char*) end + 1;
+    }
+    seg.len = w - seg.lit, seg.last = true;
+    a->segs[a->nsegs++] = seg;
+    a->argc++;
+    if (*p != '\0') p++;
+  }
+  if (a->argc == 0) {
+    log_error("empty command `%s`", cmd);
+    goto err;
+  }
+
+  // the action name must be a literal argument
+  if (cmd[0] == '@') {
+    if (a->segs[0].last && a->segs[0].var == LCVAR_NONE) {
+      a->buf[a->segs[0].len] = '\0';
+      a->act = actparse(a->buf, a->argc - 1);
+    }
+    if (a->act == ACT_NONE) {
+      log_error("unknown action or wrong number of arguments `%s`", cmd);
+      goto err;
+    }
+  }
+  return a;
+
+err:
+  free(a->buf);
+  free(a->segs);
+  free(a);
+  return NULL;
+}
+
+/// @brief Parses the commands of a command set into argv templates, either
+/// all commands if \p exec is set, or only built-in actions. Placeholders
+/// cannot be used by batched command sets, as their commands run for many
+/// files at once, and actions cannot be batched.
+/// @param cmd The command set to populate
+/// @param exec Parse all commands, not only actions
+/// @return 0 if successful, otherwise -1 to indicate an error.
+static int lcmdparseargvs(struct lcmdset_s* cmd, const bool exec) {
+  size_t n = 0, acts = 0;
+  for (; cmd->syscmds[n] != NULL; n++) acts += cmd->syscmds[n][0] == '@';
+  if (!exec && acts == 0) return 0;
+  if ((cmd->argvs = calloc(n + 1, sizeof(*cmd->argvs))) == NULL) return -1;
+  for (size_t i = 0; i < n; i++) {
+    if (!exec && cmd->syscmds[i][0] != '@') continue;
+    if ((cmd->argvs[i] = lcmdparseargv(cmd->syscmds[i])) == NULL) return -1;
+    if (cmd->batch.count > 0 && cmd->argvs[i]->act != ACT_NONE) {
+      log_error("actions cannot be batched: %s", cmd->syscmds[i]);
+      return -1;
+    }
+    if (cmd->batch.count > 0 && cmd->argvs[i]->vars) {
+      log_error("placeholders cannot be used in batched command `%s`",
+                cmd->syscmds[i]);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/// @brief Parses the `coproc` setting of a command set, which is either `true`,
+/// `false`, or an object with the following optional keys:
+/// - `requests`: The number of requests after which a coprocess is restarted,
+/// or 0 to never restart it (default 0)
+/// - `timeout`: The time in milliseconds a coprocess may take to reply before
+/// it is stopped, or 0 to wait indefinitely (default `COPROCTIMEOUTMS`)
+/// Coprocesses are started once, so their commands cannot be batched and
+/// cannot contain placeholders.
+/// @param item cJSON value of the `coproc` setting
+/// @param cmd The command set to populate
+/// @return 0 if successful, otherwise -1 to indicate an error.
+static int lcmdparsecoproc(const cJSON* item, struct lcmdset_s* cmd) {
+  if (cJSON_IsFalse(item)) return 0;
+  if (!cJSON_IsTrue(item) && !cJSON_IsObject(item)) return -1;
+
+  const cJSON* requests = cJSON_GetObjectItem(item, "requests");
+  const cJSON* timeout = cJSON_GetObjectItem(item, "timeout");
+  if (cJSON_IsNumber(requests)) cmd->coprocmax = (long) requests->valuedouble;
+  if (cmd->coprocmax < 0) return -1;
+  cmd->coproctimeout = COPROCTIMEOUTMS;
+  if (cJSON_IsNumber(timeout)) {
+    if (timeout->valuedouble < 0) return -1;
+    cmd->coproctimeout = (uint64_t) timeout->valuedouble;
+  }
+  if (cmd->batch.count > 0) {
+    log_error("coprocess commands cannot be batched: %s", cmd->syscmds[0]);
+    return -1;
+  }
+  for (size_t i = 0; cmd->argvs != NULL && cmd->syscmds[i] != NULL; i++) {
+    if (cmd->argvs[i] != NULL && cmd->argvs[i]->act != ACT_NONE) {
+      log_error("actions cannot be coprocesses: %s", cmd->syscmds[i]);
+      return -1;
+    }
+    if (cmd->argvs[i] != NULL && cmd->argvs[i]->vars) {
+      log_error("placeholders cannot be used in coprocess command `%s`",
+                cmd->syscmds[i]);
+      return -1;
+    }
+  }
+  cmd->coprocid = 0;// numbered by `lcmdparse`
+  return 0;
+}
+
+/// @brief Parses the `plugin` setting of a command set and loads the plugin,
+/// see `fsaplugin.h`. The setting is either the shared object file path, or an
+/// object with the following keys:
+/// - `path`: The shared object file path
+/// - `arg`: An optional string passed to the plugin's `fsap_init`
+/// @param item cJSON value of the `plugin` setting
+/// @param cmd The command set to populate
+/// @return 0 if successful, otherwise -1 to indicate an error.
+static int lcmdparseplugin(const cJSON* item, struct lcmdset_s* cmd) {
+  const cJSON* path = item;
+  const cJSON* arg = NULL;
+  if (cJSON_IsObject(item)) {
+    path = cJSON_GetObjectItem(item, "path");
+    arg = cJSON_GetObjectItem(item, "arg");
+    if (arg != NULL && !cJSON_IsString(arg)) return -1;
+  }
+  if (!cJSON_IsString(path)) return -1;
+  if ((cmd->plugin = pluginopen(path->valuestring,
+                                arg != NULL ? arg->valuestring : NULL)) == NULL)
+    return -1;
+  cmd->pluginid = 0;// numbered by `lcmdparse`
+  return 0;
+}
+
 /// @brief Populates a single command struct by parsing the fields of the
-/// provided cJSON object.
+/// provided cJSON object. An object with only a `prune` array is a prune-only
+/// command set, which never matches any file.
 /// @param obj cJSON object containing the command data
 /// @param cmd Struct to populate with parsed command data
 /// @param id Command set index for naming purposes
@@ -130,12 +435,45 @@ static int lcmdparseone(const cJSON* obj, struct lcmdset_s* cmd, const int id) {
   cJSON* onlist = cJSON_GetObjectItem(obj, "on");
   cJSON* plist = cJSON_GetObjectItem(obj, "patterns");
   cJSON* clist = cJSON_GetObjectItem(obj, "commands");
+  cJSON* dlist = cJSON_GetObjectItem(obj, "prune");
+  cJSON* plugin = cJSON_GetObjectItem(obj, "plugin");
 
-  if (!cJSON_IsArray(onlist) || !cJSON_IsArray(plist) || !cJSON_IsArray(clist))
-    return -1;
+  cmd->coprocid = -1;
+  cmd->pluginid = -1;
+  if (dlist != NULL) {
+    if (!cJSON_IsArray(dlist)) return -1;
+    if ((cmd->dpatterns = lcmdcompile(dlist)) == NULL) return -1;
+  }
+  const bool pruneonly = dlist != NULL && onlist == NULL && plist == NULL &&
+                         clist == NULL && plugin == NULL;
 
-  if ((cmd->onflags = lcmdparseflags(onlist)) == 0) return -1;
-  if ((cmd->syscmds = lcmdjsontosl(clist)) == NULL) return -1;
+  if (pruneonly) {
+    if ((cmd->fpatterns = calloc(1, sizeof(regex_t*))) == NULL) return -1;
+  } else {
+    if (!cJSON_IsArray(onlist) || !cJSON_IsArray(plist) ||
+        (!cJSON_IsArray(clist) && (clist != NULL || plugin == NULL)))
+      return -1;
+
+    if ((cmd->onflags = lcmdparseflags(onlist)) == 0) return -1;
+    if (clist != NULL) {
+      if ((cmd->syscmds = lcmdjsontosl(clist)) == NULL) return -1;
+    } else if ((cmd->syscmds = calloc(1, sizeof(*cmd->syscmds))) == NULL) {
+      return -1;// a plugin without commands
+    }
+    if ((cmd->fpatterns = lcmdcompile(plist)) == NULL) return -1;
+    if (plugin != NULL && lcmdparseplugin(plugin, cmd)) return -1;
+
+    // a plugin without commands has no commands to batch
+    cJSON* batch = cJSON_GetObjectItem(obj, "batch");
+    if (batch != NULL && clist != NULL && lcmdparsebatch(batch, cmd))
+      return -1;
+
+    cJSON* exec = cJSON_GetObjectItem(obj, "exec");
+    if (lcmdparseargvs(cmd, cJSON_IsTrue(exec))) return -1;
+
+    cJSON* coproc = cJSON_GetObjectItem(obj, "coproc");
+    if (coproc != NULL && lcmdparsecoproc(coproc, cmd)) return -1;
+  }
 
   // copy description, otherwise use the index as the name
   cJSON* desc = cJSON_GetObjectItem(obj, "description");
@@ -147,39 +485,14 @@ static int lcmdparseone(const cJSON* obj, struct lcmdset_s* cmd, const int id) {
     if ((cmd->name = strdup(b)) == NULL) return -1;
   }
 
-  const int regcount = cJSON_GetArraySize(plist);
-  if ((cmd->fpatterns = calloc(regcount + 1, sizeof(regex_t*))) == NULL)
-    return -1;
-
-  // compile regex patterns
-  for (int i = 0; i < regcount; i++) {
-    cJSON* p = cJSON_GetArrayItem(plist, i);
-    if (!cJSON_IsString(p)) return -1;
-
-    regex_t* reg;
-    if ((reg = cmd->fpatterns[i] = calloc(1, sizeof(*reg))) == NULL) return -1;
-
-    int regmode = REG_EXTENDED | REG_NOSUB;
-#ifdef __APPLE__
-    regmode |= REG_ENHANCED;
-#endif
-
-    if (regcomp(reg, p->valuestring, regmode)) {
-      char errmsg[512] = {0};
-      regerror(errno, reg, errmsg, sizeof(errmsg));
-      log_error("error compiling pattern `%s`: %s", p->valuestring, errmsg);
-
-      return -1;
-    }
-  }
-
   return 0;
 }
 
-struct lcmdset_s** lcmdparse(const char* fp) {
+struct lcmdset_s** lcmdparse(const char* fp, const char* sd) {
   char* fbuf = NULL;            /* file contents buffer */
   cJSON* jt = NULL;             /* parsed JSON tree */
   struct lcmdset_s** cs = NULL; /* command set array */
+  struct mre_s* m = NULL;       /* combined file pattern matcher */
 
   if ((fbuf = fsreadstr(fp)) == NULL) {
     log_error("error reading file `%s`: %s", fp, strerror(errno));
@@ -192,25 +505,49 @@ struct lcmdset_s** lcmdparse(const char* fp) {
 
   const int len = cJSON_GetArraySize(jt);
   if ((cs = calloc(len + 1, sizeof(cs))) == NULL) goto err;
+  if ((m = mrenew()) == NULL) goto err;
 
   // iterate over each command block
   cJSON* item;
   int i = 0;
+  int ncoprocs = 0;
+  int nplugins = 0;
   cJSON_ArrayForEach(item, jt) {
     assert(i < len);
     struct lcmdset_s* cmd;
-    if ((cmd = cs[i] = malloc(sizeof(*cmd))) == NULL) goto err;
+    if ((cmd = cs[i] = calloc(1, sizeof(*cmd))) == NULL) goto err;
+    if ((cmd->searchdir = strdup(sd)) == NULL) goto err;
     if (lcmdparseone(item, cmd, i)) {
       log_error("error parsing command block %d", i);
       goto err;
     }
+
+    // number the coprocesses of all commands, see `lcmdinvokecoproc`
+    if (cmd->coprocid >= 0) {
+      cmd->coprocid = ncoprocs;
+      for (size_t j = 0; cmd->syscmds[j] != NULL; j++) ncoprocs++;
+    }
+    if (cmd->pluginid >= 0) cmd->pluginid = nplugins++;
+
+    // the file patterns of all sets are matched by the combined matcher
+    const cJSON* plist = cJSON_GetObjectItem(item, "patterns");
+    const int id = i < LCMASKREST ? i : LCMASKREST;
+    for (int j = 0; cmd->fpatterns[j] != NULL; j++)
+      if (mreadd(m, cJSON_GetArrayItem(plist, j)->valuestring,
+                 cmd->fpatterns[j], id))
+        goto err;
     i++;
   }
+  if (mrebuild(m)) goto err;
+  for (i = 0; i < len; i++) cs[i]->matcher = m;
+  if (len == 0) mrefree(m);// owned by no command set
 
   goto ok;
 
 err:
+  mrefree(m);
   lcmdfree_r(cs);
+  cs = NULL;
 ok:
   free(fbuf);
   if (jt != NULL) cJSON_Delete(jt);
@@ -228,72 +565,666 @@ static bool lcmdmatch(regex_t** fpatterns, const char* fp) {
   return false;
 }
 
+/// @brief Checks if the file patterns of command set \p i match \p fp.
+/// @param cs The command set array
+/// @param i The index of the command set
+/// @param mask The match mask of \p fp, see `lcmdmatchmask`
+/// @param fp Filepath to match
+/// @return True if the filepath matches any of the patterns, otherwise false.
+static bool lcmdmatchset(struct lcmdset_s** cs, const size_t i,
+                         const uint64_t mask, const char* fp) {
+  if (i < LCMASKREST) return mask & (UINT64_C(1) << i);
+  return (mask & (UINT64_C(1) << LCMASKREST)) &&
+         lcmdmatch(cs[i]->fpatterns, fp);
+}
+
 bool lcmdmatchany(struct lcmdset_s** cs, const char* fp) {
+  if (cs == NULL || cs[0] == NULL) return false;
+  return mrematch(cs[0]->matcher, fp, true) != 0;
+}
+
+uint64_t lcmdmatchmask(struct lcmdset_s** cs, const char* fp) {
+  if (cs == NULL || cs[0] == NULL) return 0;
+  return mrematch(cs[0]->matcher, fp, false);
+}
+
+uint64_t lcmdsubscribers(struct lcmdset_s** cs, const int flags) {
+  uint64_t mask = 0;
+  for (size_t i = 0; cs != NULL && cs[i] != NULL; i++)
+    if (cs[i]->onflags & flags)
+      mask |= UINT64_C(1) << (i < LCMASKREST ? i : LCMASKREST);
+  return mask;
+}
+
+void lcmdmatchstats(struct lcmdset_s** cs, struct mrestats_s* stats) {
+  mrestats(cs != NULL && cs[0] != NULL ? cs[0]->matcher : NULL, stats);
+}
+
+uint64_t lcmdmaskhash(struct lcmdset_s** cs) {
+  if (cs == NULL || cs[0] == NULL) return 0;
+  return mrehash(cs[0]->matcher);
+}
+
+bool lcmdprune(struct lcmdset_s** cs, const char* dir, const int flags) {
+  bool prune = false;
+  for (size_t i = 0; cs != NULL && cs[i] != NULL && !prune; i++) {
+    const struct lcmdset_s* s = cs[i];
+    if (s->dpatterns == NULL) continue;
+    prune = lcmdmatch(s->dpatterns, dir);
+    if (flags & LCTOPT_TRACE)
+      log_info("cmdset %zu %s directory: %s", i,
+               prune ? "pruned" : "did not prune", dir);
+  }
+  return prune;
+}
+
+bool lcmdhasprune(struct lcmdset_s** cs) {
   for (size_t i = 0; cs != NULL && cs[i] != NULL; i++)
-    if (lcmdmatch(cs[i]->fpatterns, fp)) return true;
+    if (cs[i]->dpatterns != NULL && cs[i]->dpatterns[0] != NULL) return true;
   return false;
 }
 
-/// @brief Invokes a string \p cmd as a system command using `system(3)` in a
-/// forked/child process. The file path of \p node is set as an environment
-/// variable for use in the command. File descriptor set \p fds is used to
-/// optionally redirect stdout and stderr of the child command processes.
+/// @brief Stats the file of \p node after commands have run for it, as they
+/// may have modified the file, see `indexsetstat()`. Nodes may be re-stat'ed
+/// by several worker threads at once (e.g. by a batch and a non-batched
+/// command set), so the updates are serialized.
+/// @param node The file node to update
+static void lcmdrestat(struct inode_s* node) {
+  static pthread_mutex_t statlock = PTHREAD_MUTEX_INITIALIZER;
+  struct fsstat_s st;
+  int err;
+  if ((err = fsstat(node->fp, &st))) {
+    log_error("stat error: %d", err);
+    return;
+  }
+  pthread_mutex_lock(&statlock);
+  indexsetstat(node, &st);
+  pthread_mutex_unlock(&statlock);
+}
+
+/// @brief Expands argv template \p a for file path \p fp into an argument
+/// array. The array and its strings are allocated as a single block.
+/// @param a The argv template
+/// @param fp The file path to expand the placeholders with, or NULL if the
+/// template has none
+/// @param sd The search directory which \p fp is relative to, or NULL
+/// @param extra Number of NULL entries to reserve after the expanded arguments
+/// @return The NULL terminated argument array, which must be freed by the
+/// caller, otherwise NULL and `errno` is set.
+static char** lcmdexpand(const struct lcmdargv_s* a, const char* fp,
+                         const char* sd, const int extra) {
+  const char* val[LCVAR_COUNT] = {""};
+  size_t len[LCVAR_COUNT] = {0};
+  if (fp != NULL) {
+    const char* slash = strrchr(fp, '/');
+    const char* base = slash != NULL ? slash + 1 : fp;
+    const char* dot = strrchr(base, '.');
+    if (dot == NULL || dot == base) dot = base + strlen(base);
+    val[LCVAR_PATH] = fp, len[LCVAR_PATH] = strlen(fp);
+    val[LCVAR_DIR] = slash == NULL ? "." : slash == fp ? "/" : fp;
+    len[LCVAR_DIR] = slash == NULL || slash == fp ? 1 : slash - fp;
+    val[LCVAR_STEM] = base, len[LCVAR_STEM] = dot - base;
+    val[LCVAR_EXT] = dot, len[LCVAR_EXT] = strlen(dot);
+    const size_t sdlen = sd != NULL ? strlen(sd) : 0;
+    const char* rel = fp;
+    if (sdlen > 0 && strncmp(fp, sd, sdlen) == 0 && fp[sdlen] == '/')
+      rel = fp + sdlen + 1;
+    else if (strncmp(fp, "./", 2) == 0)
+      rel = fp + 2;
+    val[LCVAR_RELPATH] = rel, len[LCVAR_RELPATH] = strlen(rel);
+    val[LCVAR_RELDIR] = slash == NULL || slash < rel ? "." : rel;
+    len[LCVAR_RELDIR] = slash == NULL || slash < rel ? 1 : slash - rel;
+  }
+
+  size_t total = 0;
+  for (int i = 0; i < a->nsegs; i++)
+    total += a->segs[i].len + len[a->segs[i].var] + a->segs[i].last;
+
+  char** argv;
+  const size_t n = a->argc + extra + 1;
+  if ((argv = malloc(n * sizeof(*argv) + total)) == NULL) return NULL;
+  char* str = (char*) (argv + n);
+  int c = 0;
+  argv[c] = str;
+  for (int i = 0; i < a->nsegs; i++) {
+    const struct lcmdseg_s* seg = &a->segs[i];
+    memcpy(str, seg->lit, seg->len), str += seg->len;
+    memcpy(str, val[seg->var], len[seg->var]), str += len[seg->var];
+    if (seg->last) *str++ = '\0', argv[++c] = str;
+  }
+  for (int i = a->argc; i < (int) n; i++) argv[i] = NULL;
+  return argv;
+}
+
+/// @brief Builds the environment of a command process, which is the process
+/// environment with the variables \p env added or replaced. The array and its
+/// added strings are allocated as a single block.
+/// @param env NULL terminated array of alternating environment variable names
+/// and values to set
+/// @return The NULL terminated environment array, which must be freed by the
+/// caller, otherwise NULL and `errno` is set.
+static char** lcmdenviron(const char* const* env) {
+  size_t n = 0, len = 0;
+  for (size_t i = 0; environ[i] != NULL; i++) n++;
+  for (size_t i = 0; env[i] != NULL; i += 2)
+    n++, len += strlen(env[i]) + strlen(env[i + 1]) + 2;
+
+  char** envp;
+  if ((envp = malloc((n + 1) * sizeof(*envp) + len)) == NULL) return NULL;
+  char* str = (char*) (envp + n + 1);
+
+  // inherit all variables which are not replaced
+  size_t c = 0;
+  for (size_t i = 0; environ[i] != NULL; i++) {
+    bool keep = true;
+    for (size_t j = 0; keep && env[j] != NULL; j += 2) {
+      const size_t nlen = strlen(env[j]);
+      keep = strncmp(environ[i], env[j], nlen) || environ[i][nlen] != '=';
+    }
+    if (keep) envp[c++] = environ[i];
+  }
+  for (size_t i = 0; env[i] != NULL; i += 2) {
+    envp[c++] = str;
+    str += sprintf(str, "%s=%s", env[i], env[i + 1]) + 1;
+  }
+  envp[c] = NULL;
+  return envp;
+}
+
+/// @brief Invokes a string \p cmd as a system command in a child process
+/// spawned by `posix_spawnp(3)`, which does not copy the parent's memory
+/// mappings as `fork(2)` does. The command is executed by `/bin/sh -c`, or
+/// directly by \p argv, with environment variables \p env set for use in the
+/// command. File descriptor
+/// set \p fds is used to optionally redirect stdout and stderr of the child
+/// command processes.
+/// @param cmd The command string to execute
+/// @param env NULL terminated array of alternating environment variable names
+/// and values to set
+/// @param argv NULL terminated argument array of the program to execute, which
+/// is searched in `PATH`, or NULL to execute \p cmd by `/bin/sh -c`
+/// @param fds The file descriptor set to use for stdout/stderr redirection
+/// @param msspent Optional pointer to a uint64_t value to which the time spent
+/// executing the command (in milliseconds) will be added.
+/// @return The exit status of the command if successful, 127 if the program
+/// cannot be executed (as reported by the shell), otherwise -1 to indicate an
+/// error.
+static int lcmdspawn(const char* cmd, const char* const* env, char* const* argv,
+                     const struct fdset_s* fds, uint64_t* msspent) {
+  const uint64_t start = tmnow();
+  char* const shargv[] = {"/bin/sh", "-c", (char*) cmd, NULL};
+  if (argv == NULL) argv = shargv;
+
+  char** envp;
+  if ((envp = lcmdenviron(env)) == NULL) {
+    log_error("cannot build environment `%s`: %s", cmd, strerror(errno));
+    return -1;
+  }
+
+  // redirect output, and do not inherit the signals blocked by worker threads
+  posix_spawn_file_actions_t fa;
+  posix_spawnattr_t attr;
+  sigset_t mask;
+  sigemptyset(&mask);
+  posix_spawn_file_actions_init(&fa);
+  posix_spawn_file_actions_adddup2(&fa, fds->out, STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&fa, fds->err, STDERR_FILENO);
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+  posix_spawnattr_setsigmask(&attr, &mask);
+
+  pid_t pid;
+  const int err = posix_spawnp(&pid, argv[0], &fa, &attr, argv, envp);
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&fa);
+  free(envp);
+  if (err == ENOENT || err == EACCES || err == ENOEXEC || err == ENOTDIR) {
+    log_error("cannot execute `%s`: %s", cmd, strerror(err));
+    return 127;
+  } else if (err) {
+    log_error("process spawning error `%s`: %s", cmd, strerror(err));
+    return -1;
+  }
+
+  // wait for child process to finish
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno == EINTR) continue;
+    log_error("cannot wait for child process %d: %s", pid, strerror(errno));
+    return -1;
+  }
+
+  // return the time spent executing the command
+  // command sets are shared by all worker threads
+  if (msspent != NULL)
+    __atomic_fetch_add(msspent, tmnow() - start, __ATOMIC_RELAXED);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+/// @brief Runs the built-in action of argv template \p a for \p node in the
+/// calling thread. A failure is logged like a failed command.
+/// @param cmd The command string of the action
+/// @param a The argv template of the action
+/// @param node The file node to expand the placeholders with
+/// @param sd The search directory of the file node
+/// @param flags Bit flags for controlling command execution, see `lcmdinvoke`
+/// @param msspent Optional pointer to a uint64_t value to which the time spent
+/// running the action (in milliseconds) will be added.
+/// @return 0 if successful, otherwise -1 to indicate an error.
+static int lcmdaction(const char* cmd, const struct lcmdargv_s* a,
+                      const struct inode_s* node, const char* sd,
+                      const int flags, uint64_t* msspent) {
+  if (flags & LCTOPT_VERBOSE) log_verbose("[x] %s", cmd);
+  const uint64_t start = tmnow();
+  char** argv;
+  if ((argv = lcmdexpand(a, node->fp, sd, 0)) == NULL) return -1;
+  if (actrun(a->act, a->argc - 1, argv + 1))
+    log_error("action `%s` failed for `%s`: %s", cmd, node->fp,
+              strerror(errno));
+  free(argv);
+  if (msspent != NULL)
+    __atomic_fetch_add(msspent, tmnow() - start, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/// @brief Invokes a string \p cmd as a system command in a child process.
+/// The file path of \p node is set as an environment variable for use in the
+/// command, and expanded into argv template \p a if set. If \p a is a built-in
+/// action, it is run by `lcmdaction` instead. File descriptor set
+/// \p fds is used to optionally redirect stdout and stderr of the child
+/// command processes.
 /// @param cmd The command string to execute
+/// @param a The argv template of \p cmd to execute directly, or NULL
 /// @param node The file node to use for the FILEPATH environment variable
+/// @param sd The search directory of the file node
 /// @param fds The file descriptor set to use for stdout/stderr redirection
 /// @param flags Bit flags for controlling command execution. If the
 /// `LCTOPT_VERBOSE` flag is set, the command will be printed to stdout before
-/// execution. If the `LCTOPT_TRACE` flag is set, debug information regarding
-/// the eligibility of any encountered file path will be printed to stdout.
+/// execution.
 /// @param msspent Optional pointer to a uint64_t value to which the time spent
 /// executing the command (in milliseconds) will be added.
 /// @return 0 if successful, otherwise -1 to indicate an error.
-static int lcmdinvoke(const char* cmd, const struct inode_s* node,
+static int lcmdinvoke(const char* cmd, const struct lcmdargv_s* a,
+                      const struct inode_s* node, const char* sd,
                       const struct fdset_s* fds, const int flags,
                       uint64_t* msspent) {
+  if (a != NULL && a->act != ACT_NONE)
+    return lcmdaction(cmd, a, node, sd, flags, msspent);
   if (flags & LCTOPT_VERBOSE) log_verbose("[x] %s", cmd);
+  const char* env[] = {"FILEPATH", node->fp, NULL};
+  char** argv = NULL;
+  if (a != NULL && (argv = lcmdexpand(a, node->fp, sd, 0)) == NULL)
+    return -1;
+  const int status = lcmdspawn(cmd, env, argv, fds, msspent);
+  free(argv);
+  if (status < 0) return -1;
+  if (status != 0) log_error("command `%s` returned %d", cmd, status);
+  return 0;
+}
 
-  const uint64_t start = tmnow();
+/// @brief Returns the name of a file event type.
+/// @param flags The file event type and command execution bit flags
+/// @return The name as used by the `on` array, or "nop" if no type is set
+static const char* lcmdevent(const int flags) {
+  if (flags & LCTRIG_NEW) return "new";
+  if (flags & LCTRIG_MOD) return "mod";
+  if (flags & LCTRIG_DEL) return "del";
+  return "nop";
+}
 
-  // fork the process to run the command
-  pid_t pid;
-  if ((pid = fork()) < 0) {
-    log_error("process forking error `%s`: %s", cmd, strerror(errno));
-    return -1;
-  } else if (pid == 0) {
-    if (dup2(fds->out, STDOUT_FILENO) < 0) {
-      log_error("cannot redirect stdout to %d: %s", fds->out, strerror(errno));
-      _exit(1); /* avoid firing parent atexit handlers */
+/// @brief Formats the request line sent to a coprocess for a file event, a
+/// JSON object with the `path`, `event`, `mtime` and `size` of the file.
+/// @param node The file node
+/// @param flags The file event type and command execution bit flags
+/// @param len Set to the length of the request line
+/// @return The newline terminated request line, which must be freed by the
+/// caller, otherwise NULL and `errno` is set.
+static char* lcmdrequest(const struct inode_s* node, const int flags,
+                         size_t* len) {
+  char* req;
+  if ((req = malloc(strlen(node->fp) * 6 + 128)) == NULL) return NULL;
+  char* p = req + sprintf(req, "{\"path\":\"");
+  for (const char* c = node->fp; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      *p++ = '\\', *p++ = *c;
+    } else if ((unsigned char) *c < 0x20) {
+      p += sprintf(p, "\\u%04x", (unsigned char) *c);
+    } else {
+      *p++ = *c;
     }
-    if (dup2(fds->err, STDERR_FILENO) < 0) {
-      log_error("cannot redirect stderr to %d: %s", fds->err, strerror(errno));
-      _exit(1); /* avoid firing parent atexit handlers */
+  }
+  p += sprintf(p, "\",\"event\":\"%s\",\"mtime\":%" PRIu64,
+               lcmdevent(flags), node->st.lmod);
+  p += sprintf(p, ",\"size\":%" PRIu64 "}\n", node->st.fsze);
+  *len = p - req;
+  return req;
+}
+
+/// @brief Returns the coprocess of the calling thread for a command of a
+/// coprocess command set, and (re)starts it if it is not running or reached its
+/// request limit. The coprocess table of \p fds is grown as needed.
+/// @param s The command set
+/// @param j The index of the command in the command set
+/// @param fds The file descriptor set of the calling thread
+/// @return The running coprocess, otherwise NULL to indicate an error.
+static struct coproc_s* lcmdcoproc(const struct lcmdset_s* s, const size_t j,
+                                   struct fdset_s* fds) {
+  const int id = s->coprocid + (int) j;
+  if (id >= fds->ncoprocs) {
+    struct coproc_s* r;
+    if ((r = realloc(fds->coprocs, (id + 1) * sizeof(*r))) == NULL)
+      return NULL;
+    memset(r + fds->ncoprocs, 0, (id + 1 - fds->ncoprocs) * sizeof(*r));
+    fds->coprocs = r, fds->ncoprocs = id + 1;
+  }
+  struct coproc_s* cp = &fds->coprocs[id];
+  if (cp->pid > 0 && s->coprocmax > 0 && cp->calls >= s->coprocmax)
+    coprocstop(cp);
+  if (cp->pid > 0) return cp;
+
+  char* const shargv[] = {"/bin/sh", "-c", s->syscmds[j], NULL};
+  char** argv = NULL;
+  if (s->argvs != NULL &&
+      (argv = lcmdexpand(s->argvs[j], NULL, NULL, 0)) == NULL)
+    return NULL;
+  const int err = coprocstart(cp, argv != NULL ? argv : shargv, fds->err);
+  free(argv);
+  if (err) {
+    log_error("cannot start coprocess `%s`: %s", s->syscmds[j],
+              strerror(errno));
+    return NULL;
+  }
+  return cp;
+}
+
+/// @brief Sends a request for the file event of \p node to the coprocess of a
+/// command and reads its status line. A coprocess which exited is restarted
+/// and sent the request once more, so a coprocess which exits on every request
+/// does not stop the command set. A coprocess which does not reply in time is
+/// stopped, and restarted for the next request.
+/// @param s The command set
+/// @param j The index of the command in the command set
+/// @param node The file node
+/// @param fds The file descriptor set of the calling thread
+/// @param flags Bit flags for controlling command execution, see `lcmdinvoke`
+/// @return 0 if successful, otherwise -1 to indicate an error.
+static int lcmdinvokecoproc(struct lcmdset_s* s, const size_t j,
+                            const struct inode_s* node, struct fdset_s* fds,
+                            const int flags) {
+  const char* cmd = s->syscmds[j];
+  if (flags & LCTOPT_VERBOSE) log_verbose("[x] %s", cmd);
+  const uint64_t start = tmnow();
+
+  size_t len;
+  char* req;
+  if ((req = lcmdrequest(node, flags, &len)) == NULL) return -1;
+  char reply[COPROCBUFSZE];
+  int err = -1;
+  for (int try = 0; try < 2 && err; try++) {
+    struct coproc_s* cp;
+    if ((cp = lcmdcoproc(s, j, fds)) == NULL) break;
+    if ((err = coproccall(cp, req, len, reply, sizeof(reply),
+                          s->coproctimeout))) {
+      const bool timedout = errno == ETIMEDOUT;
+      log_error("coprocess `%s` failed for `%s`: %s", cmd, node->fp,
+                strerror(errno));
+      coprocstop(cp);
+      if (timedout) break;// the request itself may hang the coprocess
     }
+  }
+  free(req);
+  __atomic_fetch_add(&s->msspent, tmnow() - start, __ATOMIC_RELAXED);
+  if (err) return -1;
 
-    // child process, modify local environment variables for use in commands
-    setenv("FILEPATH", node->fp, 1);
+  // the reply starts with the exit status of the request
+  char* end;
+  const long status = strtol(reply, &end, 10);
+  if (end == reply) {
+    log_error("coprocess `%s` replied `%s` for `%s`", cmd, reply, node->fp);
+  } else if (status != 0) {
+    log_error("command `%s` returned %ld for `%s`", cmd, status, node->fp);
+  }
+  return 0;
+}
 
-    // execute the command and instantly exit child process
-    int err;
-    if ((err = system(cmd))) log_error("command `%s` returned %d", cmd, err);
-    fdclose((struct fdset_s*) fds); /* close child process references */
-    _exit(err);                     /* avoid firing parent atexit handlers */
-  } else {
-    // parent process, wait for child process to finish
-    if (waitpid(pid, NULL, 0) < 0) {
-      log_error("cannot wait for child process %d: %s", pid, strerror(errno));
-      return -1;
+/// @brief Calls the plugin of a command set for the file event of \p node with
+/// the plugin context of the calling thread. The context table of \p fds is
+/// grown as needed.
+/// @param s The command set
+/// @param node The file node
+/// @param fds The file descriptor set of the calling thread
+/// @param flags Bit flags for controlling command execution, see `lcmdinvoke`
+/// @return 0 if successful, otherwise -1 to indicate an error.
+static int lcmdinvokeplugin(struct lcmdset_s* s, const struct inode_s* node,
+                            struct fdset_s* fds, const int flags) {
+  const int id = s->pluginid;
+  if (id >= fds->nplugctxs) {
+    struct pluginctx_s* r;
+    if ((r = realloc(fds->plugctxs, (id + 1) * sizeof(*r))) == NULL) return -1;
+    memset(r + fds->nplugctxs, 0, (id + 1 - fds->nplugctxs) * sizeof(*r));
+    fds->plugctxs = r, fds->nplugctxs = id + 1;
+  }
+  struct pluginctx_s* pc = &fds->plugctxs[id];
+  pc->plugin = s->plugin;
+  pc->dirty = true;
+
+  if (flags & LCTOPT_VERBOSE) log_verbose("[x] %s", s->plugin->fp);
+  const uint64_t start = tmnow();
+  const struct fsap_file_s file = {
+          .path = node->fp,
+          .event = flags & LCTRIG_ALL,
+          .mtime = node->st.lmod,
+          .size = node->st.fsze,
+  };
+  const int status = s->plugin->process(s->plugin->state, &pc->ctx, &file);
+  __atomic_fetch_add(&s->msspent, tmnow() - start, __ATOMIC_RELAXED);
+  if (status != 0)
+    log_error("plugin `%s` returned %d for `%s`", s->plugin->fp, status,
+              node->fp);
+  return 0;
+}
+
+/// @brief Calls the flush function of a plugin context.
+/// @param pc The plugin context
+/// @param last The thread is exiting and the context must be freed
+static void lcmdflushplugin(struct pluginctx_s* pc, const bool last) {
+  pc->dirty = false;
+  if (pc->plugin->flush == NULL) return;
+  int status;
+  if ((status = pc->plugin->flush(pc->plugin->state, pc->ctx, last)))
+    log_error("plugin `%s` flush returned %d", pc->plugin->fp, status);
+}
+
+/// @brief Writes the file paths of a batch, each terminated by a NUL byte, to
+/// a new temporary file.
+/// @param b The batch
+/// @param fp Buffer of at least `PATH_MAX` bytes set to the temporary file
+/// path, which must be unlinked by the caller
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int lcmdbatchfile(const struct lcmdbatch_s* b, char* fp) {
+  const char* tmp = getenv("TMPDIR");
+  snprintf(fp, PATH_MAX, "%s/fsautoproc.XXXXXX",
+           tmp != NULL && *tmp != '\0' ? tmp : "/tmp");
+  int fd;
+  if ((fd = mkstemp(fp)) < 0) return -1;
+  FILE* s;
+  if ((s = fdopen(fd, "w")) == NULL) {
+    close(fd);
+    unlink(fp);
+    return -1;
+  }
+  for (int i = 0; i < b->len; i++)
+    fwrite(b->nodes[i]->fp, 1, strlen(b->nodes[i]->fp) + 1, s);
+  if (fclose(s) != 0) {
+    unlink(fp);
+    return -1;
+  }
+  return 0;
+}
+
+/// @brief Invokes a string \p cmd once for all files of a batch, passing the
+/// file paths as configured by the command set. A failure of the command is
+/// reported for each file of the batch, since the command's exit status cannot
+/// tell which of the files failed.
+/// @param s The command set
+/// @param cmd The command string to execute
+/// @param a The argv template of \p cmd to execute directly, or NULL
+/// @param b The batch
+/// @param fds The file descriptor set to use for stdout/stderr redirection
+/// @param flags Bit flags for controlling command execution, see `lcmdinvoke`
+/// @return 0 if successful, otherwise -1 to indicate an error.
+static int lcmdinvokebatch(struct lcmdset_s* s, const char* cmd,
+                           const struct lcmdargv_s* a,
+                           const struct lcmdbatch_s* b,
+                           const struct fdset_s* fds, const int flags) {
+  if (flags & LCTOPT_VERBOSE) log_verbose("[x] %s (%d files)", cmd, b->len);
+
+  char* list = NULL;  /* newline separated file paths */
+  char** argv = NULL; /* command arguments followed by file paths */
+  char tmpfp[PATH_MAX] = {0};
+  const char* env[] = {NULL, NULL, NULL};
+  int ret = -1;
+  switch (s->batch.pass) {
+    case LCPASS_ENV: {
+      if ((list = malloc(b->bytes + 1)) == NULL) goto err;
+      size_t off = 0;
+      for (int i = 0; i < b->len; i++) {
+        const size_t len = strlen(b->nodes[i]->fp);
+        memcpy(list + off, b->nodes[i]->fp, len);
+        list[off + len] = '\n';
+        off += len + 1;
+      }
+      list[off > 0 ? off - 1 : 0] = '\0';
+      env[0] = "FILEPATHS", env[1] = list;
+      break;
     }
+    case LCPASS_FILE:
+      if (lcmdbatchfile(b, tmpfp)) {
+        log_error("cannot write file list: %s", strerror(errno));
+        goto err;
+      }
+      env[0] = "FILELIST", env[1] = tmpfp;
+      break;
+    case LCPASS_ARGS:
+      if (a != NULL) break;
+      if ((argv = calloc(b->len + 5, sizeof(*argv))) == NULL) goto err;
+      argv[0] = "/bin/sh", argv[1] = "-c", argv[2] = (char*) cmd;
+      argv[3] = "sh";
+      for (int i = 0; i < b->len; i++) argv[i + 4] = b->nodes[i]->fp;
+      break;
+  }
+  if (a != NULL) {
+    const bool args = s->batch.pass == LCPASS_ARGS;
+    const int extra = args ? b->len : 0;
+    if ((argv = lcmdexpand(a, NULL, NULL, extra)) == NULL) goto err;
+    for (int i = 0; args && i < b->len; i++)
+      argv[a->argc + i] = b->nodes[i]->fp;
+  }
 
-    // return the time spent executing the command
-    if (msspent != NULL) *msspent += tmnow() - start;
-    return 0;
+  int status;
+  if ((status = lcmdspawn(cmd, env, argv, fds, &s->msspent)) < 0) goto err;
+  for (int i = 0; status != 0 && i < b->len; i++)
+    log_error("command `%s` returned %d for `%s`", cmd, status,
+              b->nodes[i]->fp);
+  ret = 0;
+err:
+  if (tmpfp[0] != '\0') unlink(tmpfp);
+  free(list);
+  free(argv);
+  return ret;
+}
+
+/// @brief Runs all commands of the command set for the files of a detached
+/// batch, and re-stats the files of new and modified file events.
+/// @param s The command set
+/// @param b The batch, which is freed
+/// @param trig The file event type of the batch
+/// @param fds The file descriptor set to use for stdout/stderr redirection
+/// @param flags Bit flags for controlling command execution, see `lcmdinvoke`
+/// @return 0 if successful, otherwise -1 to indicate an error.
+static int lcmdbatchrun(struct lcmdset_s* s, struct lcmdbatch_s* b,
+                        const int trig, const struct fdset_s* fds,
+                        const int flags) {
+  int ret = 0;
+  for (size_t j = 0; s->syscmds[j] != NULL && !ret; j++)
+    ret = lcmdinvokebatch(s, s->syscmds[j], s->argvs ? s->argvs[j] : NULL, b,
+                          fds, flags);
+  if (trig & (LCTRIG_NEW | LCTRIG_MOD))
+    for (int i = 0; i < b->len; i++) lcmdrestat(b->nodes[i]);
+  free(b->nodes);
+  *b = (struct lcmdbatch_s){0};
+  return ret;
+}
+
+/// @brief Returns the index of the batch for a file event type.
+/// @param trig The file event type, one of `LCTRIG_*`
+/// @return The index into `lcmdbatches_s::pending`
+static int lcmdbatchidx(const int trig) {
+  int i = 0;
+  while (i < LCBATCHES - 1 && !(trig & (1 << i))) i++;
+  return i;
+}
+
+/// @brief Adds the file \p node to the pending batch of the command set for
+/// the file event type. If the file path would exceed the configured byte size
+/// of the batch, the batch is detached first. If the batch reaches its
+/// configured file count, byte size or age, it is detached. Detached batches
+/// are run by the calling thread.
+/// @param s The command set
+/// @param node The file node to add
+/// @param fds The file descriptor set to use for stdout/stderr redirection
+/// @param flags The file event type and command execution bit flags
+/// @return 0 if successful, otherwise -1 to indicate an error.
+static int lcmdbatchadd(struct lcmdset_s* s, struct inode_s* node,
+                        const struct fdset_s* fds, const int flags) {
+  const int trig = flags & LCTRIG_ALL;
+  const size_t bytes = strlen(node->fp) + 1;
+  struct lcmdbatch_s full[2] = {0};
+  int nfull = 0;
+  int ret = 0;
+
+  pthread_mutex_lock(&s->batch.lock);
+  struct lcmdbatch_s* b = &s->batch.pending[lcmdbatchidx(trig)];
+  if (b->len > 0 && b->bytes + bytes > s->batch.bytes) {
+    full[nfull++] = *b;
+    *b = (struct lcmdbatch_s){0};
+  }
+  if (b->len == b->cap) {
+    const int cap = b->cap > 0 ? b->cap * 2 : 16;
+    struct inode_s** r;
+    if ((r = realloc(b->nodes, cap * sizeof(*r))) == NULL) {
+      ret = -1;
+      goto unlock;
+    }
+    b->nodes = r, b->cap = cap;
+  }
+  const uint64_t now = tmnow();
+  if (b->len == 0) b->since = now;
+  b->nodes[b->len++] = node;
+  b->bytes += bytes;
+  if (b->len >= s->batch.count || b->bytes >= s->batch.bytes ||
+      (s->batch.ms > 0 && now - b->since >= s->batch.ms)) {
+    full[nfull++] = *b;
+    *b = (struct lcmdbatch_s){0};
   }
+unlock:
+  pthread_mutex_unlock(&s->batch.lock);
+
+  for (int i = 0; i < nfull; i++)
+    if (lcmdbatchrun(s, &full[i], trig, fds, flags)) ret = -1;
+  return ret;
 }
 
-int lcmdexec(struct lcmdset_s** cs, const struct inode_s* node,
-             const struct fdset_s* fds, int flags) {
+int lcmdexec(struct lcmdset_s** cs, struct inode_s* node,
+             struct fdset_s* fds, int flags) {
   int ret = 0;
+  bool ran = false;
+
+  // match the file patterns of all command sets at once, unless the match
+  // mask was already computed by the file filter
+  const uint64_t mask = node->flags & INODE_MASK
+                                ? node->mask
+                                : lcmdmatchmask(cs, node->fp);
   for (size_t i = 0; cs != NULL && cs[i] != NULL; i++) {
     struct lcmdset_s* s = cs[i];
     if (!(s->onflags & flags)) {
@@ -301,7 +1232,7 @@ int lcmdexec(struct lcmdset_s** cs, const struct inode_s* node,
         log_info("cmdset %zu ignored flags: 0x%02X", i, flags);
       continue;
     }
-    if (!lcmdmatch(s->fpatterns, node->fp)) {
+    if (!lcmdmatchset(cs, i, mask, node->fp)) {
       if (flags & LCTOPT_TRACE)
         log_info("cmdset %zu ignored filepath: %s", i, node->fp);
       continue;
@@ -312,10 +1243,78 @@ int lcmdexec(struct lcmdset_s** cs, const struct inode_s* node,
       continue;// skip executing commands
     }
 
+    if (s->plugin != NULL) {
+      ran = true;
+      if ((ret = lcmdinvokeplugin(s, node, fds, flags))) break;
+    }
+
+    if (s->batch.count > 0) {
+      if ((ret = lcmdbatchadd(s, node, fds, flags))) break;
+      continue;
+    }
+
     // invoke all system commands
-    for (size_t j = 0; s->syscmds[j] != NULL; j++)
-      if ((ret = lcmdinvoke(s->syscmds[j], node, fds, flags, &s->msspent)))
-        break;
+    ran = true;
+    for (size_t j = 0; s->syscmds[j] != NULL; j++) {
+      if (s->coprocid >= 0) {
+        ret = lcmdinvokecoproc(s, j, node, fds, flags);
+      } else {
+        ret = lcmdinvoke(s->syscmds[j], s->argvs ? s->argvs[j] : NULL, node,
+                         s->searchdir, fds, flags, &s->msspent);
+      }
+      if (ret) break;
+    }
+  }
+  if (ran && (flags & (LCTRIG_NEW | LCTRIG_MOD))) lcmdrestat(node);
+  return ret;
+}
+
+int lcmdflush(struct lcmdset_s** cs, const struct fdset_s* fds,
+              const int flags) {
+  int ret = 0;
+  for (size_t i = 0; cs != NULL && cs[i] != NULL; i++) {
+    struct lcmdset_s* s = cs[i];
+    if (s->batch.count == 0) continue;
+    for (int j = 0; j < LCBATCHES; j++) {
+      pthread_mutex_lock(&s->batch.lock);
+      struct lcmdbatch_s b = s->batch.pending[j];
+      s->batch.pending[j] = (struct lcmdbatch_s){0};
+      pthread_mutex_unlock(&s->batch.lock);
+      if (b.len == 0) {
+        free(b.nodes);
+        continue;
+      }
+      int err;
+      if ((err = lcmdbatchrun(s, &b, 1 << j, fds, flags))) ret = err;
+    }
   }
   return ret;
 }
+
+bool lcmdpending(struct lcmdset_s** cs) {
+  bool pending = false;
+  for (size_t i = 0; cs != NULL && cs[i] != NULL && !pending; i++) {
+    struct lcmdset_s* s = cs[i];
+    if (s->batch.count == 0) continue;
+    pthread_mutex_lock(&s->batch.lock);
+    for (int j = 0; j < LCBATCHES; j++) pending |= s->batch.pending[j].len > 0;
+    pthread_mutex_unlock(&s->batch.lock);
+  }
+  return pending;
+}
+
+void lcmdidle(struct fdset_s* fds) {
+  for (int i = 0; i < fds->nplugctxs; i++)
+    if (fds->plugctxs[i].dirty) lcmdflushplugin(&fds->plugctxs[i], false);
+}
+
+void lcmdrelease(struct fdset_s* fds) {
+  for (int i = 0; i < fds->ncoprocs; i++) coprocstop(&fds->coprocs[i]);
+  free(fds->coprocs);
+  fds->coprocs = NULL, fds->ncoprocs = 0;
+  for (int i = 0; i < fds->nplugctxs; i++)
+    if (fds->plugctxs[i].plugin != NULL)
+      lcmdflushplugin(&fds->plugctxs[i], true);
+  free(fds->plugctxs);
+  fds->plugctxs = NULL, fds->nplugctxs = 0;
+}
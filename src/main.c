@@ -2,7 +2,10 @@
 /// @brief Main program entry point.
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,26 +18,42 @@
 #include "index.h"
 #include "lcmd.h"
 #include "log.h"
+#include "mre.h"
 #include "prog.h"
+#include "tm.h"
 #include "tp.h"
+#include "watch.h"
 
 /// @brief Managed initialization arguments for the program.
 static struct {
+  char* changelog;  ///< Changed paths file path, or `-` for stdin (-C)
   char* configfile; ///< Configuration file path (-c)
+  _Bool dirskip;    ///< Skip listing unchanged directories (-d)
+  int restat;       ///< Re-stat skipped directory files every n runs (-d)
+  _Bool binindex;   ///< Write the file index in binary format (-f)
+  _Bool digest;     ///< Detect modified files by their content digest (-H)
   char* indexfile;  ///< Index file path (-i)
   char* lockfile;   ///< Exclusive lock file path (-x)
   char* searchdir;  ///< Search directory root (-s)
   char* tracefile;  ///< Trace file path (-r)
   _Bool pipefiles;  ///< Pipe subprocess stdout/stderr to files (-p)
+  _Bool postdirs;   ///< Only re-list directories changed by commands (-P)
   _Bool includejunk;///< Include ignored files in index (-j)
   _Bool listspent;  ///< List time spent for each command set (-l)
+  _Bool mergediff;  ///< Diff using a sorted merge pass (-m)
   _Bool skipproc;   ///< Skip processing files, only update file index (-u)
+  _Bool uring;      ///< Stat files in batches using io_uring (-U)
   int threads;      ///< Number of worker threads (-t)
+  int queuedepth;   ///< Maximum number of queued work requests (-Q)
+  int scanthreads;  ///< Number of directory scan threads (-T)
   _Bool verbose;    ///< Enable verbose output (-v)
+  _Bool watch;      ///< Watch for changes after the initial search (-w)
+  int flushsecs;    ///< Write the watched index every n seconds (-w)
 } initargs;
 
 /// @brief Frees all duplicated initialization arguments.
 static void freeinitargs(void) {
+  free(initargs.changelog);
   free(initargs.configfile);
   free(initargs.tracefile);
   free(initargs.lockfile);
@@ -44,8 +63,13 @@ static void freeinitargs(void) {
 
 static struct lcmdset_s** cmdsets; ///< Command sets loaded from configuration
 
+/// @brief The mask of the command sets triggered by each combination of file
+/// event types, see `lcmdsubscribers`.
+static uint64_t subscribers[LCTRIG_ALL + 1];
+
 static struct index_s lastmap; ///< Stored index from previous run (if any)
 static struct index_s thismap; ///< Live checked index from this run
+static bool indexdirty;        ///< Files changed since the index was written
 
 static struct flock_s worklock; ///< Exclusive work lock for local directory
 
@@ -87,28 +111,67 @@ static void freeall(void) {
 /// option is provided.
 static int parseinitargs(const int argc, char** const argv) {
   int c;
-  while ((c = getopt(argc, argv, ":hc:i:jlps:t:r:uvx:")) != -1) {
+  const char* optstr = ":hc:C:d:f:Hi:jlmpPQ:s:t:T:r:uUvw:x:";
+  while ((c = getopt(argc, argv, optstr)) != -1) {
     switch (c) {
       case 'h':
         printf("Usage: %s -i <file>\n"
                "\n"
                "Options:\n"
                "  -c <file>   Configuration file (default: `fsautoproc.json`)\n"
+               "  -C <file>   Read changed paths from file (`-`: stdin) "
+               "instead of scanning\n"
+               "  -d <#>      Skip unchanged directories, re-stat their files "
+               "every # runs (0: never)\n"
+               "  -f <fmt>    File index write format, `text` or `bin` "
+               "(default: `text`)\n"
+               "  -H          Detect modified files by their content digest\n"
                "  -i <file>   File index write path\n"
                "  -j          Enable including ignored files in index\n"
                "  -l          List time spent for each command set\n"
+               "  -m          Diff using a sorted merge with the file index\n"
                "  -p          Pipe subprocess stdout/stderr to files\n"
+               "  -P          Only re-list directories changed by commands "
+               "after processing\n"
+               "  -Q <#>      Maximum number of queued commands "
+               "(default: 256)\n"
                "  -s <dir>    Search directory root (default: `.`)\n"
                "  -t <#>      Number of worker threads (default: 4)\n"
+               "  -T <#>      Number of directory scan threads (default: 1)\n"
                "  -r <file>   Trace which command sets match the file\n"
                "  -u          Skip processing files, only update file index\n"
+               "  -U          Stat files in batches using io_uring (Linux)\n"
                "  -v          Enable verbose output\n"
+               "  -w <#>      Watch for changes after scanning, writing the "
+               "index every # seconds\n"
                "  -x <file>   Exclusive lock file path\n",
                argv[0]);
         exit(0);
       case 'c':
         strdupoptarg(initargs.configfile);
         break;
+      case 'C':
+        strdupoptarg(initargs.changelog);
+        break;
+      case 'd':
+        initargs.dirskip = true;
+        initargs.restat = (int) strtol(optarg, NULL, 10);
+        if (initargs.restat < 0) {
+          log_error("invalid re-stat interval: %s", optarg);
+          return 1;
+        }
+        break;
+      case 'f':
+        if (strcmp(optarg, "bin") == 0) {
+          initargs.binindex = true;
+        } else if (strcmp(optarg, "text") != 0) {
+          log_error("unknown index format: %s", optarg);
+          return 1;
+        }
+        break;
+      case 'H':
+        initargs.digest = true;
+        break;
       case 'i':
         strdupoptarg(initargs.indexfile);
         break;
@@ -118,24 +181,51 @@ static int parseinitargs(const int argc, char** const argv) {
       case 'l':
         initargs.listspent = true;
         break;
+      case 'm':
+        initargs.mergediff = true;
+        break;
       case 'p':
         initargs.pipefiles = true;
         break;
+      case 'P':
+        initargs.postdirs = true;
+        break;
+      case 'Q':
+        initargs.queuedepth = (int) strtol(optarg, NULL, 10);
+        if (initargs.queuedepth <= 0) {
+          log_error("invalid queue depth: %s", optarg);
+          return 1;
+        }
+        break;
       case 's':
         strdupoptarg(initargs.searchdir);
         break;
       case 't':
         initargs.threads = (int) strtol(optarg, NULL, 10);
         break;
+      case 'T':
+        initargs.scanthreads = (int) strtol(optarg, NULL, 10);
+        break;
       case 'r':
         strdupoptarg(initargs.tracefile);
         break;
       case 'u':
         initargs.skipproc = true;
         break;
+      case 'U':
+        initargs.uring = true;
+        break;
       case 'v':
         initargs.verbose = true;
         break;
+      case 'w':
+        initargs.watch = true;
+        initargs.flushsecs = (int) strtol(optarg, NULL, 10);
+        if (initargs.flushsecs < 0) {
+          log_error("invalid index write interval: %s", optarg);
+          return 1;
+        }
+        break;
       case 'x':
         strdupoptarg(initargs.lockfile);
         break;
@@ -171,6 +261,8 @@ static int parseinitargs(const int argc, char** const argv) {
   }
 
   if (initargs.threads == 0) initargs.threads = 4;
+  if (initargs.queuedepth == 0) initargs.queuedepth = 256;
+  if (initargs.scanthreads <= 0) initargs.scanthreads = 1;
 
   return 0;
 }
@@ -188,28 +280,81 @@ static int loadindex(struct index_s* idx, const char* fp) {
   return err;
 }
 
-/// @brief Writes the index to the specified file path.
+/// @brief Writes the index to the specified file path, using the binary format
+/// if the `binindex` flag is set, otherwise the text format. The index is
+/// written to a temporary file which then replaces \p fp, since the previous
+/// index may still be memory mapped from \p fp and must not be truncated.
 /// @param idx The index to write
 /// @param fp The file path to save the index to
 /// @return 0 if successful, otherwise a non-zero error code.
 static int writeindex(struct index_s* idx, const char* fp) {
-  FILE* s = fopen(fp, "w");
-  if (s == NULL) return -1;
-  const int err = indexwrite(idx, s);
-  fclose(s);
+  const size_t len = strlen(fp) + sizeof(".tmp");
+  char* tmp;
+  if ((tmp = malloc(len)) == NULL) return -1;
+  snprintf(tmp, len, "%s.tmp", fp);
+  FILE* s = fopen(tmp, "w");
+  if (s == NULL) {
+    free(tmp);
+    return -1;
+  }
+  int err = initargs.binindex ? indexwritebin(idx, s) : indexwrite(idx, s);
+  if (fclose(s)) err = -1;
+  if (!err && rename(tmp, fp)) err = -1;
+  if (err) unlink(tmp);
+  free(tmp);
   return err;
 }
 
 /// @brief Filters out junk files from the index based on loaded command sets
 /// \p cmdsets and the \p initargs.includejunk flag/program option.
 /// @param fp The file path to filter
+/// @param mask Set to the mask of the command sets matching the file, see
+/// `lcmdmatchmask`
 /// @return True if the file is considered junk, otherwise false.
-static bool filterjunk(const char* fp) {
-  const bool junk = !initargs.includejunk && !lcmdmatchany(cmdsets, fp);
+static bool filterjunk(const char* fp, uint64_t* mask) {
+  *mask = lcmdmatchmask(cmdsets, fp);
+  const bool junk = !initargs.includejunk && *mask == 0;
   if (junk && initargs.verbose) log_info("[j] %s", fp);
   return junk;
 }
 
+/// @brief Filters out directories which match the prune patterns of the loaded
+/// command sets \p cmdsets, so their subtrees are not searched or watched.
+/// Pruned directories are only logged once, not again by the post stage.
+/// @param dir The directory path to filter
+/// @param post True if called by the post stage of the search
+/// @return True if the directory is pruned, otherwise false.
+static bool filterprune(const char* dir, const bool post) {
+  const bool prune = lcmdprune(cmdsets, dir, 0);
+  if (prune && !post && initargs.verbose) log_info("[p] %s", dir);
+  return prune;
+}
+
+/// @brief Prune filter of the change notification watches, see `filterprune`.
+/// @param dir The directory path to filter
+/// @return True if the directory is pruned, otherwise false.
+static bool watchprune(const char* dir) {
+  return filterprune(dir, false);
+}
+
+/// @brief Queues the pending batches of batched command sets to run, without
+/// waiting for them.
+static void flushbatches(void) {
+  if (initargs.skipproc || !lcmdpending(cmdsets)) return;
+  const int flags = initargs.verbose ? LCTOPT_VERBOSE : 0;
+  const struct tpreq_s req = {cmdsets, NULL, flags};
+  int err;
+  if ((err = tpqueue(&req))) log_error("error queueing batches: %d", err);
+}
+
+/// @brief Waits for all queued commands to finish, including the pending
+/// batches of batched command sets.
+static void waitcommands(void) {
+  tpwait();
+  flushbatches();
+  tpwait();
+}
+
 /// @brief Callback function passed to the diff engine to handle progress
 /// notifications. This function will print a progress bar to the console when
 /// a directory is completed, and block between stage completions to ensure all
@@ -221,19 +366,22 @@ static void onnotify(const enum deng_notif_t notif) {
       printprogbar(thismap.size, lastmap.size);
       break;
     case DENG_NOTIF_STAGE_DONE:
-      tpwait(); /* wait for all queued commands to finish */
+      waitcommands(); /* wait for all queued commands to finish */
       break;
   }
 }
 
 /// @brief Queues command execution for a file event of the specified type,
 /// using the provided inode for the file information. If the `skipproc` flag
-/// is set, the command execution is skipped. If the `verbose` flag is set, the
-/// command execution is done with verbose output.
+/// is set, or the match mask of the inode shows that no command set matching
+/// the file is triggered by the event, the command execution is skipped. If
+/// the `verbose` flag is set, the command execution is done with verbose
+/// output.
 /// @param in The inode for the file event
 /// @param trig The file event type
 static void trigfileevent(struct inode_s* in, const int trig) {
   if (initargs.skipproc) return;
+  if ((in->flags & INODE_MASK) && !(in->mask & subscribers[trig])) return;
   const int flags = trig | (initargs.verbose ? LCTOPT_VERBOSE : 0);
   const struct tpreq_s req = {cmdsets, in, flags};
   int err;
@@ -247,6 +395,7 @@ static void trigfileevent(struct inode_s* in, const int trig) {
 /// @param in The inode for the new file
 static void onnew(struct inode_s* in) {
   log_info("[+] %s", in->fp);
+  indexdirty = true;
   trigfileevent(in, LCTRIG_NEW);
 }
 
@@ -256,6 +405,7 @@ static void onnew(struct inode_s* in) {
 /// @param in The inode for the deleted file
 static void ondel(struct inode_s* in) {
   log_info("[-] %s", in->fp);
+  indexdirty = true;
   trigfileevent(in, LCTRIG_DEL);
 }
 
@@ -265,6 +415,7 @@ static void ondel(struct inode_s* in) {
 /// @param in The inode for the modified file
 static void onmod(struct inode_s* in) {
   log_info("[*] %s", in->fp);
+  indexdirty = true;
   trigfileevent(in, LCTRIG_MOD);
 }
 
@@ -276,9 +427,54 @@ static void onnop(struct inode_s* in) {
   trigfileevent(in, LCTRIG_NOP);
 }
 
+/// @brief File event hook functions passed to the diff engine.
+static const struct deng_hooks_s hooks = {onnotify, onnew, ondel, onmod, onnop};
+
+/// @brief Entries skipped by the diff engine, reported in verbose mode.
+static struct deng_stats_s searchstats;
+
+/// @brief Builds the diff engine search options from the initialization
+/// arguments. The prune filter is only set if any command set has prune
+/// patterns.
+/// @return The search options.
+static struct deng_opts_s searchopts(void) {
+  int flags = 0;
+  if (initargs.mergediff) flags |= DENG_OPT_MERGE;
+  if (initargs.dirskip) flags |= DENG_OPT_DIRSKIP;
+  if (initargs.uring) flags |= DENG_OPT_URING;
+  if (initargs.postdirs) flags |= DENG_OPT_POSTDIRS;
+  if (initargs.digest) flags |= DENG_OPT_DIGEST;
+  return (struct deng_opts_s){flags, (unsigned int) initargs.restat,
+                              initargs.scanthreads,
+                              lcmdhasprune(cmdsets) ? filterprune : NULL,
+                              &searchstats};
+}
+
+/// @brief Updates the index from the previously saved index and the changed
+/// paths read from the `changelog` file, or stdin if it is `-`, instead of
+/// scanning the search directory.
+/// @param opts The search options
+/// @return 0 if successful, otherwise a non-zero error code.
+static int ingestchanges(const struct deng_opts_s* opts) {
+  const bool usestdin = strcmp(initargs.changelog, "-") == 0;
+  FILE* s = usestdin ? stdin : fopen(initargs.changelog, "r");
+  if (s == NULL) {
+    log_error("error reading `%s`: %s", initargs.changelog, strerror(errno));
+    return -1;
+  }
+  const int err = dengchanges(initargs.searchdir, s, filterjunk, &hooks,
+                              &lastmap, &thismap, opts);
+  if (!usestdin) fclose(s);
+  return err;
+}
+
 /// @brief Compares the current file system state with a previously saved index.
+/// If changed paths are provided and a previous index exists, only the changed
+/// paths are compared.
 /// @return 0 if successful, otherwise a non-zero error code.
 static int cmpchanges(void) {
+  // match masks stored in the index are discarded if the patterns changed
+  lastmap.maskhash = thismap.maskhash = lcmdmaskhash(cmdsets);
   if (loadindex(&lastmap, initargs.indexfile)) {
     // continue if the index file does not exist
     if (errno != ENOENT) {
@@ -287,34 +483,239 @@ static int cmpchanges(void) {
     }
   }
 
-  const struct deng_hooks_s hooks = {onnotify, onnew, ondel, onmod, onnop};
+  const struct deng_opts_s opts = searchopts();
 
   int err;
-  if ((err = dengsearch(initargs.searchdir, filterjunk, &hooks, &lastmap,
-                        &thismap))) {
-    log_error("error processing directory `%s`: %d", initargs.searchdir, err);
+  if (initargs.changelog != NULL && lastmap.size > 0) {
+    if ((err = ingestchanges(&opts))) {
+      log_error("error processing changed paths `%s`: %d", initargs.changelog,
+                err);
+      return -1;
+    }
+  } else {
+    if (initargs.changelog != NULL)
+      log_error("no index to apply changed paths to, scanning `%s`",
+                initargs.searchdir);
+    if ((err = dengsearch(initargs.searchdir, filterjunk, &hooks, &lastmap,
+                          &thismap, &opts))) {
+      log_error("error processing directory `%s`: %d", initargs.searchdir,
+                err);
+      return -1;
+    }
+  }
+
+  log_info("compared %ld files", thismap.size - thismap.dirs);
+  if (initargs.verbose)
+    log_info("pruned %ld directories, ignored %ld files", searchstats.pruned,
+             searchstats.ignored);
+  if (initargs.verbose && initargs.digest)
+    log_info("digested %ld files, %ld changed files have the same content",
+             searchstats.digests, searchstats.touched);
+
+  if (writeindex(&thismap, initargs.indexfile)) {
+    log_error("error writing `%s`: %s", initargs.indexfile, strerror(errno));
     return -1;
   }
+  indexdirty = false;
+
+  return 0;
+}
+
+static volatile sig_atomic_t stopwatch; ///< Watch mode stop request flag
+
+/// @brief Signal handler which requests watch mode to stop.
+/// @param sig The caught signal number
+static void onstop(const int sig) {
+  (void) sig;
+  stopwatch = 1;
+}
+
+/// @brief Blocks SIGINT and SIGTERM in the calling thread, which is inherited
+/// by the threads it creates afterwards, or installs `onstop` as their handler
+/// and unblocks them. Blocking the signals in the worker threads ensures they
+/// are delivered to the main thread and interrupt waiting for changes.
+/// @param block True to block the signals, false to handle them
+static void stopsignals(const bool block) {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  if (!block) {
+    struct sigaction sa = {0};
+    sa.sa_handler = onstop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+  }
+  pthread_sigmask(block ? SIG_BLOCK : SIG_UNBLOCK, &set, NULL);
+}
+
+/// @brief Callback function for change notifications in watch mode. The
+/// changed path is reconciled with the live index, which may trigger new,
+/// modified, and deleted file events.
+/// @param fp The changed file or directory path
+/// @param udata The search options
+/// @return 0 in all cases, errors are logged and the path is skipped.
+static int onchange(const char* fp, void* udata) {
+  if (dengsync(fp, filterjunk, &hooks, &thismap, udata))
+    log_error("error processing `%s`: %s", fp, strerror(errno));
+  return 0;
+}
+
+/// @brief Rescans the search directory after change notifications were lost,
+/// using the live index as the previous index state. Directories whose
+/// modified time is unchanged since they were indexed are not listed, so only
+/// the directories affected by the lost changes are read. Their files are
+/// re-stat'ed every time unless an interval is set with `-d`.
+/// @param opts The search options
+/// @return 0 if successful, otherwise a non-zero error code.
+static int rescan(struct deng_opts_s opts) {
+  log_error("change notifications were lost, rescanning `%s`",
+            initargs.searchdir);
+  // commands queued for the changes read so far use nodes of the live index,
+  // which is searched and replaced by the rescan
+  waitcommands();
+  opts.flags |= DENG_OPT_DIRSKIP;
+  if (!initargs.dirskip) opts.restat = 1;
+
+  struct index_s next = {.maskhash = thismap.maskhash};
+  struct index_s copy = {.maskhash = thismap.maskhash};
+  int err = -1;
+  if (dengsearch(initargs.searchdir, filterjunk, &hooks, &thismap, &next,
+                 &opts)) {
+    log_error("error processing directory `%s`", initargs.searchdir);
+    goto ret;
+  }
 
-  log_info("compared %zu files", thismap.size);
+  // the new index interns filepaths of the previous indexes, so it is copied
+  // before they are freed to avoid retaining each generation of index
+  if (indexcopy(&copy, &next)) goto ret;
+  indexfree(&lastmap);
+  indexfree(&thismap);
+  thismap = copy;
+  copy = (struct index_s){0};
+  indexdirty = true;
+  err = 0;
+ret:
+  indexfree(&next);
+  indexfree(&copy);
+  return err;
+}
 
+/// @brief Writes the live index in watch mode once all queued commands have
+/// finished, since they update the stat info of their file nodes.
+/// @return 0 if successful, otherwise a non-zero error code.
+static int flushindex(void) {
+  waitcommands();
   if (writeindex(&thismap, initargs.indexfile)) {
     log_error("error writing `%s`: %s", initargs.indexfile, strerror(errno));
     return -1;
   }
+  indexdirty = false;
+  return 0;
+}
+
+/// @brief Compares the current file system state with a previously saved index
+/// and then watches the search directory for changes until SIGINT or SIGTERM
+/// is caught. Changed paths are reconciled with the live index and their file
+/// events are queued as they occur. The index is written at most every
+/// `flushsecs` seconds while files are changing, and once more on exit.
+/// @return 0 if successful, otherwise a non-zero error code.
+static int watchchanges(void) {
+  struct watch_s w;
+  if (watchopen(&w)) {
+    log_error("error opening change notifications: %s", strerror(errno));
+    return -1;
+  }
+
+  // watch before the initial search so no change is missed in between, any
+  // change seen by both is reconciled without triggering a second event
+  int err = -1;
+  if (lcmdhasprune(cmdsets)) w.prune = watchprune;
+  if (watchadd(&w, initargs.searchdir)) {
+    log_error("error watching `%s` (is `fs.inotify.max_user_watches` too low?)",
+              initargs.searchdir);
+    goto ret;
+  }
+  if (cmpchanges()) goto ret;
+
+  const struct deng_opts_s opts = searchopts();
+  uint64_t flushat = 0;
+  while (!stopwatch) {
+    int timeout = -1;
+    if (flushat > 0) {
+      const uint64_t now = tmnow();
+      timeout = flushat > now ? (int) (flushat - now) : 0;
+    }
+    const int ready = watchwait(&w, timeout);
+    if (ready < 0 && errno != EINTR) {
+      log_error("error waiting for changes: %s", strerror(errno));
+      goto ret;
+    }
+    if (ready > 0) {
+      // commands queued for earlier changes may still update their nodes
+      tpwait();
+      if (watchread(&w, onchange, (void*) &opts)) {
+        log_error("error reading changes: %s", strerror(errno));
+        goto ret;
+      }
+      flushbatches();// changes are not held back until the next notification
+    }
+    if (w.overflow) {
+      w.overflow = false;
+      if (rescan(opts)) goto ret;
+    }
+    if (indexdirty && flushat == 0)
+      flushat = tmnow() + (uint64_t) initargs.flushsecs * 1000;
+    if (flushat > 0 && tmnow() >= flushat) {
+      if (flushindex()) goto ret;
+      flushat = 0;
+    }
+  }
+  err = indexdirty ? flushindex() : 0;
+ret:
+  watchclose(&w);
+  return err;
+}
 
+/// @brief Traces which command sets prune the parent directories of the
+/// specified path, starting below the search directory if the path is within
+/// it. `lcmdprune` will print the prune decision of each command set.
+/// @param fp The file or directory path to trace
+/// @return 0 if successful, otherwise a non-zero error code.
+static int traceparents(const char* fp) {
+  const size_t sdlen = strlen(initargs.searchdir);
+  size_t off = 1;
+  if (strncmp(fp, initargs.searchdir, sdlen) == 0 && fp[sdlen] == '/')
+    off = sdlen + 1;
+  if (strlen(fp) < off) return 0;
+
+  char* dir;
+  if ((dir = strdup(fp)) == NULL) return -1;
+  for (char* p = strchr(dir + off, '/'); p != NULL; p = strchr(p + 1, '/')) {
+    *p = '\0';
+    lcmdprune(cmdsets, dir, LCTOPT_TRACE);
+    *p = '/';
+  }
+  free(dir);
   return 0;
 }
 
 /// @brief Traces which command sets match the specified file by manually
 /// invoking the command execution logic with a trace flag. `lcmdexec` will
-/// print the command set names that match the file.
-/// @param fp The file path to trace
+/// print the command set names that match the file. The prune decisions for
+/// its parent directories, or the directory itself, are traced first.
+/// @param fp The file or directory path to trace
 /// @return 0 if successful, otherwise a non-zero error code.
 static int tracefile(const char* fp) {
   struct inode_s node = {.fp = (char*) fp};
-  if (fsstat(fp, &node.st)) return -1;
-  const struct fdset_s fds = {.out = STDOUT_FILENO, .err = STDERR_FILENO};
+  bool dir;
+  if (fsstatdir(fp, &node.st, &dir) || traceparents(fp)) return -1;
+  if (dir) {
+    lcmdprune(cmdsets, fp, LCTOPT_TRACE);
+    return 0;
+  }
+  struct fdset_s fds = {.out = STDOUT_FILENO, .err = STDERR_FILENO};
   return lcmdexec(cmdsets, &node, &fds, LCTOPT_TRACE | LCTRIG_ALL);
 }
 
@@ -327,6 +728,36 @@ static void printmsspent(void) {
   }
 }
 
+/// @brief Prints the work queue statistics of the thread pool, and the CPU
+/// time used by its threads (excluding the commands they run), to the console.
+/// The time the search spent blocked on a full queue indicates that more
+/// worker threads could be used, while the time workers spent waiting on an
+/// empty queue indicates that the search could not keep up with them.
+static void printqueuestats(void) {
+  struct tpstats_s s;
+  tpstats(&s);
+  log_info("queued %ld commands, queue high-water %d/%d", s.queued,
+           s.highwater, s.depth);
+  log_info("search blocked %.3fs, workers waited %.3fs", s.pushwaitns / 1e9,
+           s.popwaitns / 1e9);
+  log_info("worker threads used %.3fs of CPU time", s.cpuns / 1e9);
+}
+
+/// @brief Prints how many file paths were matched against the file patterns of
+/// the command sets, and how many matches were reused from the index instead,
+/// to the console. Of the patterns matched by `regexec` rather than the
+/// combined matcher, the share skipped by their literal prefilter is printed.
+static void printmatchstats(void) {
+  struct mrestats_s s;
+  lcmdmatchstats(cmdsets, &s);
+  log_info("matched %ld paths, reused %ld matches from the index", s.strings,
+           searchstats.reused);
+  const long execs = s.regexecs + s.skipped;
+  if (execs > 0)
+    log_info("prefilter skipped %ld of %ld regexec calls (%.1f%%)", s.skipped,
+             execs, 100.0 * s.skipped / execs);
+}
+
 /// @brief Main program entry point.
 /// @param argc The number of arguments
 /// @param argv The argument array
@@ -349,16 +780,20 @@ int main(int argc, char** argv) {
 
   // init worker thread pool
   const int tpflags = initargs.pipefiles ? TPOPT_LOGFILES : 0;
-  if ((err = tpinit(initargs.threads, tpflags))) {
+  if (initargs.watch) stopsignals(true);
+  if ((err = tpinit(initargs.threads, initargs.queuedepth, tpflags))) {
     log_error("error initializing thread pool: %d", err);
     return 1;
   }
+  if (initargs.watch) stopsignals(false);
 
   // load configuration file
-  if ((cmdsets = lcmdparse(initargs.configfile)) == NULL) {
+  if ((cmdsets = lcmdparse(initargs.configfile, initargs.searchdir)) == NULL) {
     log_error("error loading configuration file `%s`", initargs.configfile);
     return 1;
   }
+  for (int trig = 0; trig <= LCTRIG_ALL; trig++)
+    subscribers[trig] = lcmdsubscribers(cmdsets, trig);
 
   if (initargs.tracefile != NULL) {
     // prints which command sets match the file and exits
@@ -367,12 +802,21 @@ int main(int argc, char** argv) {
       return 1;
     }
     return 0;
+  } else if (initargs.watch) {
+    if ((err = watchchanges())) {
+      log_error("error watching changes: %d", err);
+      return 1;
+    }
   } else if ((err = cmpchanges())) {
     log_error("error comparing changes: %d", err);
     return 1;
   }
 
   if (initargs.listspent) printmsspent();
+  if (initargs.verbose) {
+    printqueuestats();
+    printmatchstats();
+  }
 
   return 0;
 }
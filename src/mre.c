@@ -0,0 +1,911 @@
+/// @file mre.c
+/// @brief Matching of many regex patterns against a string in a single pass.
+///
+/// Supported patterns are parsed into a syntax tree, and compiled into a
+/// Thompson NFA whose accepting nodes carry the pattern identifier. The NFA
+/// of all patterns is converted into a DFA over byte classes by subset
+/// construction, where every DFA state also contains the start nodes of all
+/// patterns, so a single pass over a string finds the matches starting at any
+/// offset. Each DFA state holds the mask of identifiers matched once it is
+/// reached, and of identifiers matched if the string ends in it.
+///
+/// Patterns executed by `regexec` are scanned for literal text which every
+/// match contains, i.e. an anchored prefix or suffix, or otherwise the
+/// longest literal run, and are only executed for strings containing it.
+#include "mre.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// @def MRENODES
+/// @brief Maximum number of NFA nodes of all patterns, patterns exceeding it
+/// are executed by `regexec`
+#define MRENODES 8192
+
+/// @def MRESTATES
+/// @brief Maximum number of DFA states, all patterns are executed by `regexec`
+/// if the DFA exceeds it
+#define MRESTATES 2048
+
+/// @def MREDUPMAX
+/// @brief Maximum bound of an interval expression, as `RE_DUP_MAX`
+#define MREDUPMAX 255
+
+/// @enum mreast_t
+/// @brief Syntax tree node types
+enum mreast_t {
+  MA_SET, ///< A byte of `set`
+  MA_CAT, ///< `a` followed by `b`
+  MA_ALT, ///< `a` or `b`
+  MA_REP, ///< `a` repeated `min` to `max` times
+  MA_BOL, ///< Beginning of the string, `^`
+  MA_EOL, ///< End of the string, `$`
+};
+
+/// @struct mreast_s
+/// @brief Syntax tree node
+struct mreast_s {
+  enum mreast_t type; ///< Node type
+  int a, b;           ///< Child node indices
+  int min, max;       ///< Repetition bounds of `MA_REP`, `max` -1 if unbounded
+  uint8_t set[32];    ///< Byte bitmap of `MA_SET`
+};
+
+/// @struct mreparse_s
+/// @brief Pattern parser state
+struct mreparse_s {
+  const char* p;        ///< Current position in the pattern
+  struct mreast_s* ast; ///< Syntax tree nodes
+  int len;              ///< Number of nodes in `ast`
+  int cap;              ///< Allocated capacity of `ast`
+  int depth;            ///< Number of enclosing groups
+  bool first;           ///< The atom starts its concatenation
+};
+
+/// @enum mrenode_t
+/// @brief NFA node types
+enum mrenode_t {
+  MN_SET,   ///< Consumes a byte of `set` and continues at `out`
+  MN_SPLIT, ///< Continues at both `out` and `out1`
+  MN_BOL,   ///< Continues at `out` at the beginning of the string
+  MN_EOL,   ///< Continues at `out` at the end of the string
+  MN_MATCH, ///< Pattern `id` matched
+};
+
+/// @struct mrenode_s
+/// @brief NFA node
+struct mrenode_s {
+  enum mrenode_t type; ///< Node type
+  int out, out1;       ///< Next node indices
+  int id;              ///< Pattern identifier of `MN_MATCH`
+  uint8_t set[32];     ///< Byte bitmap of `MN_SET`
+};
+
+/// @struct mrelits_s
+/// @brief Literal text which every match of a pattern contains, used to skip
+/// executing the pattern by `regexec`.
+struct mrelits_s {
+  char* pre;     ///< Prefix of matched strings if anchored by `^`, or NULL
+  char* suf;     ///< Suffix of matched strings if anchored by `$`, or NULL
+  char* mid;     ///< Substring of matched strings without `pre` or `suf`
+  size_t prelen; ///< Length of `pre`
+  size_t suflen; ///< Length of `suf`
+};
+
+/// @struct mrepat_s
+/// @brief An added pattern
+struct mrepat_s {
+  const regex_t* reg;    ///< Compiled pattern
+  int id;                ///< Pattern identifier
+  int start;             ///< NFA start node, or -1 if executed by `regexec`
+  struct mrelits_s lits; ///< Required literals if executed by `regexec`
+};
+
+struct mre_s {
+  struct mrepat_s* pats;   ///< Added patterns
+  int npats;               ///< Number of patterns in `pats`
+  int cappats;             ///< Allocated capacity of `pats`
+  struct mrenode_s* nfa;   ///< NFA nodes of all patterns, freed once built
+  int nnfa;                ///< Number of nodes in `nfa`
+  int capnfa;              ///< Allocated capacity of `nfa`
+  bool dfa;                ///< The DFA is built and used
+  int ncls;                ///< Number of byte classes
+  uint8_t cls[256];        ///< Byte class of each byte
+  int32_t* trans;          ///< Next state of each state and byte class
+  uint64_t* now;           ///< Identifiers matched on reaching each state
+  uint64_t* end;           ///< Identifiers matched if the string ends there
+  uint64_t fallback;       ///< Identifiers of patterns executed by `regexec`
+  uint64_t hash;           ///< FNV-1a hash of all added patterns and identifiers
+  struct mrestats_s stats; ///< Match counters, updated atomically
+};
+
+/// @brief Sets bit \p b of byte bitmap \p set.
+static void mresetbit(uint8_t* set, const int b) {
+  set[b >> 3] |= (uint8_t) (1 << (b & 7));
+}
+
+/// @brief Returns bit \p b of byte bitmap \p set.
+static bool mrebit(const uint8_t* set, const int b) {
+  return set[b >> 3] & (1 << (b & 7));
+}
+
+/// @brief Appends a syntax tree node.
+/// @param ps The parser state
+/// @param type The node type
+/// @return The node index, otherwise -1 if the tree is too large or memory
+/// allocation failed.
+static int mreastnew(struct mreparse_s* ps, const enum mreast_t type) {
+  if (ps->len == ps->cap) {
+    if (ps->cap >= MRENODES) return -1;
+    const int cap = ps->cap > 0 ? ps->cap * 2 : 16;
+    struct mreast_s* r;
+    if ((r = realloc(ps->ast, cap * sizeof(*r))) == NULL) return -1;
+    ps->ast = r, ps->cap = cap;
+  }
+  ps->ast[ps->len] = (struct mreast_s){.type = type};
+  return ps->len++;
+}
+
+/// @brief Adds the bytes of a character class, e.g. `alpha`, to a bitmap.
+/// @param name The class name, not NUL terminated
+/// @param len The length of \p name
+/// @param set The byte bitmap
+/// @return 0 if successful, otherwise -1 if the class is unknown.
+static int mreclass(const char* name, const size_t len, uint8_t* set) {
+  static const struct {
+    const char* name;
+    int (*fn)(int);
+  } classes[] = {
+          {"alpha", isalpha}, {"digit", isdigit}, {"alnum", isalnum},
+          {"upper", isupper}, {"lower", islower}, {"space", isspace},
+          {"blank", isblank}, {"punct", ispunct}, {"print", isprint},
+          {"graph", isgraph}, {"cntrl", iscntrl}, {"xdigit", isxdigit},
+  };
+  for (size_t i = 0; i < sizeof(classes) / sizeof(*classes); i++) {
+    if (strlen(classes[i].name) != len || memcmp(classes[i].name, name, len))
+      continue;
+    for (int b = 1; b < 256; b++)
+      if (classes[i].fn(b)) mresetbit(set, b);
+    return 0;
+  }
+  return -1;
+}
+
+/// @brief Parses a bracket expression following its `[`.
+/// @param ps The parser state
+/// @param set The byte bitmap to populate
+/// @return 0 if successful, otherwise -1 if the expression is unsupported.
+static int mreparsebracket(struct mreparse_s* ps, uint8_t* set) {
+  const bool neg = *ps->p == '^';
+  if (neg) ps->p++;
+  for (bool first = true;; first = false) {
+    const unsigned char c = *ps->p;
+    if (c == '\0' || c == '\\') return -1;// escapes differ by platform
+    if (c == ']' && !first) break;
+    if (c == '[' && ps->p[1] == ':') {
+      const char* name = ps->p + 2;
+      const char* end;
+      if ((end = strstr(name, ":]")) == NULL) return -1;
+      if (mreclass(name, end - name, set)) return -1;
+      ps->p = end + 2;
+      continue;
+    }
+    if (c == '[' && (ps->p[1] == '.' || ps->p[1] == '=')) return -1;
+    if (c == '-' && !first && ps->p[1] != ']') return -1;
+
+    unsigned char hi = c;
+    if (ps->p[1] == '-' && ps->p[2] != ']' && ps->p[2] != '\0') {
+      hi = ps->p[2];
+      if (hi < c || hi == '[' || hi == '\\') return -1;
+      ps->p += 3;
+    } else {
+      ps->p++;
+    }
+    for (int b = c; b <= hi; b++) mresetbit(set, b);
+  }
+  ps->p++;
+  if (neg)
+    for (int i = 0; i < 32; i++) set[i] = ~set[i];
+  set[0] &= ~1;// NUL terminates the string
+  return 0;
+}
+
+static int mreparsealt(struct mreparse_s* ps);
+
+/// @brief Parses an atom: a group, anchor, bracket expression, `.`, or an
+/// optionally escaped literal byte.
+/// @param ps The parser state
+/// @return The node index, otherwise -1 if the atom is unsupported.
+static int mreparseatom(struct mreparse_s* ps) {
+  const unsigned char c = *ps->p;
+  int n;
+  switch (c) {
+    case '(':
+      ps->p++, ps->depth++;
+      if (*ps->p == ')' || (n = mreparsealt(ps)) < 0 || *ps->p != ')')
+        return -1;
+      ps->p++, ps->depth--;
+      return n;
+    case '^':
+    case '$':
+      // glibc matches other anchors next to line breaks within the string
+      ps->p++;
+      if (ps->depth > 0) return -1;
+      if (c == '^' && !ps->first) return -1;
+      if (c == '$' && *ps->p != '\0' && *ps->p != '|') return -1;
+      return mreastnew(ps, c == '^' ? MA_BOL : MA_EOL);
+    case '[':
+      ps->p++;
+      if ((n = mreastnew(ps, MA_SET)) < 0) return -1;
+      return mreparsebracket(ps, ps->ast[n].set) ? -1 : n;
+    case '.':
+      ps->p++;
+      if ((n = mreastnew(ps, MA_SET)) < 0) return -1;
+      memset(ps->ast[n].set, 0xFF, sizeof(ps->ast[n].set));
+      ps->ast[n].set[0] &= ~1;
+      return n;
+    case '\0':
+    case ')':
+    case '|':
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+      return -1;
+    default:
+      break;
+  }
+
+  // escaped letters and digits are back-references or GNU extensions
+  unsigned char lit = c;
+  if (c == '\\') {
+    lit = ps->p[1];
+    if (lit == '\0' || isalnum(lit) || lit == '`' || lit == '\'') return -1;
+    ps->p++;
+  }
+  ps->p++;
+  if ((n = mreastnew(ps, MA_SET)) < 0) return -1;
+  mresetbit(ps->ast[n].set, lit);
+  return n;
+}
+
+/// @brief Parses the bounds of an interval expression following its `{`.
+/// @param ps The parser state
+/// @param min Set to the minimum bound
+/// @param max Set to the maximum bound, or -1 if unbounded
+/// @return 0 if successful, otherwise -1 if the interval is unsupported.
+static int mreparseinterval(struct mreparse_s* ps, int* min, int* max) {
+  if (!isdigit((unsigned char) *ps->p)) return -1;
+  char* end;
+  *min = *max = (int) strtol(ps->p, &end, 10);
+  if (*end == ',') {
+    end++;
+    *max = isdigit((unsigned char) *end) ? (int) strtol(end, &end, 10) : -1;
+  }
+  if (*end != '}' || *min > MREDUPMAX || *max > MREDUPMAX ||
+      (*max >= 0 && *max < *min))
+    return -1;
+  ps->p = end + 1;
+  return 0;
+}
+
+/// @brief Parses an atom followed by any number of repetition operators.
+/// Stacked operators repeat the preceding repetition, e.g. `a+?` is `(a+)?`,
+/// except on macOS where patterns are compiled with `REG_ENHANCED`, which
+/// makes them lazy quantifiers, so such patterns are unsupported there.
+/// @param ps The parser state
+/// @return The node index, otherwise -1 if the expression is unsupported.
+static int mreparserep(struct mreparse_s* ps) {
+  int n;
+  if ((n = mreparseatom(ps)) < 0) return -1;
+#ifdef __APPLE__
+  const int atom = n;
+#endif
+  for (;;) {
+    int min, max;
+    switch (*ps->p++) {
+      case '*':
+        min = 0, max = -1;
+        break;
+      case '+':
+        min = 1, max = -1;
+        break;
+      case '?':
+        min = 0, max = 1;
+        break;
+      case '{':
+        if (mreparseinterval(ps, &min, &max)) return -1;
+        break;
+      default:
+        ps->p--;
+        return n;
+    }
+#ifdef __APPLE__
+    if (n != atom) return -1;
+#endif
+    if (ps->ast[n].type == MA_BOL || ps->ast[n].type == MA_EOL) return -1;
+    const int r = mreastnew(ps, MA_REP);
+    if (r < 0) return -1;
+    ps->ast[r].a = n, ps->ast[r].min = min, ps->ast[r].max = max;
+    n = r;
+  }
+}
+
+/// @brief Parses a non-empty concatenation of repetitions.
+/// @param ps The parser state
+/// @return The node index, otherwise -1 if the expression is unsupported.
+static int mreparsecat(struct mreparse_s* ps) {
+  int n = -1;
+  while (*ps->p != '\0' && *ps->p != '|' && *ps->p != ')') {
+    int r, c;
+    ps->first = n < 0;
+    if ((r = mreparserep(ps)) < 0) return -1;
+    if (n < 0) {
+      n = r;
+      continue;
+    }
+    if ((c = mreastnew(ps, MA_CAT)) < 0) return -1;
+    ps->ast[c].a = n, ps->ast[c].b = r;
+    n = c;
+  }
+  return n;
+}
+
+/// @brief Parses alternatives of non-empty concatenations.
+/// @param ps The parser state
+/// @return The node index, otherwise -1 if the expression is unsupported.
+static int mreparsealt(struct mreparse_s* ps) {
+  int n;
+  if ((n = mreparsecat(ps)) < 0) return -1;
+  while (*ps->p == '|') {
+    ps->p++;
+    int r, c;
+    if ((r = mreparsecat(ps)) < 0) return -1;
+    if ((c = mreastnew(ps, MA_ALT)) < 0) return -1;
+    ps->ast[c].a = n, ps->ast[c].b = r;
+    n = c;
+  }
+  return n;
+}
+
+/// @brief Appends an NFA node.
+/// @param m The matcher
+/// @param type The node type
+/// @param out The next node index
+/// @param out1 The alternative next node index of `MN_SPLIT`
+/// @return The node index, otherwise -1 if the NFA is too large or memory
+/// allocation failed.
+static int mrenodenew(struct mre_s* m, const enum mrenode_t type,
+                      const int out, const int out1) {
+  if (out < 0 || out1 < 0 || m->nnfa >= MRENODES) return -1;
+  if (m->nnfa == m->capnfa) {
+    const int cap = m->capnfa > 0 ? m->capnfa * 2 : 64;
+    struct mrenode_s* r;
+    if ((r = realloc(m->nfa, cap * sizeof(*r))) == NULL) return -1;
+    m->nfa = r, m->capnfa = cap;
+  }
+  m->nfa[m->nnfa] = (struct mrenode_s){.type = type, .out = out, .out1 = out1};
+  return m->nnfa++;
+}
+
+/// @brief Emits the NFA nodes of a syntax tree node, continuing at \p next.
+/// @param m The matcher
+/// @param ps The parser state holding the syntax tree
+/// @param n The syntax tree node index
+/// @param next The NFA node to continue at once \p n matched
+/// @return The start node index, otherwise -1 if the NFA is too large.
+static int mreemit(struct mre_s* m, const struct mreparse_s* ps, const int n,
+                   int next) {
+  const struct mreast_s* a = &ps->ast[n];
+  int s, k;
+  switch (a->type) {
+    case MA_SET:
+      if ((k = mrenodenew(m, MN_SET, next, 0)) >= 0)
+        memcpy(m->nfa[k].set, a->set, sizeof(a->set));
+      return k;
+    case MA_CAT:
+      return mreemit(m, ps, a->a, mreemit(m, ps, a->b, next));
+    case MA_ALT:
+      s = mreemit(m, ps, a->a, next);
+      return mrenodenew(m, MN_SPLIT, s, mreemit(m, ps, a->b, next));
+    case MA_BOL:
+      return mrenodenew(m, MN_BOL, next, 0);
+    case MA_EOL:
+      return mrenodenew(m, MN_EOL, next, 0);
+    case MA_REP:
+      break;
+  }
+
+  // optional copies nest as `(a(a)?)?`, an unbounded tail loops as `a*`
+  s = next;
+  if (a->max < 0) {
+    if ((s = k = mrenodenew(m, MN_SPLIT, 0, next)) < 0) return -1;
+    const int body = mreemit(m, ps, a->a, k);// may move `m->nfa`
+    if ((m->nfa[k].out = body) < 0) return -1;
+  }
+  for (int i = a->min; i < a->max; i++)
+    s = mrenodenew(m, MN_SPLIT, mreemit(m, ps, a->a, s), next);
+  for (int i = 0; i < a->min; i++) s = mreemit(m, ps, a->a, s);
+  return s;
+}
+
+/// @brief Skips a bracket expression for scanning literals.
+/// @param p The position following the `[` of the expression
+/// @return The position following the closing `]`, or NULL if unterminated.
+static const char* mreskipbracket(const char* p) {
+  if (*p == '^') p++;
+  if (*p == ']') p++;
+  for (; *p != '\0'; p++) {
+    if (*p == ']') return p + 1;
+    if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+      const char end[] = {p[1], ']', '\0'};
+      if ((p = strstr(p + 2, end)) == NULL) return NULL;
+      p++;
+    }
+  }
+  return NULL;
+}
+
+/// @brief Skips a group for scanning literals.
+/// @param p The position following the `(` of the group
+/// @return The position following the closing `)`, or NULL if unterminated.
+static const char* mreskipgroup(const char* p) {
+  for (int depth = 1; *p != '\0';) {
+    if (*p == '\\') {
+      if (p[1] == '\0') return NULL;
+      p += 2;
+    } else if (*p == '[') {
+      if ((p = mreskipbracket(p + 1)) == NULL) return NULL;
+    } else {
+      if (*p == '(') depth++;
+      if (*p++ == ')' && --depth == 0) return p;
+    }
+  }
+  return NULL;
+}
+
+/// @struct mrescan_s
+/// @brief Literal scanner state
+struct mrescan_s {
+  char* run;              ///< Current run of literal characters
+  size_t len;             ///< Number of characters in `run`
+  bool lead;              ///< `run` starts at the `^` anchor
+  char* best;             ///< Longest run of literal characters
+  size_t bestlen;         ///< Number of characters in `best`
+  struct mrelits_s* lits; ///< The literals to set
+};
+
+/// @brief Ends the current run of literal characters of the scanner.
+/// @param sc The scanner state
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int mreendrun(struct mrescan_s* sc) {
+  if (sc->lead && sc->len > 0) {
+    if ((sc->lits->pre = strndup(sc->run, sc->len)) == NULL) return -1;
+    sc->lits->prelen = sc->len;
+  }
+  if (sc->len > sc->bestlen) {
+    memcpy(sc->best, sc->run, sc->len);
+    sc->bestlen = sc->len;
+  }
+  sc->len = 0;
+  sc->lead = false;
+  return 0;
+}
+
+/// @brief Frees the literals of a pattern.
+/// @param lits The literals to free
+static void mrefreelits(struct mrelits_s* lits) {
+  free(lits->pre);
+  free(lits->suf);
+  free(lits->mid);
+  *lits = (struct mrelits_s){0};
+}
+
+/// @brief Scans the runs of literal characters of a pattern. Runs are split at
+/// every other atom, and characters quantified by `*`, `?`, an interval
+/// expression, or `+` followed by another quantifier are dropped.
+/// @param sc The scanner state
+/// @param p The pattern string, following its `^` anchor if any
+/// @return 0 if successful, 1 if the pattern has no literals since it has a
+/// top-level alternation or is malformed, otherwise -1 and `errno` is set.
+static int mrescanruns(struct mrescan_s* sc, const char* p) {
+  while (*p != '\0') {
+    const char c = *p++;
+    if (c == '\\' && *p != '\0' && strchr(".[]()*+?{}|^$\\", *p)) {
+      sc->run[sc->len++] = *p++;
+      continue;
+    }
+    switch (c) {
+      case '\\':// GNU escapes and back-references
+        if (*p != '\0') p++;
+        break;
+      case '[':
+        if ((p = mreskipbracket(p)) == NULL) return 1;
+        break;
+      case '(':
+        if ((p = mreskipgroup(p)) == NULL) return 1;
+        break;
+      case '|':
+        return 1;
+      case '{':
+        if (strchr(p, '}') != NULL) p = strchr(p, '}') + 1;
+        // fallthrough
+      case '*':
+      case '?':
+        if (sc->len > 0) sc->len--;// the quantified character is optional
+        break;
+      case '$':
+        if (*p == '\0' && sc->len > 0) {
+          if ((sc->lits->suf = strndup(sc->run, sc->len)) == NULL) return -1;
+          sc->lits->suflen = sc->len;
+        }
+        break;
+      case '+': {
+        // a following quantifier other than `+` makes the repeated character
+        // optional, e.g. `b+?` is `(b+)?`
+        const char* q = p + strspn(p, "+");
+        if ((*q == '?' || *q == '*' || *q == '{') && sc->len > 0) sc->len--;
+        break;
+      }
+      case '.':
+      case '^':
+      case ')':
+        break;
+      default:
+        sc->run[sc->len++] = c;
+        continue;
+    }
+    if (mreendrun(sc)) return -1;
+  }
+  return mreendrun(sc);
+}
+
+/// @brief Scans a pattern for literal text which every match contains, see
+/// `mrescanruns`. The longest run is only used if the pattern has no anchored
+/// prefix or suffix.
+/// @param pattern The pattern string
+/// @param lits The literals to set
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int mrescanlits(const char* pattern, struct mrelits_s* lits) {
+  const size_t len = strlen(pattern) + 1;
+  struct mrescan_s sc = {.lead = *pattern == '^', .lits = lits};
+  int ret = -1;
+  if ((sc.run = malloc(len)) != NULL && (sc.best = malloc(len)) != NULL)
+    ret = mrescanruns(&sc, pattern + sc.lead);
+  if (ret == 0 && lits->pre == NULL && lits->suf == NULL && sc.bestlen > 0 &&
+      (lits->mid = strndup(sc.best, sc.bestlen)) == NULL)
+    ret = -1;
+  if (ret != 0) mrefreelits(lits);
+  free(sc.run);
+  free(sc.best);
+  return ret < 0 ? -1 : 0;
+}
+
+/// @brief Checks if \p s contains the literals of a pattern.
+/// @param lits The literals of the pattern
+/// @param s The NUL terminated string
+/// @param len The length of \p s
+/// @return true if the pattern may match \p s, otherwise false.
+static bool mrelitsmatch(const struct mrelits_s* lits, const char* s,
+                         const size_t len) {
+  if (lits->pre != NULL &&
+      (len < lits->prelen || memcmp(s, lits->pre, lits->prelen) != 0))
+    return false;
+  if (lits->suf != NULL &&
+      (len < lits->suflen ||
+       memcmp(s + len - lits->suflen, lits->suf, lits->suflen) != 0))
+    return false;
+  return lits->mid == NULL || strstr(s, lits->mid) != NULL;
+}
+
+struct mre_s* mrenew(void) { return calloc(1, sizeof(struct mre_s)); }
+
+int mreadd(struct mre_s* m, const char* pattern, const regex_t* reg,
+           const int id) {
+  if (m->npats == m->cappats) {
+    const int cap = m->cappats > 0 ? m->cappats * 2 : 8;
+    struct mrepat_s* r;
+    if ((r = realloc(m->pats, cap * sizeof(*r))) == NULL) return -1;
+    m->pats = r, m->cappats = cap;
+  }
+  struct mrepat_s* p = &m->pats[m->npats];
+  *p = (struct mrepat_s){.reg = reg, .id = id, .start = -1};
+  if (mrescanlits(pattern, &p->lits)) return -1;
+  m->npats++;
+  if (m->npats == 1) m->hash = 0xcbf29ce484222325ULL;
+  for (const char* c = pattern;; c++) {
+    m->hash = (m->hash ^ (unsigned char) *c) * 0x100000001b3ULL;
+    if (*c == '\0') break;
+  }
+  m->hash = (m->hash ^ (uint64_t) id) * 0x100000001b3ULL;
+
+  // compile supported patterns into the NFA, dropping partial nodes on error
+  struct mreparse_s ps = {.p = pattern};
+  const int nnfa = m->nnfa;
+  int n;
+  if ((n = mreparsealt(&ps)) >= 0 && *ps.p == '\0') {
+    int match;
+    if ((match = mrenodenew(m, MN_MATCH, 0, 0)) >= 0) {
+      m->nfa[match].id = id;
+      p->start = mreemit(m, &ps, n, match);
+    }
+  }
+  free(ps.ast);
+  if (p->start < 0) {
+    m->nnfa = nnfa;
+    m->fallback |= UINT64_C(1) << id;
+  }
+  return 0;
+}
+
+/// @struct mrebuild_s
+/// @brief Subset construction state
+struct mrebuild_s {
+  int* mark;      ///< Generation each NFA node was last added to `set`
+  int gen;        ///< Current generation
+  int* stack;     ///< Closure traversal stack
+  int* set;       ///< NFA nodes of the state being built
+  int len;        ///< Number of nodes in `set`
+  int* kern;      ///< NFA nodes of all states, ordered
+  size_t kernlen; ///< Number of nodes in `kern`
+  size_t kerncap; ///< Allocated capacity of `kern`
+  size_t* koff;   ///< Offset of each state's nodes in `kern`
+  int* klen;      ///< Number of each state's nodes
+  int nstates;    ///< Number of states
+  int capstates;  ///< Allocated capacity of the matcher's state tables
+  int* table;     ///< Hash table of state indices plus one
+};
+
+/// @brief Adds the nodes reachable from \p s without consuming a byte to the
+/// state being built. Only byte consuming, `MN_EOL` and `MN_MATCH` nodes are
+/// added, as they determine the transitions and matches of the state.
+/// @param m The matcher
+/// @param b The construction state
+/// @param s The NFA node index
+/// @param bol The position is the beginning of the string
+/// @param eol The position is the end of the string
+static void mreclosure(const struct mre_s* m, struct mrebuild_s* b,
+                       const int s, const bool bol, const bool eol) {
+  int top = 0;
+  b->stack[top++] = s;
+  while (top > 0) {
+    const int n = b->stack[--top];
+    if (b->mark[n] == b->gen) continue;
+    b->mark[n] = b->gen;
+    const struct mrenode_s* node = &m->nfa[n];
+    switch (node->type) {
+      case MN_SPLIT:
+        b->stack[top++] = node->out1;
+        b->stack[top++] = node->out;
+        continue;
+      case MN_BOL:
+        if (bol) b->stack[top++] = node->out;
+        continue;
+      case MN_EOL:
+        if (eol) b->stack[top++] = node->out;
+        break;
+      default:
+        break;
+    }
+    b->set[b->len++] = n;
+  }
+}
+
+/// @brief Compares two NFA node indices for `qsort`.
+static int mrecmp(const void* a, const void* b) {
+  return *(const int*) a - *(const int*) b;
+}
+
+/// @brief Looks up the state of the nodes in `b->set`, adding a new state if
+/// it does not exist.
+/// @param m The matcher
+/// @param b The construction state
+/// @return The state index, otherwise -1 if the DFA is too large or memory
+/// allocation failed.
+static int mreintern(struct mre_s* m, struct mrebuild_s* b) {
+  qsort(b->set, b->len, sizeof(*b->set), mrecmp);
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < b->len; i++) h = (h ^ (uint32_t) b->set[i]) * 16777619u;
+  const uint32_t mask = MRESTATES * 2 - 1;
+  for (uint32_t i = h & mask;; i = (i + 1) & mask) {
+    const int st = b->table[i] - 1;
+    if (st < 0) break;
+    if (b->klen[st] == b->len &&
+        !memcmp(&b->kern[b->koff[st]], b->set, b->len * sizeof(*b->set)))
+      return st;
+  }
+  if (b->nstates == MRESTATES) return -1;
+
+  // append the state, growing the transition table
+  const int st = b->nstates;
+  if (b->kernlen + b->len > b->kerncap) {
+    const size_t cap = (b->kernlen + b->len) * 2;
+    int* r;
+    if ((r = realloc(b->kern, cap * sizeof(*r))) == NULL) return -1;
+    b->kern = r, b->kerncap = cap;
+  }
+  if (st == b->capstates) {
+    const int cap = st > 0 ? st * 2 : 16;
+    void* r;
+    if ((r = realloc(m->trans, (size_t) cap * m->ncls * sizeof(*m->trans))) ==
+        NULL)
+      return -1;
+    m->trans = r;
+    if ((r = realloc(m->now, cap * sizeof(*m->now))) == NULL) return -1;
+    m->now = r;
+    if ((r = realloc(m->end, cap * sizeof(*m->end))) == NULL) return -1;
+    m->end = r;
+    b->capstates = cap;
+  }
+  memcpy(&b->kern[b->kernlen], b->set, b->len * sizeof(*b->set));
+  b->koff[st] = b->kernlen, b->klen[st] = b->len;
+  b->kernlen += b->len;
+  for (uint32_t i = h & mask;; i = (i + 1) & mask) {
+    if (b->table[i] != 0) continue;
+    b->table[i] = st + 1;
+    break;
+  }
+  return b->nstates++;
+}
+
+/// @brief Partitions the bytes into classes which no `MN_SET` node of the
+/// NFA distinguishes.
+/// @param m The matcher
+static void mreclasses(struct mre_s* m) {
+  memset(m->cls, 0, sizeof(m->cls));
+  m->ncls = 1;
+  for (int n = 0; n < m->nnfa; n++) {
+    if (m->nfa[n].type != MN_SET) continue;
+    int remap[512];
+    memset(remap, -1, sizeof(remap));
+    int ncls = 0;
+    for (int c = 0; c < 256; c++) {
+      const int key = m->cls[c] * 2 + mrebit(m->nfa[n].set, c);
+      if (remap[key] < 0) remap[key] = ncls++;
+      m->cls[c] = (uint8_t) remap[key];
+    }
+    m->ncls = ncls;
+  }
+}
+
+/// @brief Builds the DFA states reachable from the start state.
+/// @param m The matcher
+/// @param b The construction state
+/// @return 0 if successful, otherwise -1 if the DFA is too large or memory
+/// allocation failed.
+static int mresubsets(struct mre_s* m, struct mrebuild_s* b) {
+  int rep[256];// a byte of each class
+  for (int c = 255; c >= 0; c--) rep[m->cls[c]] = c;
+
+  b->gen++, b->len = 0;
+  for (int i = 0; i < m->npats; i++)
+    if (m->pats[i].start >= 0) mreclosure(m, b, m->pats[i].start, true, false);
+  if (mreintern(m, b) != 0) return -1;
+
+  for (int st = 0; st < b->nstates; st++) {
+    // the matches of the state, and of the string ending in it
+    uint64_t now = 0, end = 0;
+    b->gen++, b->len = 0;
+    for (int i = 0; i < b->klen[st]; i++) {
+      const struct mrenode_s* node = &m->nfa[b->kern[b->koff[st] + i]];
+      if (node->type == MN_MATCH) now |= UINT64_C(1) << node->id;
+      if (node->type == MN_EOL) mreclosure(m, b, node->out, st == 0, true);
+    }
+    for (int i = 0; i < b->len; i++)
+      if (m->nfa[b->set[i]].type == MN_MATCH)
+        end |= UINT64_C(1) << m->nfa[b->set[i]].id;
+    m->now[st] = now, m->end[st] = now | end;
+
+    for (int c = 0; c < m->ncls; c++) {
+      b->gen++, b->len = 0;
+      for (int i = 0; i < b->klen[st]; i++) {
+        const struct mrenode_s* node = &m->nfa[b->kern[b->koff[st] + i]];
+        if (node->type == MN_SET && mrebit(node->set, rep[c]))
+          mreclosure(m, b, node->out, false, false);
+      }
+      for (int i = 0; i < m->npats; i++)
+        if (m->pats[i].start >= 0)
+          mreclosure(m, b, m->pats[i].start, false, false);
+      int next;
+      if ((next = mreintern(m, b)) < 0) return -1;
+      m->trans[(size_t) st * m->ncls + c] = next;
+    }
+  }
+  return 0;
+}
+
+int mrebuild(struct mre_s* m) {
+  int ret = 0;
+  struct mrebuild_s b = {0};
+  if (m->nnfa == 0) goto done;
+
+  mreclasses(m);
+  if ((b.mark = calloc(m->nnfa, sizeof(*b.mark))) == NULL ||
+      (b.stack = malloc((m->nnfa * 2 + 1) * sizeof(*b.stack))) == NULL ||
+      (b.set = malloc(m->nnfa * sizeof(*b.set))) == NULL ||
+      (b.koff = malloc(MRESTATES * sizeof(*b.koff))) == NULL ||
+      (b.klen = malloc(MRESTATES * sizeof(*b.klen))) == NULL ||
+      (b.table = calloc(MRESTATES * 2, sizeof(*b.table))) == NULL) {
+    ret = -1;
+    goto done;
+  }
+  if (mresubsets(m, &b)) {
+    // too many states, or out of memory, use `regexec` for all patterns
+    if (b.nstates < MRESTATES) ret = -1;
+    for (int i = 0; i < m->npats; i++) {
+      m->pats[i].start = -1;
+      m->fallback |= UINT64_C(1) << m->pats[i].id;
+    }
+    goto done;
+  }
+  m->dfa = true;
+done:
+  free(b.mark);
+  free(b.stack);
+  free(b.set);
+  free(b.kern);
+  free(b.koff);
+  free(b.klen);
+  free(b.table);
+  free(m->nfa);
+  m->nfa = NULL, m->nnfa = 0;
+  if (ret) errno = ENOMEM;
+  return ret;
+}
+
+uint64_t mrematch(struct mre_s* m, const char* s, const bool any) {
+  if (m == NULL) return 0;
+  __atomic_fetch_add(&m->stats.strings, 1, __ATOMIC_RELAXED);
+  uint64_t mask = 0;
+  if (m->dfa) {
+    int st = 0;
+    for (const unsigned char* c = (const unsigned char*) s; *c != '\0'; c++) {
+      mask |= m->now[st];
+      if (any && mask != 0) return mask;
+      st = m->trans[(size_t) st * m->ncls + m->cls[*c]];
+    }
+    mask |= m->end[st];
+  }
+
+  // patterns of identifiers which did not match yet, unless their literals
+  // are missing from the string
+  if (!(m->fallback & ~mask)) return mask;
+  const size_t len = strlen(s);
+  for (int i = 0; i < m->npats && !(any && mask != 0); i++) {
+    const struct mrepat_s* p = &m->pats[i];
+    const uint64_t bit = UINT64_C(1) << p->id;
+    if (p->start >= 0 || (mask & bit)) continue;
+    if (!mrelitsmatch(&p->lits, s, len)) {
+      __atomic_fetch_add(&m->stats.skipped, 1, __ATOMIC_RELAXED);
+      continue;
+    }
+    __atomic_fetch_add(&m->stats.regexecs, 1, __ATOMIC_RELAXED);
+    if (!regexec(p->reg, s, 0, NULL, 0)) mask |= bit;
+  }
+  return mask;
+}
+
+void mrestats(const struct mre_s* m, struct mrestats_s* stats) {
+  *stats = (struct mrestats_s){0};
+  if (m == NULL) return;
+  stats->strings = __atomic_load_n(&m->stats.strings, __ATOMIC_RELAXED);
+  stats->regexecs = __atomic_load_n(&m->stats.regexecs, __ATOMIC_RELAXED);
+  stats->skipped = __atomic_load_n(&m->stats.skipped, __ATOMIC_RELAXED);
+}
+
+uint64_t mrehash(const struct mre_s* m) {
+  return m != NULL ? m->hash : 0;
+}
+
+void mrefree(struct mre_s* m) {
+  if (m == NULL) return;
+  for (int i = 0; i < m->npats; i++) mrefreelits(&m->pats[i].lits);
+  free(m->pats);
+  free(m->nfa);
+  free(m->trans);
+  free(m->now);
+  free(m->end);
+  free(m);
+}
@@ -0,0 +1,74 @@
+/// @file plugin.c
+/// @brief Loading of shared object plugins, see `fsaplugin.h`.
+#include "plugin.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+/// @brief Resolves the function symbol \p name of a plugin. The address is
+/// copied since ISO C does not define converting object pointers, as returned
+/// by `dlsym`, to function pointers.
+/// @param p The plugin
+/// @param name The symbol name
+/// @param fn Pointer to the function pointer to set, or set to NULL if the
+/// symbol is not defined
+/// @param size The size of the function pointer
+static void pluginsym(const struct plugin_s* p, const char* name, void* fn,
+                      const size_t size) {
+  void* sym = dlsym(p->dl, name);
+  if (sym == NULL) {
+    memset(fn, 0, size);
+  } else {
+    memcpy(fn, &sym, size);
+  }
+}
+
+struct plugin_s* pluginopen(const char* fp, const char* arg) {
+  struct plugin_s* p;
+  if ((p = calloc(1, sizeof(*p))) == NULL) return NULL;
+  if ((p->fp = strdup(fp)) == NULL) goto err;
+  if ((p->dl = dlopen(fp, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+    log_error("cannot load plugin `%s`: %s", fp, dlerror());
+    goto err;
+  }
+
+  const int* version = dlsym(p->dl, "fsap_version");
+  if (version == NULL || *version != FSAP_VERSION) {
+    log_error("plugin `%s` does not implement interface version %d", fp,
+              FSAP_VERSION);
+    goto err;
+  }
+  int (*init)(const char*, void**);
+  pluginsym(p, "fsap_init", &init, sizeof(init));
+  pluginsym(p, "fsap_process", &p->process, sizeof(p->process));
+  pluginsym(p, "fsap_flush", &p->flush, sizeof(p->flush));
+  pluginsym(p, "fsap_fini", &p->fini, sizeof(p->fini));
+  if (p->process == NULL) {
+    log_error("plugin `%s` does not export `fsap_process`", fp);
+    goto err;
+  }
+
+  int err;
+  if (init != NULL && (err = init(arg, &p->state))) {
+    log_error("plugin `%s` failed to initialize: %d", fp, err);
+    goto err;
+  }
+  return p;
+err:
+  if (p->dl != NULL) dlclose(p->dl);
+  free(p->fp);
+  free(p);
+  return NULL;
+}
+
+void pluginclose(struct plugin_s* p) {
+  if (p == NULL) return;
+  if (p->fini != NULL) p->fini(p->state);
+  dlclose(p->dl);
+  free(p->fp);
+  free(p);
+}
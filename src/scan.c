@@ -0,0 +1,260 @@
+/// @file scan.c
+/// @brief Parallel work-stealing directory tree scanner implementation.
+#include "scan.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+/// @struct scanres_s
+/// @brief Queued directory result waiting to be collected.
+struct scanres_s {
+  void* res;              ///< Directory function result
+  struct scanres_s* next; ///< Next queued result
+};
+
+/// @struct scanwk_s
+/// @brief Scanner thread and its directory deque. The owning thread pushes and
+/// pops directories at the tail (depth first), other threads steal from the
+/// head (breadth first) so stolen work tends to be large subtrees.
+struct scanwk_s {
+  pthread_t tid;        ///< System thread identifier
+  pthread_mutex_t lock; ///< Deque lock
+  char** dq;            ///< Deque of queued directory paths
+  long head;            ///< Deque head position, stolen by other threads
+  long tail;            ///< Deque tail position, owned by this thread
+  long cap;             ///< Allocated capacity of `dq`
+  struct scan_s* sc;    ///< Shared scan state
+  int id;               ///< Index of this thread in the scan state
+};
+
+/// @struct scan_s
+/// @brief Shared scan state.
+struct scan_s {
+  struct scanwk_s* wks;          ///< Scanner threads
+  int nwks;                      ///< Number of scanner threads
+  scandirfn_t dirfn;             ///< Directory function
+  scanresfn_t resfn;             ///< Result function
+  scanfreefn_t freefn;           ///< Free function for unqueued results
+  void* udata;                   ///< User data for `dirfn` and `resfn`
+  _Atomic long pending;          ///< Directories queued or being processed
+  _Atomic unsigned long version; ///< Incremented each time a dir is queued
+  _Atomic int idle;              ///< Number of idle waiting threads
+  _Atomic int err;               ///< First error, stops the scan if set
+  pthread_mutex_t lock;          ///< Lock for the result queue and waiting
+  pthread_cond_t work;           ///< Signaled when work is queued or done
+  pthread_cond_t ready;          ///< Signaled when a result is queued
+  struct scanres_s* rhead;       ///< Result queue head
+  struct scanres_s* rtail;       ///< Result queue tail
+  int running;                   ///< Number of running scanner threads
+};
+
+/// @brief Sets the scan error to \p err if no error has been set yet.
+/// @param sc The scan state
+/// @param err The error value
+static void scanfail(struct scan_s* sc, const int err) {
+  int none = 0;
+  atomic_compare_exchange_strong(&sc->err, &none, err);
+}
+
+int scanpush(struct scanwk_s* wk, const char* dir) {
+  struct scan_s* sc = wk->sc;
+  char* d;
+  if ((d = strdup(dir)) == NULL) return -1;
+
+  pthread_mutex_lock(&wk->lock);
+  if (wk->tail == wk->cap) {
+    if (wk->head > 0) {
+      // reclaim the space of stolen entries before growing
+      memmove(wk->dq, wk->dq + wk->head,
+              (wk->tail - wk->head) * sizeof(*wk->dq));
+      wk->tail -= wk->head, wk->head = 0;
+    } else {
+      const long cap = wk->cap > 0 ? wk->cap * 2 : 64;
+      char** dq;
+      if ((dq = realloc(wk->dq, cap * sizeof(*dq))) == NULL) {
+        pthread_mutex_unlock(&wk->lock);
+        free(d);
+        return -1;
+      }
+      wk->dq = dq, wk->cap = cap;
+    }
+  }
+  // count the directory as pending before it can be taken by another thread
+  atomic_fetch_add(&sc->pending, 1);
+  wk->dq[wk->tail++] = d;
+  pthread_mutex_unlock(&wk->lock);
+
+  atomic_fetch_add(&sc->version, 1);
+  if (atomic_load(&sc->idle) > 0) {
+    pthread_mutex_lock(&sc->lock);
+    pthread_cond_broadcast(&sc->work);
+    pthread_mutex_unlock(&sc->lock);
+  }
+  return 0;
+}
+
+/// @brief Takes the next directory for scanner thread \p wk to process, from
+/// the tail of its own deque, or otherwise by stealing from the head of
+/// another thread's deque.
+/// @param wk The scanner thread
+/// @return The directory path which must be freed by the caller, or NULL if
+/// no directories are queued.
+static char* scantake(struct scanwk_s* wk) {
+  struct scan_s* sc = wk->sc;
+  char* dir = NULL;
+
+  pthread_mutex_lock(&wk->lock);
+  if (wk->tail > wk->head) dir = wk->dq[--wk->tail];
+  if (wk->tail == wk->head) wk->head = wk->tail = 0;
+  pthread_mutex_unlock(&wk->lock);
+
+  for (int i = 1; dir == NULL && i < sc->nwks; i++) {
+    struct scanwk_s* v = &sc->wks[(wk->id + i) % sc->nwks];
+    pthread_mutex_lock(&v->lock);
+    if (v->tail > v->head) dir = v->dq[v->head++];
+    pthread_mutex_unlock(&v->lock);
+  }
+  return dir;
+}
+
+/// @brief Scanner thread entry point. The thread processes directories until
+/// no directories are queued or being processed by any thread. While idle, the
+/// thread waits until another thread queues a directory.
+/// @param arg The scanner thread self context
+/// @return NULL in all cases
+static void* scanentry(void* arg) {
+  struct scanwk_s* wk = arg;
+  struct scan_s* sc = wk->sc;
+
+  for (;;) {
+    const unsigned long v = atomic_load(&sc->version);
+    char* dir;
+    if ((dir = scantake(wk)) == NULL) {
+      // wait until a directory is queued after the failed take, or until all
+      // pending directories have been processed
+      pthread_mutex_lock(&sc->lock);
+      atomic_fetch_add(&sc->idle, 1);
+      while (atomic_load(&sc->pending) > 0 && atomic_load(&sc->version) == v)
+        pthread_cond_wait(&sc->work, &sc->lock);
+      atomic_fetch_sub(&sc->idle, 1);
+      const bool done = atomic_load(&sc->pending) == 0;
+      pthread_mutex_unlock(&sc->lock);
+      if (done) break;
+      continue;
+    }
+
+    void* res = NULL;
+    int err = 0;
+    if (!atomic_load(&sc->err)) err = sc->dirfn(wk, dir, &res, sc->udata);
+    if (err) {
+      log_error("scan func for `%s` returned %d", dir, err);
+      scanfail(sc, err);
+    }
+    free(dir);
+
+    struct scanres_s* r = NULL;
+    if (res != NULL && (r = malloc(sizeof(*r))) == NULL) {
+      scanfail(sc, -1);
+      sc->freefn(res);
+    }
+    pthread_mutex_lock(&sc->lock);
+    if (r != NULL) {
+      r->res = res, r->next = NULL;
+      if (sc->rtail != NULL) {
+        sc->rtail->next = r;
+      } else {
+        sc->rhead = r;
+      }
+      sc->rtail = r;
+      pthread_cond_signal(&sc->ready);
+    }
+    if (atomic_fetch_sub(&sc->pending, 1) == 1)
+      pthread_cond_broadcast(&sc->work);// wake idle threads to exit
+    pthread_mutex_unlock(&sc->lock);
+  }
+
+  pthread_mutex_lock(&sc->lock);
+  if (--sc->running == 0) pthread_cond_signal(&sc->ready);
+  pthread_mutex_unlock(&sc->lock);
+  return NULL;
+}
+
+int scanrun(const char* root, const int threads, scandirfn_t dirfn,
+            scanresfn_t resfn, scanfreefn_t freefn, void* udata) {
+  assert(root != NULL);
+  assert(threads > 0);
+
+  struct scan_s sc = {0};
+  sc.nwks = threads, sc.dirfn = dirfn, sc.resfn = resfn, sc.freefn = freefn;
+  sc.udata = udata;
+  if ((sc.wks = calloc(threads, sizeof(*sc.wks))) == NULL) return -1;
+  pthread_mutex_init(&sc.lock, NULL);
+  pthread_cond_init(&sc.work, NULL);
+  pthread_cond_init(&sc.ready, NULL);
+  for (int i = 0; i < threads; i++) {
+    sc.wks[i].sc = &sc, sc.wks[i].id = i;
+    pthread_mutex_init(&sc.wks[i].lock, NULL);
+  }
+
+  int err = 0;
+  if (scanpush(&sc.wks[0], root)) {
+    err = -1;
+    goto ret;
+  }
+
+  // start the scanner threads, continuing with fewer threads if any fail, the
+  // lock is held so no thread can exit before the running count is final
+  int started = 0;
+  pthread_mutex_lock(&sc.lock);
+  for (; started < threads; started++) {
+    struct scanwk_s* wk = &sc.wks[started];
+    if ((err = pthread_create(&wk->tid, NULL, scanentry, wk))) {
+      log_error("cannot create thread: %s", strerror(err));
+      break;
+    }
+  }
+  sc.running = started;
+  pthread_mutex_unlock(&sc.lock);
+  if (started == 0) {
+    err = -1;
+    goto ret;
+  }
+  err = 0;
+
+  // collect results on the calling thread until all scanner threads exit
+  for (;;) {
+    pthread_mutex_lock(&sc.lock);
+    while (sc.rhead == NULL && sc.running > 0)
+      pthread_cond_wait(&sc.ready, &sc.lock);
+    struct scanres_s* r = sc.rhead;
+    if (r != NULL && (sc.rhead = r->next) == NULL) sc.rtail = NULL;
+    pthread_mutex_unlock(&sc.lock);
+    if (r == NULL) break;
+
+    int rerr;
+    if ((rerr = resfn(r->res, udata))) scanfail(&sc, rerr);
+    free(r);
+  }
+  for (int i = 0; i < started; i++) pthread_join(sc.wks[i].tid, NULL);
+  err = atomic_load(&sc.err);
+
+ret:
+  for (int i = 0; i < threads; i++) {
+    struct scanwk_s* wk = &sc.wks[i];
+    for (long j = wk->head; j < wk->tail; j++) free(wk->dq[j]);
+    free(wk->dq);
+    pthread_mutex_destroy(&wk->lock);
+  }
+  free(sc.wks);
+  pthread_mutex_destroy(&sc.lock);
+  pthread_cond_destroy(&sc.work);
+  pthread_cond_destroy(&sc.ready);
+  return err;
+}
@@ -4,14 +4,13 @@
 
 #include <assert.h>
 #include <pthread.h>
-#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "fd.h"
-#include "fs.h"
 #include "index.h"
 #include "lcmd.h"
 #include "log.h"
@@ -19,48 +18,100 @@
 /// @struct thrd_s
 /// @brief Initialized worker thread in the thread pool.
 struct thrd_s {
-  _Atomic bool rsrvd;   ///< Work request reservation flag
-  _Atomic bool canwork; ///< Work request ready to process flag
-  struct tpreq_s work;  ///< Work request to process
-  pthread_t tid;        ///< System thread identifier
-  _Bool fdsopen;        ///< File descriptor set open flag
-  struct fdset_s fds;   ///< Output file descriptor set
+  pthread_t tid;      ///< System thread identifier
+  _Bool fdsopen;      ///< File descriptor set open flag
+  struct fdset_s fds; ///< Output file descriptor set
+  uint64_t cpuns;     ///< CPU time used by the thread when it last slept
 };
 
-static struct thrd_s** thrds;  ///< Thread pool worker threads array
-static _Atomic bool haltthrds; ///< Thread pool halt flag
-static _Atomic int thrdrc;     ///< Thread pool thread count
+static struct thrd_s** thrds; ///< Thread pool worker threads array
+static bool haltthrds;        ///< Thread pool halt flag
+
+static struct tpreq_s* queue;  ///< Bounded work request ring buffer
+static int queuecap;           ///< Capacity of `queue`
+static int queuehead;          ///< Index of the oldest queued request
+static int queuelen;           ///< Number of queued requests
+static int inflight;           ///< Queued and executing requests
+static struct tpstats_s stats; ///< Work queue statistics
+static pthread_mutex_t queuelock = PTHREAD_MUTEX_INITIALIZER; ///< Queue lock
+static pthread_cond_t notempty = PTHREAD_COND_INITIALIZER; ///< Request queued
+static pthread_cond_t notfull = PTHREAD_COND_INITIALIZER;  ///< Request taken
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER;     ///< All finished
+
+/// @brief Returns the current monotonic time in nanoseconds, used to measure
+/// the time spent waiting on the work queue.
+/// @return The current time in nanoseconds
+static uint64_t tpnowns(void) {
+  struct timespec now = {0};
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+/// @brief Returns the CPU time used by the calling thread in nanoseconds.
+/// @return The thread CPU time in nanoseconds
+static uint64_t tpcpuns(void) {
+  struct timespec cpu = {0};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+  return (uint64_t) cpu.tv_sec * 1000000000 + (uint64_t) cpu.tv_nsec;
+}
+
+/// @brief Waits on condition \p cond of the work queue, adding the time spent
+/// waiting to \p waitns. The queue lock must be held.
+/// @param cond The condition variable to wait on
+/// @param waitns The wait time counter to add to
+static void tpcondwait(pthread_cond_t* cond, uint64_t* waitns) {
+  const uint64_t start = tpnowns();
+  pthread_cond_wait(cond, &queuelock);
+  *waitns += tpnowns() - start;
+}
 
-/// @brief Thread pool worker thread entry point. The thread will spin lock
-/// while waiting to be reserved. Once reserved, it spin locks while waiting
-/// for the main thread to finalize the work request. Once ready, the work
-/// request is executed and the thread is released back to the pool.
+/// @brief Thread pool worker thread entry point. The thread sleeps while the
+/// work queue is empty. Queued work requests are taken in order and executed
+/// until the pool is halted and the queue is drained. The last request taken
+/// is only released once the thread finds the queue empty and has flushed its
+/// plugin contexts, so `tpwait` also waits for the work plugins hold back. The
+/// thread's CPU time is recorded whenever it runs out of work.
 /// @param arg The thread self context
 /// @return NULL in all cases
 static void* tpentrypoint(void* arg) {
   struct thrd_s* self = arg;
-  atomic_fetch_add(&thrdrc, 1);
-  while (!atomic_load(&haltthrds)) {
-    if (!atomic_load(&self->rsrvd)) continue; /* wait for work reservation */
-
-    // spin while waiting for the main thread to set the work request
-    // this avoids the atomic state of rsrvd being set before the calling thread
-    // has a chance to lock and set the work request
-    while (!atomic_load(&self->canwork)) continue;
-    atomic_store(&self->canwork, false);// reset work confirmation flag
-
-    const struct tpreq_s* req = &self->work;
+  bool held = false;// the last request taken is not yet released
+  pthread_mutex_lock(&queuelock);
+  for (;;) {
+    if (queuelen == 0 && held) {
+      pthread_mutex_unlock(&queuelock);
+      lcmdidle(&self->fds);
+
+      // release the request, waking `tpwait` once all requests are finished
+      pthread_mutex_lock(&queuelock);
+      held = false;
+      if (--inflight == 0) pthread_cond_broadcast(&idle);
+      continue;
+    }
+    if (queuelen == 0) self->cpuns = tpcpuns();
+    while (queuelen == 0 && !haltthrds)
+      tpcondwait(&notempty, &stats.popwaitns);
+    if (queuelen == 0) break;// halted and drained
+    const struct tpreq_s work = queue[queuehead];
+    queuehead = (queuehead + 1) % queuecap;
+    queuelen--;
+    if (held) inflight--;// never the last, as `work` is still in flight
+    held = true;
+    pthread_cond_signal(&notfull);
+    pthread_mutex_unlock(&queuelock);
+
+    const struct tpreq_s* req = &work;
     int err;
-    if ((err = lcmdexec(req->cs, req->node, &self->fds, req->flags)))
+    if (req->node == NULL) {
+      if ((err = lcmdflush(req->cs, &self->fds, req->flags)))
+        log_error("batch execution error: %d", err);
+    } else if ((err = lcmdexec(req->cs, req->node, &self->fds, req->flags))) {
       log_error("thread execution error: %d", err);
-    if (req->flags & (LCTRIG_NEW | LCTRIG_MOD)) {
-      if ((err = fsstat(req->node->fp, &req->node->st)))
-        log_error("stat error: %d", err);
     }
-
-    atomic_store(&self->rsrvd, false);// release the reservation
+    pthread_mutex_lock(&queuelock);
   }
-  atomic_fetch_sub(&thrdrc, 1);
+  pthread_mutex_unlock(&queuelock);
+  lcmdrelease(&self->fds);// stop the coprocesses and plugins of the thread
   return NULL;
 }
 
@@ -85,9 +136,13 @@ static void tpinitthrd(struct thrd_s* t, const int flags) {
   }
 }
 
-int tpinit(const int size, const int flags) {
+int tpinit(const int size, const int depth, const int flags) {
   assert(thrds == NULL);
   assert(size > 0);
+  assert(depth > 0);
+
+  if ((queue = calloc(depth, sizeof(*queue))) == NULL) return -1;
+  queuecap = depth;
 
   // add one for the NULL sentinel
   if ((thrds = calloc(size + 1, sizeof(struct thrd_s*))) == NULL) goto fail;
@@ -105,6 +160,9 @@ int tpinit(const int size, const int flags) {
 fail:
   for (int i = 0; i < size; i++) free(thrds[i]);
   free(thrds);
+  thrds = NULL;
+  free(queue);
+  queue = NULL;
   return -1;
 }
 
@@ -112,30 +170,38 @@ int tpqueue(const struct tpreq_s* req) {
   assert(thrds != NULL);
   assert(req != NULL);
 
-findnext:
-  for (size_t i = 0; thrds[i] != NULL; i++) {
-    struct thrd_s* t = thrds[i];
-    bool isrsrvd = false;
-    if (!atomic_compare_exchange_strong(&t->rsrvd, &isrsrvd, true))
-      continue; /* thread is already reserved */
-    memcpy(&t->work, req, sizeof(*req));
-    atomic_store(&t->canwork, true); /* release lock/allow thread to continue */
-    return 0;
-  }
-  goto findnext;// spin while waiting for a thread to be available
+  pthread_mutex_lock(&queuelock);
+  while (queuelen == queuecap) tpcondwait(&notfull, &stats.pushwaitns);
+  queue[(queuehead + queuelen) % queuecap] = *req;
+  queuelen++;
+  stats.queued++;
+  if (queuelen > stats.highwater) stats.highwater = queuelen;
+  inflight++;
+  pthread_cond_signal(&notempty);
+  pthread_mutex_unlock(&queuelock);
+  return 0;
 }
 
 void tpwait(void) {
-  for (size_t i = 0; thrds != NULL && thrds[i] != NULL; i++) {
-    while (atomic_load(&thrds[i]->rsrvd))// wait for thread to become idle
-      ;
-  }
+  pthread_mutex_lock(&queuelock);
+  while (inflight > 0) pthread_cond_wait(&idle, &queuelock);
+  pthread_mutex_unlock(&queuelock);
+}
+
+void tpstats(struct tpstats_s* s) {
+  pthread_mutex_lock(&queuelock);
+  *s = stats;
+  s->depth = queuecap;
+  for (size_t i = 0; thrds != NULL && thrds[i] != NULL; i++)
+    s->cpuns += thrds[i]->cpuns;
+  pthread_mutex_unlock(&queuelock);
 }
 
 void tpshutdown(void) {
-  atomic_store(&haltthrds, true);// signal threads to exit
-  while (atomic_load(&thrdrc) > 0)
-    ;
+  pthread_mutex_lock(&queuelock);
+  haltthrds = true;// signal threads to exit once drained
+  pthread_cond_broadcast(&notempty);
+  pthread_mutex_unlock(&queuelock);
   for (size_t i = 0; thrds != NULL && thrds[i] != NULL; i++) {
     struct thrd_s* t = thrds[i];
     pthread_join(t->tid, NULL);
@@ -150,4 +216,6 @@ void tpfree(void) {
   for (size_t i = 0; thrds != NULL && thrds[i] != NULL; i++) free(thrds[i]);
   free(thrds);
   thrds = NULL;
+  free(queue);
+  queue = NULL;
 }
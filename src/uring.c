@@ -0,0 +1,270 @@
+/// @file uring.c
+/// @brief Batched file stat backend using Linux io_uring. The ring is set up
+/// with the raw system calls, so no liburing dependency is required.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE// statx(2)
+#endif
+
+#include "uring.h"
+
+#include <errno.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+
+/// @def URINGENTRIES
+/// @brief The number of submission queue entries, which also bounds the number
+/// of stat requests in flight.
+#define URINGENTRIES 256
+
+/// @struct uring_s
+/// @brief Memory mapped io_uring instance.
+struct uring_s {
+  int fd;                    ///< Ring file descriptor
+  unsigned int* sqhead;      ///< Submission queue head, consumed by kernel
+  unsigned int* sqtail;      ///< Submission queue tail, produced by us
+  unsigned int sqmask;       ///< Submission queue ring mask
+  unsigned int* sqarray;     ///< Submission queue index array
+  struct io_uring_sqe* sqes; ///< Submission queue entries
+  unsigned int* cqhead;      ///< Completion queue head, consumed by us
+  unsigned int* cqtail;      ///< Completion queue tail, produced by kernel
+  unsigned int cqmask;       ///< Completion queue ring mask
+  struct io_uring_cqe* cqes; ///< Completion queue entries
+  unsigned int entries;      ///< Number of submission queue entries
+  void* sqmap;               ///< Submission queue ring mapping
+  size_t sqmapsze;           ///< Size of `sqmap`
+  void* cqmap;               ///< Completion queue ring mapping, or `sqmap`
+  size_t cqmapsze;           ///< Size of `cqmap`
+  size_t sqesze;             ///< Size of the `sqes` mapping
+  struct statx* stxs;        ///< Stat buffer for each in flight request
+  size_t* slots;             ///< Request index of each in flight request
+};
+
+static pthread_key_t uringkey;                       ///< Thread local ring key
+static pthread_once_t uringonce = PTHREAD_ONCE_INIT; ///< Key creation guard
+static _Atomic bool uringunavail;                    ///< Setup has failed
+
+/// @brief Unmaps and closes an io_uring instance, and frees it.
+/// @param arg The io_uring instance
+static void uringfree(void* arg) {
+  struct uring_s* r = arg;
+  if (r == NULL) return;
+  if (r->sqes != NULL && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqesze);
+  if (r->cqmap != NULL && r->cqmap != MAP_FAILED && r->cqmap != r->sqmap)
+    munmap(r->cqmap, r->cqmapsze);
+  if (r->sqmap != NULL && r->sqmap != MAP_FAILED)
+    munmap(r->sqmap, r->sqmapsze);
+  if (r->fd >= 0) close(r->fd);
+  free(r->stxs);
+  free(r->slots);
+  free(r);
+}
+
+/// @brief Creates the thread local ring key, with `uringfree` as destructor.
+static void uringmkkey(void) {
+  if (pthread_key_create(&uringkey, uringfree))
+    atomic_store(&uringunavail, true);
+}
+
+/// @brief Probes whether the kernel supports `IORING_OP_STATX` requests. The
+/// ring can be set up on 5.1 to 5.5 kernels, which then fail every stat
+/// request with `EINVAL`. `IORING_REGISTER_PROBE` was added in the same
+/// kernel release as `IORING_OP_STATX`, so a failed probe means no support.
+/// @param fd The ring file descriptor
+/// @return 0 if supported, otherwise -1 and `errno` is set.
+static int uringprobe(const int fd) {
+  const size_t sze = sizeof(struct io_uring_probe) +
+                     IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe* probe;
+  if ((probe = calloc(1, sze)) == NULL) return -1;
+  int err = 0;
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe,
+              IORING_OP_LAST) < 0) {
+    err = -1;
+  } else if (probe->last_op < IORING_OP_STATX ||
+             !(probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED)) {
+    errno = EOPNOTSUPP;
+    err = -1;
+  }
+  free(probe);
+  return err;
+}
+
+/// @brief Creates and maps a new io_uring instance.
+/// @return The io_uring instance, or NULL and `errno` is set.
+static struct uring_s* uringnew(void) {
+  struct uring_s* r;
+  if ((r = calloc(1, sizeof(*r))) == NULL) return NULL;
+  r->fd = -1;
+
+  struct io_uring_params p = {0};
+  if ((r->fd = (int) syscall(__NR_io_uring_setup, URINGENTRIES, &p)) < 0)
+    goto err;
+  if (uringprobe(r->fd)) goto err;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    errno = ENOSYS;// unreachable, IORING_OP_STATX requires a 5.6 kernel
+    goto err;
+  }
+
+  r->sqmapsze = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  r->cqmapsze = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (r->cqmapsze > r->sqmapsze) r->sqmapsze = r->cqmapsze;
+  r->sqmap = mmap(NULL, r->sqmapsze, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  if (r->sqmap == MAP_FAILED) goto err;
+  r->cqmap = r->sqmap, r->cqmapsze = r->sqmapsze;
+  r->sqesze = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqesze, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED) goto err;
+
+  char* sq = r->sqmap;
+  r->sqhead = (unsigned int*) (sq + p.sq_off.head);
+  r->sqtail = (unsigned int*) (sq + p.sq_off.tail);
+  r->sqmask = *(unsigned int*) (sq + p.sq_off.ring_mask);
+  r->sqarray = (unsigned int*) (sq + p.sq_off.array);
+  char* cq = r->cqmap;
+  r->cqhead = (unsigned int*) (cq + p.cq_off.head);
+  r->cqtail = (unsigned int*) (cq + p.cq_off.tail);
+  r->cqmask = *(unsigned int*) (cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+  r->entries = p.sq_entries;
+
+  if ((r->stxs = malloc(r->entries * sizeof(*r->stxs))) == NULL) goto err;
+  if ((r->slots = malloc(r->entries * sizeof(*r->slots))) == NULL) goto err;
+  return r;
+
+err:;
+  const int e = errno;
+  uringfree(r);
+  errno = e;
+  return NULL;
+}
+
+/// @brief Returns the calling thread's io_uring instance, creating it on first
+/// use. If io_uring is unavailable, no further setup attempts are made by any
+/// thread.
+/// @return The io_uring instance, or NULL and `errno` is set.
+static struct uring_s* uringget(void) {
+  pthread_once(&uringonce, uringmkkey);
+  if (atomic_load(&uringunavail)) {
+    errno = ENOSYS;
+    return NULL;
+  }
+  struct uring_s* r = pthread_getspecific(uringkey);
+  if (r != NULL) return r;
+  if ((r = uringnew()) == NULL) {
+    log_error("io_uring unavailable, using synchronous stat: %s",
+              strerror(errno));
+    atomic_store(&uringunavail, true);
+    errno = ENOSYS;
+    return NULL;
+  }
+  if (pthread_setspecific(uringkey, r)) {
+    uringfree(r);
+    errno = ENOMEM;
+    return NULL;
+  }
+  return r;
+}
+
+/// @brief Copies the result of a completed stat request.
+/// @param req The stat request
+/// @param stx The completed stat buffer
+/// @param res The completion result, 0 or a negated error number
+static void uringdone(struct uringreq_s* req, const struct statx* stx,
+                      const int res) {
+  if ((req->err = -res)) return;
+  const struct statx_timestamp ts = stx->stx_mtime; /* last modified */
+  req->st.lmod = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  req->st.fsze = stx->stx_size;
+  req->st.ctag = fschangetag(stx->stx_ino, stx->stx_ctime.tv_sec,
+                             stx->stx_ctime.tv_nsec);
+  if (req->wantdir) req->dir = S_ISDIR(stx->stx_mode);
+}
+
+int uringstat(const int dfd, struct uringreq_s* reqs, const size_t n) {
+  struct uring_s* r;
+  if ((r = uringget()) == NULL) return -1;
+
+  // stack of free in flight slots, slot i is free if it is below `nfree`
+  unsigned int freeslots[URINGENTRIES];
+  unsigned int nfree = 0;
+  for (unsigned int i = 0; i < r->entries && i < URINGENTRIES; i++)
+    freeslots[nfree++] = i;
+
+  size_t next = 0;           /* next request to queue */
+  unsigned int unsubmit = 0; /* queued but not yet submitted */
+  unsigned int inflight = 0; /* submitted but not yet completed */
+  while (next < n || unsubmit > 0 || inflight > 0) {
+    // queue as many requests as there are free slots
+    unsigned int tail = *r->sqtail;
+    while (next < n && nfree > 0) {
+      const unsigned int slot = freeslots[--nfree];
+      struct uringreq_s* req = &reqs[next];
+      const unsigned int idx = tail & r->sqmask;
+      struct io_uring_sqe* sqe = &r->sqes[idx];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_STATX;
+      sqe->fd = dfd;
+      sqe->addr = (uint64_t) (uintptr_t) req->fp;
+      sqe->addr2 = (uint64_t) (uintptr_t) &r->stxs[slot];
+      sqe->len = STATX_MTIME | STATX_SIZE | STATX_INO | STATX_CTIME |
+                 (req->wantdir ? STATX_TYPE : 0);
+      sqe->statx_flags = req->follow ? 0 : AT_SYMLINK_NOFOLLOW;
+      sqe->user_data = slot;
+      r->slots[slot] = next++;
+      r->sqarray[idx] = idx;
+      tail++, unsubmit++;
+    }
+    __atomic_store_n(r->sqtail, tail, __ATOMIC_RELEASE);
+
+    // submit queued requests and wait for at least one completion
+    const int ret = (int) syscall(__NR_io_uring_enter, r->fd, unsubmit, 1,
+                                  IORING_ENTER_GETEVENTS, NULL, 0);
+    if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      // requests may still be in flight, so the ring can no longer be reused
+      log_error("io_uring submit error: %s", strerror(errno));
+      pthread_setspecific(uringkey, NULL);
+      if (inflight == 0) uringfree(r);
+      return -1;
+    }
+    if (ret > 0) unsubmit -= (unsigned int) ret, inflight += (unsigned int) ret;
+
+    // reap all available completions
+    unsigned int head = *r->cqhead;
+    const unsigned int ctail = __atomic_load_n(r->cqtail, __ATOMIC_ACQUIRE);
+    for (; head != ctail; head++) {
+      const struct io_uring_cqe* cqe = &r->cqes[head & r->cqmask];
+      const unsigned int slot = (unsigned int) cqe->user_data;
+      uringdone(&reqs[r->slots[slot]], &r->stxs[slot], cqe->res);
+      freeslots[nfree++] = slot;
+      inflight--;
+    }
+    __atomic_store_n(r->cqhead, head, __ATOMIC_RELEASE);
+  }
+  return 0;
+}
+
+#else
+
+int uringstat(const int dfd, struct uringreq_s* reqs, const size_t n) {
+  (void) dfd, (void) reqs, (void) n;
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif
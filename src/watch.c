@@ -0,0 +1,210 @@
+/// @file watch.c
+/// @brief Recursive directory change notifications using Linux inotify.
+#include "watch.h"
+
+#include <errno.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "fs.h"
+#include "log.h"
+
+/// @def WATCHMASK
+/// @brief The inotify events watched for each directory. File creation alone
+/// is not watched, since a created file is usually still being written and is
+/// reported by `IN_CLOSE_WRITE` once complete.
+#define WATCHMASK                                                              \
+  (IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM |        \
+   IN_MOVED_TO | IN_ONLYDIR)
+
+int watchopen(struct watch_s* w) {
+  *w = (struct watch_s){.fd = -1};
+  if ((w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) return -1;
+  return 0;
+}
+
+/// @brief Sets the changed path buffer to the directory path \p dir joined with
+/// the entry \p name, growing the buffer as required.
+/// @param w The instance
+/// @param dir The directory path
+/// @param name The entry name
+/// @return The changed path, or NULL if an allocation error occurred.
+static const char* watchpath(struct watch_s* w, const char* dir,
+                             const char* name) {
+  const size_t dlen = strlen(dir);
+  const size_t len = dlen + strlen(name) + 2;
+  if (len > w->fpcap) {
+    const size_t cap = len * 2;
+    char* fp;
+    if ((fp = realloc(w->fp, cap)) == NULL) return NULL;
+    w->fp = fp, w->fpcap = cap;
+  }
+  memcpy(w->fp, dir, dlen);
+  w->fp[dlen] = '/';
+  strcpy(w->fp + dlen + 1, name);
+  return w->fp;
+}
+
+/// @brief `fswalk` file callback which ignores files.
+/// @param fp The file path (unused)
+/// @param st The stat info of the file (unused)
+/// @param udata The instance (unused)
+/// @return 0 in all cases
+static int watchskip(const char* fp, const struct fsstat_s* st, void* udata) {
+  (void) fp, (void) st, (void) udata;
+  return 0;
+}
+
+/// @brief Determines whether directory \p dir is pruned and not watched.
+/// @param w The instance
+/// @param dir The directory path
+/// @return true if the directory is pruned, otherwise false
+static bool watchpruned(const struct watch_s* w, const char* dir) {
+  return w->prune != NULL && w->prune(dir);
+}
+
+/// @brief `fswalk` directory callback for `watchadd`, which skips pruned
+/// directories.
+/// @param fp The directory path
+/// @param st The stat info of the directory (unused)
+/// @param udata The instance
+/// @return 0 if successful, otherwise -1 and `errno` is set.
+static int watchaddfn(const char* fp, const struct fsstat_s* st, void* udata) {
+  (void) st;
+  if (watchpruned(udata, fp)) return 0;
+  return watchadd(udata, fp);
+}
+
+int watchadd(struct watch_s* w, const char* dir) {
+  int wd;
+  if ((wd = inotify_add_watch(w->fd, dir, WATCHMASK)) < 0) {
+    // directories removed before they could be watched are not errors
+    if (errno == ENOENT || errno == ENOTDIR) return 0;
+    log_error("error watching `%s`: %s", dir, strerror(errno));
+    return -1;
+  }
+  if (wd >= w->cap) {
+    const int cap = wd * 2 + 16;
+    char** dirs;
+    if ((dirs = realloc(w->dirs, cap * sizeof(*dirs))) == NULL) return -1;
+    memset(dirs + w->cap, 0, (cap - w->cap) * sizeof(*dirs));
+    w->dirs = dirs, w->cap = cap;
+  }
+  // an already watched directory (e.g. moved) returns its existing descriptor
+  char* d;
+  if ((d = strdup(dir)) == NULL) return -1;
+  free(w->dirs[wd]);
+  w->dirs[wd] = d;
+
+  return fswalk(dir, watchskip, watchaddfn, w, 0);
+}
+
+/// @brief Stops watching directory \p dir and all watched directories within
+/// its subtree, e.g. once it has been moved out of its watched parent.
+/// @param w The instance
+/// @param dir The directory path
+static void watchrmtree(struct watch_s* w, const char* dir) {
+  const size_t len = strlen(dir);
+  for (int wd = 0; wd < w->cap; wd++) {
+    char* d = w->dirs[wd];
+    if (d == NULL || strncmp(d, dir, len) != 0) continue;
+    if (d[len] != '\0' && d[len] != '/') continue;
+    inotify_rm_watch(w->fd, wd);
+    free(d);
+    w->dirs[wd] = NULL;
+  }
+}
+
+int watchwait(struct watch_s* w, const int timeout) {
+  struct pollfd pfd = {w->fd, POLLIN, 0};
+  const int n = poll(&pfd, 1, timeout);
+  if (n < 0) return -1;
+  return n > 0 ? 1 : 0;
+}
+
+int watchread(struct watch_s* w, watchfn_t fn, void* udata) {
+  _Alignas(struct inotify_event) char buf[16384];
+  for (;;) {
+    const ssize_t n = read(w->fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return errno == EAGAIN ? 0 : -1;
+
+    const struct inotify_event* ev;
+    for (ssize_t off = 0; off < n; off += sizeof(*ev) + ev->len) {
+      ev = (const struct inotify_event*) (buf + off);
+      if (ev->mask & IN_Q_OVERFLOW) {
+        w->overflow = true;
+        continue;
+      }
+      if (ev->wd < 0 || ev->wd >= w->cap || w->dirs[ev->wd] == NULL) continue;
+      if (ev->mask & IN_IGNORED) {
+        // the directory was removed, or its watch was removed by `watchrmtree`
+        free(w->dirs[ev->wd]);
+        w->dirs[ev->wd] = NULL;
+        continue;
+      }
+      if (ev->len == 0 || ev->name[0] == '.') continue;// skip hidden entries
+
+      const bool dir = ev->mask & IN_ISDIR;
+      if (dir && !(ev->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                               IN_MOVED_TO)))
+        continue;
+      if (!dir && !(ev->mask & ~IN_CREATE)) continue;
+
+      const char* fp;
+      if ((fp = watchpath(w, w->dirs[ev->wd], ev->name)) == NULL) return -1;
+      if (dir && (ev->mask & IN_MOVED_FROM)) watchrmtree(w, fp);
+      if (dir && (ev->mask & (IN_CREATE | IN_MOVED_TO)) &&
+          !watchpruned(w, fp) && watchadd(w, fp))
+        log_error("changes within `%s` will not be detected", fp);
+
+      int err;
+      if ((err = fn(fp, udata))) return err;
+    }
+  }
+}
+
+void watchclose(struct watch_s* w) {
+  if (w->fd >= 0) close(w->fd);
+  for (int wd = 0; wd < w->cap; wd++) free(w->dirs[wd]);
+  free(w->dirs);
+  free(w->fp);
+  *w = (struct watch_s){.fd = -1};
+}
+
+#else
+
+int watchopen(struct watch_s* w) {
+  *w = (struct watch_s){.fd = -1};
+  errno = ENOSYS;
+  return -1;
+}
+
+int watchadd(struct watch_s* w, const char* dir) {
+  (void) w, (void) dir;
+  errno = ENOSYS;
+  return -1;
+}
+
+int watchwait(struct watch_s* w, const int timeout) {
+  (void) w, (void) timeout;
+  errno = ENOSYS;
+  return -1;
+}
+
+int watchread(struct watch_s* w, watchfn_t fn, void* udata) {
+  (void) w, (void) fn, (void) udata;
+  errno = ENOSYS;
+  return -1;
+}
+
+void watchclose(struct watch_s* w) { *w = (struct watch_s){.fd = -1}; }
+
+#endif
@@ -1,8 +1,13 @@
 #undef NDEBUG
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "deng.h"
 #include "index.h"
@@ -37,6 +42,42 @@ static void onnop(struct inode_s* in) {
   evcounts.nop++;
 }
 
+static int npruned; /* number of first stage calls to `pruneall` */
+
+static bool pruneall(const char* dir, const bool post) {
+  assert(dir != NULL);
+  if (!post) npruned++;
+  return true;
+}
+
+static int nmatched; /* number of files filtered by `matchtxt` */
+
+static bool matchtxt(const char* fp, uint64_t* mask) {
+  nmatched++;
+  *mask = strstr(fp, ".txt") != NULL ? 1 : 0;
+  return *mask == 0;
+}
+
+/* writes `content` to `fp` and sets its mtime, so the file's stat info only
+ * differs from a previous version by its inode and change time */
+static void writefile(const char* fp, const char* content) {
+  FILE* f = fopen(fp, "w");
+  assert(f != NULL && fputs(content, f) >= 0 && fclose(f) == 0);
+  const struct timespec ts[2] = {{0, UTIME_OMIT}, {1000, 0}};
+  assert(utimensat(AT_FDCWD, fp, ts, 0) == 0);
+}
+
+/* creates `<fp>.out` for each new file which is not an output itself, like a
+ * command which writes its output next to its input */
+static void onnewout(struct inode_s* in) {
+  onnew(in);
+  const size_t len = strlen(in->fp);
+  if (len > 4 && strcmp(in->fp + len - 4, ".out") == 0) return;
+  char fp[256];
+  snprintf(fp, sizeof(fp), "%s.out", in->fp);
+  writefile(fp, "output");
+}
+
 struct scantest_s {
   const char* sd;                   /* initial search directory */
   _Bool hasindex;                   /* has `index.dat` file in directory */
@@ -64,9 +105,21 @@ int main(void) {
           .nop = onnop,
   };
 
-  for (int i = 0; i < SCANTESTCOUNT; i++) {
-    const struct scantest_s* test = &scantests[i];
-    log_verbose("running test %d against `%s`", i, test->sd);
+  /* each test is run using each combination of the search option flags, and
+   * both sequential and parallel scanning */
+  static const int modes[] = {0, DENG_OPT_MERGE, DENG_OPT_DIRSKIP,
+                              DENG_OPT_MERGE | DENG_OPT_DIRSKIP,
+                              DENG_OPT_POSTDIRS,
+                              DENG_OPT_MERGE | DENG_OPT_POSTDIRS};
+  const int modecount = sizeof(modes) / sizeof(modes[0]);
+
+  for (int i = 0; i < SCANTESTCOUNT * modecount * 2; i++) {
+    const struct scantest_s* test = &scantests[i % SCANTESTCOUNT];
+    const int flags = modes[i / SCANTESTCOUNT % modecount];
+    const int threads = i < SCANTESTCOUNT * modecount ? 1 : 4;
+    const struct deng_opts_s opts = {flags, 0, threads, NULL, NULL};
+    log_verbose("running test %d against `%s` (flags 0x%02X, %d threads)", i,
+                test->sd, flags, threads);
 
     struct index_s old = {0};
     struct index_s new = {0};
@@ -81,7 +134,7 @@ int main(void) {
       log_verbose("using fixed index `%s`", fp);
     }
 
-    assert(dengsearch(test->sd, NULL, &hooks, &old, &new) == 0);
+    assert(dengsearch(test->sd, NULL, &hooks, &old, &new, &opts) == 0);
 
     log_verbose("%d new files (expected %d)", evcounts.new, test->expected.new);
     log_verbose("%d del files (expected %d)", evcounts.del, test->expected.del);
@@ -95,9 +148,252 @@ int main(void) {
 
     memset(&evcounts, 0, sizeof(evcounts));
 
+    /* a rescan against the updated index must find every file unmodified */
+    struct index_s next = {0};
+    assert(dengsearch(test->sd, NULL, &hooks, &new, &next, &opts) == 0);
+    assert(evcounts.new == 0 && evcounts.del == 0 && evcounts.mod == 0);
+    assert(evcounts.nop == new.size - new.dirs);
+    assert(next.size == new.size && next.dirs == new.dirs);
+
+    memset(&evcounts, 0, sizeof(evcounts));
+
     indexfree(&old);
     indexfree(&new);
+    indexfree(&next);
+  }
+
+  /* reconciling single paths reports only changes and removes deleted nodes,
+   * including the subtree of a deleted directory */
+  const struct deng_opts_s opts = {0, 0, 1, NULL, NULL};
+  struct index_s idx = {0};
+  assert(dengsync("../test/new-files-test", NULL, &hooks, &idx, &opts) == 0);
+  assert(evcounts.new == 3 && idx.size == 4 && idx.dirs == 1);
+  assert(dengsync("../test/new-files-test", NULL, &hooks, &idx, &opts) == 0);
+  assert(evcounts.new == 3 && evcounts.mod == 0 && evcounts.nop == 0);
+  const struct inode_s gone[] = {{"../test/gone", {0}, INODE_DIR, 0, 0, 0},
+                                 {"../test/gone/file", {0}, 0, 0, 0, 0}};
+  assert(indexput(&idx, gone[0]) != NULL && indexput(&idx, gone[1]) != NULL);
+  assert(dengsync("../test/gone", NULL, &hooks, &idx, &opts) == 0);
+  assert(evcounts.del == 1 && idx.size == 4 && idx.dirs == 1);
+  const struct inode_s lost[] = {
+      {"../test/new-files-test/gone", {0}, INODE_DIR, 0, 0, 0},
+      {"../test/new-files-test/gone/sub", {0}, INODE_DIR, 0, 0, 0},
+      {"../test/new-files-test/gone/sub/file", {0}, 0, 0, 0, 0},
+      {"../test/new-files-test/gone.txt", {0}, 0, 0, 0, 0}};
+  for (int i = 0; i < 4; i++) assert(indexput(&idx, lost[i]) != NULL);
+  indexfind(&idx, "../test/new-files-test")->st.fsze = 5;
+  assert(dengsync("../test/new-files-test", NULL, &hooks, &idx, &opts) == 0);
+  assert(evcounts.del == 3 && idx.size == 4 && idx.dirs == 1);
+  for (int i = 0; i < 3; i++) {
+    static const char* names[] = {"file1.txt", "file2.jpg", "file3.properties"};
+    char fp[256];
+    snprintf(fp, sizeof(fp), "../test/new-files-test/%s", names[i]);
+    assert(indexfind(&idx, fp) != NULL);
+  }
+  indexfree(&idx);
+  memset(&evcounts, 0, sizeof(evcounts));
+
+  /* ingesting changed paths only reports and updates the listed paths */
+  struct index_s old = {0};
+  struct index_s new = {0};
+  FILE* f = fopen("../test/deleted-files-test/index.dat", "r");
+  assert(f != NULL && indexread(&old, f) == 0);
+  fclose(f);
+  char changes[] = "file1.txt\n../test/deleted-files-test/file2.jpg\n";
+  f = fmemopen(changes, strlen(changes), "r");
+  assert(f != NULL);
+  assert(dengchanges("../test/deleted-files-test", f, NULL, &hooks, &old,
+                     &new, &opts) == 0);
+  fclose(f);
+  assert(evcounts.del == 2 && evcounts.new == 0 && new.size == 1);
+  indexfree(&new);
+  indexfree(&old);
+  memset(&evcounts, 0, sizeof(evcounts));
+
+  /* pruned directories are neither listed nor counted as children */
+  struct deng_stats_s stats = {0};
+  const struct deng_opts_s popts = {0, 0, 1, pruneall, &stats};
+  assert(dengsearch("../test", NULL, &hooks, &old, &new, &popts) == 0);
+  assert(stats.pruned == 4 && new.dirs == 1 && npruned == 4);
+  assert(indexfind(&new, "../test")->st.fsze == (uint64_t) new.size - 1);
+  assert(indexfind(&new, "../test/new-files-test/file1.txt") == NULL);
+  indexfree(&new);
+  memset(&evcounts, 0, sizeof(evcounts));
+
+  /* match masks persist in the index while its mask hash is unchanged, so
+   * known files are not filtered again, otherwise they are discarded */
+  new.maskhash = 1;
+  assert(dengsearch("../test/new-files-test", matchtxt, &hooks, &old, &new,
+                    &opts) == 0);
+  assert(nmatched == 5 && new.size == 2); /* ignored ones again when done */
+  const char* txtfp = "../test/new-files-test/file1.txt";
+  const struct inode_s* txt = indexfind(&new, txtfp);
+  assert(txt != NULL && (txt->flags & INODE_MASK) && txt->mask == 1);
+  for (int bin = 0; bin < 2; bin++) {
+    for (uint64_t hash = 1; hash <= 2; hash++) {
+      f = tmpfile();
+      assert(f != NULL);
+      assert((bin ? indexwritebin(&new, f) : indexwrite(&new, f)) == 0);
+      rewind(f);
+      struct index_s next = {.maskhash = hash};
+      assert(indexread(&next, f) == 0 && next.size == new.size);
+      fclose(f);
+      txt = indexfind(&next, txtfp);
+      assert(txt != NULL && !!(txt->flags & INODE_MASK) == (hash == 1));
+
+      struct index_s last = {.maskhash = hash};
+      nmatched = 0;
+      assert(dengsearch("../test/new-files-test", matchtxt, &hooks, &next,
+                        &last, &opts) == 0);
+      assert(nmatched == (hash == 1 ? 4 : 5) && evcounts.nop == 1);
+      assert(indexfind(&last, txtfp)->mask == 1);
+      memset(&evcounts, 0, sizeof(evcounts));
+      indexfree(&last);
+      indexfree(&next);
+    }
+  }
+  indexfree(&new);
+
+  /* subtrees are listed in sorted order, tracking later inserts and removals
+   * until the sorted view is rebuilt */
+  struct index_s sub = {0};
+  const char* subfps[] = {"a", "a/b", "a/b/c", "a-x", "a/d", "ab"};
+  for (int i = 0; i < 6; i++) {
+    const struct inode_s node = {(char*) subfps[i], {0}, 0, 0, 0, 0};
+    assert(indexput(&sub, node));
+  }
+  long nsub;
+  struct inode_s** subfl = indexsubtree(&sub, "a", &nsub);
+  assert(subfl != NULL && nsub == 3 && strcmp(subfl[1]->fp, "a/b/c") == 0);
+  free(subfl);
+  assert(indexdel(&sub, "a/b/c") != NULL);
+  assert(indexput(&sub, (struct inode_s){"a/c", {0}, 0, 0, 0, 0}));
+  for (int i = 0; i < 64; i++) {
+    subfl = indexsubtree(&sub, "a", &nsub);
+    assert(subfl != NULL && nsub == 3 && strcmp(subfl[1]->fp, "a/c") == 0);
+    free(subfl);
+    char fp[8];
+    snprintf(fp, sizeof(fp), "b/%d", i);
+    assert(indexput(&sub, (struct inode_s){fp, {0}, 0, 0, 0, 0}));
+  }
+  indexfree(&sub);
+
+  /* a text index is never mistaken for a binary index, and a binary index of
+   * another version is rejected */
+  struct index_s fsai = {0};
+  assert(indexput(&fsai, (struct inode_s){"FSAI", {1, 2, 3}, 0, 0, 0, 0}));
+  for (int bin = 0; bin < 2; bin++) {
+    f = tmpfile();
+    assert(f != NULL);
+    assert((bin ? indexwritebin(&fsai, f) : indexwrite(&fsai, f)) == 0);
+    rewind(f);
+    struct index_s next = {0};
+    assert(indexread(&next, f) == 0 && next.size == 1);
+    assert(indexfind(&next, "FSAI")->st.fsze == 2);
+    indexfree(&next);
+    if (bin) {
+      const uint32_t version = 2;
+      assert(fseek(f, 4, SEEK_SET) == 0 && fwrite(&version, 4, 1, f) == 1);
+      rewind(f);
+      assert(indexread(&next, f) == -1 && errno == EINVAL);
+      indexfree(&next);
+    }
+    fclose(f);
+  }
+  indexfree(&fsai);
+
+  /* with content digests, a touched file is unmodified, while a file replaced
+   * by one of the same size and mtime is modified */
+  char tmpdir[] = "/tmp/test_deng.XXXXXX";
+  assert(mkdtemp(tmpdir) != NULL);
+  char tmpfp[64], newfp[64];
+  snprintf(tmpfp, sizeof(tmpfp), "%s/file", tmpdir);
+  snprintf(newfp, sizeof(newfp), "%s/file.new", tmpdir);
+  for (int threads = 1; threads <= 4; threads += 3) {
+    memset(&stats, 0, sizeof(stats));
+    const struct deng_opts_s dopts = {DENG_OPT_DIGEST, 0, threads, NULL,
+                                      &stats};
+    struct index_s idx[4] = {0};
+    writefile(tmpfp, "content1");
+    assert(dengsearch(tmpdir, NULL, &hooks, &idx[0], &idx[1], &dopts) == 0);
+    const struct inode_s* node = indexfind(&idx[1], tmpfp);
+    assert(evcounts.new == 1 && (node->flags & INODE_DIGEST));
+    assert(utimensat(AT_FDCWD, tmpfp, NULL, 0) == 0);
+    assert(dengsearch(tmpdir, NULL, &hooks, &idx[1], &idx[2], &dopts) == 0);
+    assert(evcounts.nop == 1 && evcounts.mod == 0 && stats.touched == 1);
+    writefile(newfp, "content2");
+    assert(rename(newfp, tmpfp) == 0);
+    assert(dengsearch(tmpdir, NULL, &hooks, &idx[2], &idx[3], &dopts) == 0);
+    assert(evcounts.mod == 1 && stats.digests == 3);
+    memset(&evcounts, 0, sizeof(evcounts));
+
+    /* digests persist in both index formats */
+    f = tmpfile();
+    assert(f != NULL);
+    assert((threads > 1 ? indexwritebin(&idx[3], f)
+                        : indexwrite(&idx[3], f)) == 0);
+    rewind(f);
+    struct index_s next = {0};
+    assert(indexread(&next, f) == 0);
+    fclose(f);
+    node = indexfind(&idx[3], tmpfp);
+    const struct inode_s* read = indexfind(&next, tmpfp);
+    assert(read != NULL && (read->flags & INODE_DIGEST));
+    assert(read->digest == node->digest && read->st.ctag == node->st.ctag);
+    indexfree(&next);
+    for (int i = 0; i < 4; i++) indexfree(&idx[i]);
+  }
+
+  /* a file edited in place under a skipped directory keeps its previous stat
+   * info until the directory's files are re-stat'ed, and is then modified */
+  const struct timespec olddir[2] = {{0, UTIME_OMIT}, {1000, 0}};
+  for (int threads = 1; threads <= 4; threads += 3) {
+    const struct deng_opts_s sopts = {DENG_OPT_DIRSKIP, 2, threads, NULL,
+                                      NULL};
+    struct index_s idx[4] = {0};
+    writefile(tmpfp, "content");
+    assert(utimensat(AT_FDCWD, tmpdir, olddir, 0) == 0);
+    assert(dengsearch(tmpdir, NULL, &hooks, &idx[0], &idx[1], &sopts) == 0);
+    writefile(tmpfp, "edited content");
+    assert(dengsearch(tmpdir, NULL, &hooks, &idx[1], &idx[2], &sopts) == 0);
+    assert(evcounts.nop == 1 && evcounts.mod == 0);
+    assert(dengsearch(tmpdir, NULL, &hooks, &idx[2], &idx[3], &sopts) == 0);
+    assert(evcounts.mod == 1);
+    memset(&evcounts, 0, sizeof(evcounts));
+    for (int i = 0; i < 4; i++) indexfree(&idx[i]);
+  }
+
+  /* ingesting changed paths indexes the files created by the commands of the
+   * changed files, so the index matches the index of a full search */
+  const struct deng_hooks_s outhooks = {.new = onnewout, .del = ondel};
+  char srcfp[64], outfp[64];
+  snprintf(srcfp, sizeof(srcfp), "%s/src", tmpdir);
+  snprintf(outfp, sizeof(outfp), "%s/src.out", tmpdir);
+  for (int threads = 1; threads <= 4; threads += 3) {
+    const struct deng_opts_s copts = {0, 0, threads, NULL, NULL};
+    struct index_s idx[4] = {0};
+    assert(dengsearch(tmpdir, NULL, &hooks, &idx[0], &idx[1], &copts) == 0);
+    memset(&evcounts, 0, sizeof(evcounts));
+    writefile(srcfp, "source");
+    char srcchanges[] = "src\n";
+    f = fmemopen(srcchanges, strlen(srcchanges), "r");
+    assert(f != NULL);
+    assert(dengchanges(tmpdir, f, NULL, &outhooks, &idx[1], &idx[2], &copts) ==
+           0);
+    fclose(f);
+    assert(evcounts.new == 2 && indexfind(&idx[2], outfp) != NULL);
+    memset(&evcounts, 0, sizeof(evcounts));
+    assert(dengsearch(tmpdir, NULL, &hooks, &idx[2], &idx[3], &copts) == 0);
+    assert(evcounts.new == 0 && evcounts.del == 0 && evcounts.mod == 0);
+    assert(idx[3].size == idx[2].size);
+    assert(indexfind(&idx[2], tmpdir)->st.fsze == 3);
+    memset(&evcounts, 0, sizeof(evcounts));
+    for (int i = 0; i < 4; i++) indexfree(&idx[i]);
+    unlink(srcfp);
+    unlink(outfp);
   }
+  unlink(tmpfp);
+  rmdir(tmpdir);
 
   return 0;
 }
@@ -0,0 +1,107 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coproc.h"
+#include "fd.h"
+#include "index.h"
+#include "lcmd.h"
+#include "tm.h"
+
+#define LONGPATHS 64     /* number of long file paths to batch */
+#define LONGPATHLEN 4000 /* length of each long file path */
+
+/* counts the lines of a file */
+static int countlines(const char* fp) {
+  FILE* f = fopen(fp, "r");
+  assert(f != NULL);
+  int n = 0;
+  for (int c; (c = fgetc(f)) != EOF;) n += c == '\n';
+  fclose(f);
+  return n;
+}
+
+int main(void) {
+  char cfgfp[] = "/tmp/test_lcmd.XXXXXX";
+  char outfp[] = "/tmp/test_lcmd.XXXXXX";
+  int fd;
+  assert((fd = mkstemp(cfgfp)) >= 0);
+  close(fd);
+  assert((fd = mkstemp(outfp)) >= 0);
+  close(fd);
+
+  /* batches of long paths passed by environment stay below the size limit
+   * of a single environment string, so every batch is spawned */
+  FILE* f = fopen(cfgfp, "w");
+  assert(f != NULL);
+  fprintf(f,
+          "[{\"on\": [\"nop\"], \"patterns\": [\"^/\"], \"batch\": true, "
+          "\"commands\": [\"printf '%%s\\\\n' \\\"$FILEPATHS\\\" >> %s\"]}]",
+          outfp);
+  fclose(f);
+  struct lcmdset_s** cs = lcmdparse(cfgfp, ".");
+  assert(cs != NULL);
+  struct fdset_s fds = {.out = STDOUT_FILENO, .err = STDERR_FILENO};
+  struct inode_s nodes[LONGPATHS] = {0};
+  for (int i = 0; i < LONGPATHS; i++) {
+    char* fp = malloc(LONGPATHLEN + 1);
+    assert(fp != NULL);
+    memset(fp, 'a', LONGPATHLEN);
+    fp[0] = '/', fp[LONGPATHLEN] = '\0';
+    nodes[i].fp = fp;
+    assert(lcmdexec(cs, &nodes[i], &fds, LCTRIG_NOP) == 0);
+  }
+  assert(lcmdflush(cs, &fds, 0) == 0);
+  assert(countlines(outfp) == LONGPATHS);
+  for (int i = 0; i < LONGPATHS; i++) free(nodes[i].fp);
+  lcmdfree_r(cs);
+
+  /* `{relpath}` and `{reldir}` are relative to the search directory */
+  char sd[] = "/tmp/test_lcmd.XXXXXX";
+  assert(mkdtemp(sd) != NULL);
+  f = fopen(cfgfp, "w");
+  assert(f != NULL);
+  fprintf(f,
+          "[{\"on\": [\"nop\"], \"patterns\": [\"\\\\.in$\"], "
+          "\"commands\": [\"@mkdir %s/out/{reldir}\", "
+          "\"@touch %s/out/{relpath}\"]}]",
+          sd, sd);
+  fclose(f);
+  assert((cs = lcmdparse(cfgfp, sd)) != NULL);
+  char fp[64], dstfp[64];
+  snprintf(fp, sizeof(fp), "%s/sub/file.in", sd);
+  snprintf(dstfp, sizeof(dstfp), "%s/out/sub/file.in", sd);
+  struct inode_s node = {.fp = fp};
+  assert(lcmdexec(cs, &node, &fds, LCTRIG_NOP) == 0);
+  assert(access(dstfp, F_OK) == 0);
+  lcmdfree_r(cs);
+  unlink(dstfp);
+  snprintf(fp, sizeof(fp), "%s/out/sub", sd);
+  rmdir(fp);
+  snprintf(fp, sizeof(fp), "%s/out", sd);
+  rmdir(fp);
+  rmdir(sd);
+
+  /* a coprocess which does not reply in time fails its request and is
+   * stopped instead of blocking the worker thread */
+  f = fopen(cfgfp, "w");
+  assert(f != NULL);
+  fputs("[{\"on\": [\"nop\"], \"patterns\": [\"\\\\.co$\"], "
+        "\"coproc\": {\"timeout\": 100}, \"commands\": [\"exec sleep 5\"]}]",
+        f);
+  fclose(f);
+  assert((cs = lcmdparse(cfgfp, ".")) != NULL);
+  node = (struct inode_s){.fp = "./file.co"};
+  const uint64_t start = tmnow();
+  assert(lcmdexec(cs, &node, &fds, LCTRIG_NOP) != 0);
+  assert(tmnow() - start < 3000 && fds.coprocs[0].pid == 0);
+  lcmdrelease(&fds);
+  lcmdfree_r(cs);
+
+  unlink(cfgfp);
+  unlink(outfp);
+  return 0;
+}
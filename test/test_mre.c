@@ -0,0 +1,44 @@
+#undef NDEBUG
+#include <assert.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mre.h"
+
+struct mretest_s {
+  const char* pattern; /* pattern executed by `regexec` */
+  const char* s;       /* string to match */
+  bool matches;        /* expected match result */
+};
+
+#define MRETESTCOUNT 4
+
+/* patterns using GNU escapes are executed by `regexec`, but only for strings
+ * containing their literals, which must not skip matching strings */
+static const struct mretest_s mretests[MRETESTCOUNT] = {
+    {"^/srv/\\w+\\.log$", "/srv/app.log", true},
+    {"^/srv/\\w+\\.log$", "/tmp/app.log", false},
+    {"ab+?c\\w*", "acx", true}, /* `b+?` is `(b+)?` */
+    {"ab++*c\\w", "acx", true},
+};
+
+int main(void) {
+  for (int i = 0; i < MRETESTCOUNT; i++) {
+    const struct mretest_s* test = &mretests[i];
+    regex_t reg;
+    assert(regcomp(&reg, test->pattern, REG_EXTENDED | REG_NOSUB) == 0);
+    assert((regexec(&reg, test->s, 0, NULL, 0) == 0) == test->matches);
+    struct mre_s* m = mrenew();
+    assert(m != NULL && mreadd(m, test->pattern, &reg, 0) == 0);
+    assert(mrebuild(m) == 0);
+    assert(mrematch(m, test->s, false) == (test->matches ? 1 : 0));
+    struct mrestats_s stats;
+    mrestats(m, &stats);
+    assert(stats.regexecs + stats.skipped == 1);
+    mrefree(m);
+    regfree(&reg);
+  }
+
+  return 0;
+}